@@ -0,0 +1,109 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Lexer throughput: scans generated corpora with scan_token() and reports
+// MB/s, tokens/s and allocations per token for each shape.
+//
+//   bench_lexer [shape] [megabytes] [iterations]
+//
+// With no shape every shape is run. The best iteration is reported.
+
+#include "bench/corpus.h"
+#include "src/allocator.h"
+#include "src/lexer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct LexRun {
+  double seconds;
+  size_t tokens;
+  size_t allocations;
+} LexRun;
+
+static LexRun lex_corpus(const char *src) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  Lexer lexer;
+  LexRun run = {0};
+  double start = now_seconds();
+  init_lexer(&lexer, src, &counting);
+  for (;;) {
+    Token token = scan_token(&lexer);
+    free_token_lexeme(&counting, token);
+    run.tokens++;
+    if (token.type == TOKEN_EOF)
+      break;
+  }
+  run.seconds = now_seconds() - start;
+  run.allocations = ctx.allocations;
+  return run;
+}
+
+static void bench_shape(CorpusShape shape, size_t bytes, int iterations) {
+  char *src = generate_corpus(shape, bytes, 0x5eed);
+  if (src == NULL) {
+    fprintf(stderr, "bench_lexer: out of memory\n");
+    exit(1);
+  }
+  size_t len = strlen(src);
+
+  LexRun best = lex_corpus(src);
+  for (int i = 1; i < iterations; i++) {
+    LexRun run = lex_corpus(src);
+    if (run.seconds < best.seconds)
+      best = run;
+  }
+
+  double mb = (double)len / (1024.0 * 1024.0);
+  printf("%-12s %8.2f MB %10.1f MB/s %8.2f Mtok/s %6.3f allocs/tok\n",
+         corpus_shape_name(shape), mb, mb / best.seconds,
+         (double)best.tokens / best.seconds / 1e6,
+         (double)best.allocations / (double)best.tokens);
+  free(src);
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 2 ? (size_t)strtoul(argv[2], NULL, 10) : 8;
+  int iterations = argc > 3 ? atoi(argv[3]) : 5;
+  if (megabytes == 0)
+    megabytes = 1;
+  if (iterations < 1)
+    iterations = 1;
+
+  if (argc > 1 && strcmp(argv[1], "all") != 0) {
+    CorpusShape shape;
+    if (!corpus_shape_from_name(argv[1], &shape)) {
+      fprintf(stderr, "bench_lexer: unknown shape '%s'\n", argv[1]);
+      return 1;
+    }
+    bench_shape(shape, megabytes << 20, iterations);
+    return 0;
+  }
+
+  for (int i = 0; i < CORPUS_SHAPE_COUNT; i++)
+    bench_shape((CorpusShape)i, megabytes << 20, iterations);
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Parser throughput: parses generated corpora with parse_program() and reports
+// lines/s, nodes/s, allocator traffic per thousand lines and peak RSS for each
+// shape, as one JSON document on stdout. Each shape is also stored in the AST
+// cache and timed as a cache hit.
+//
+//   bench_parser [shape] [megabytes] [iterations]
+//
+// With no shape every shape is run. The best iteration is reported; the
+// allocation counts are the same on every iteration. Peak RSS is the process
+// high-water mark so far, so it only grows from one shape to the next.
+
+#include "bench/corpus.h"
+#include "src/allocator.h"
+#include "src/ast.h"
+#include "src/ast_cache.h"
+#include "src/flat_ast.h"
+#include "src/lexer.h"
+#include "src/parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static size_t peak_rss_kb(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return (size_t)usage.ru_maxrss; // kilobytes on Linux
+}
+
+typedef struct ParseRun {
+  double seconds;
+  size_t nodes;
+  CountingContext counts;
+} ParseRun;
+
+static ParseRun parse_corpus(const char *src) {
+  ParseRun run = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free,
+                        &run.counts};
+
+  Lexer lexer;
+  Parser parser;
+  double start = now_seconds();
+  init_lexer(&lexer, src, &counting);
+  init_parser(&parser, &lexer, &counting);
+  Node *program = parse_program(&parser);
+  run.seconds = now_seconds() - start;
+
+  if (parser.had_error || program == NULL) {
+    fprintf(stderr, "bench_parser: corpus failed to parse\n");
+    exit(1);
+  }
+
+  // Counted outside the timed region: the flat form has one entry per node
+  FlatAst flat;
+  if (flatten_ast(&flat, program, &raw_allocator)) {
+    run.nodes = flat.count;
+    free_flat_ast(&flat);
+  }
+
+  free_node(&counting, program);
+  free_parser(&parser);
+  return run;
+}
+
+// Key, map and touch every page of the cached tree for `src`, best of
+// `iterations`. Returns a negative time if the entry can't be stored or loaded
+static double time_cache_hit(const char *src, size_t len, int iterations) {
+  char dir[] = "/tmp/dud_bench_cache_XXXXXX";
+  if (mkdtemp(dir) == NULL)
+    return -1;
+
+  Lexer lexer;
+  Parser parser;
+  init_lexer(&lexer, src, &raw_allocator);
+  init_parser(&parser, &lexer, &raw_allocator);
+  Node *program = parse_program(&parser);
+  FlatAst flat;
+  bool stored = flatten_ast(&flat, program, &raw_allocator);
+  uint64_t key = ast_cache_key(src, len);
+  stored = stored && store_cached_ast(dir, key, &flat);
+  if (flat.data != NULL)
+    free_flat_ast(&flat);
+  free_node(&raw_allocator, program);
+  free_parser(&parser);
+
+  double best = -1;
+  volatile unsigned char sink = 0;
+  for (int i = 0; stored && i < iterations; i++) {
+    double start = now_seconds();
+    CachedAst cached;
+    if (!load_cached_ast(&cached, dir, ast_cache_key(src, len)))
+      break;
+    const unsigned char *bytes = (const unsigned char *)cached.map;
+    for (size_t at = 0; at < cached.map_size; at += 4096)
+      sink ^= bytes[at];
+    unload_cached_ast(&cached);
+    double seconds = now_seconds() - start;
+    if (best < 0 || seconds < best)
+      best = seconds;
+  }
+  (void)sink;
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%016llx.ast", dir, (unsigned long long)key);
+  unlink(path);
+  rmdir(dir);
+  return best;
+}
+
+static size_t count_lines(const char *src) {
+  size_t lines = 1;
+  for (const char *c = strchr(src, '\n'); c; c = strchr(c + 1, '\n'))
+    lines++;
+  return lines;
+}
+
+static void bench_shape(CorpusShape shape, size_t bytes, int iterations,
+                        bool first) {
+  char *src = generate_corpus(shape, bytes, 0x5eed);
+  if (src == NULL) {
+    fprintf(stderr, "bench_parser: out of memory\n");
+    exit(1);
+  }
+  size_t len = strlen(src);
+  size_t lines = count_lines(src);
+
+  ParseRun best = parse_corpus(src);
+  for (int i = 1; i < iterations; i++) {
+    ParseRun run = parse_corpus(src);
+    if (run.seconds < best.seconds)
+      best = run;
+  }
+
+  double cache_hit = time_cache_hit(src, len, iterations);
+  double kloc = (double)lines / 1000.0;
+  printf("%s    {\"shape\": \"%s\", \"bytes\": %zu, \"lines\": %zu, "
+         "\"nodes\": %zu, \"seconds\": %.6f,\n"
+         "     \"lines_per_sec\": %.0f, \"nodes_per_sec\": %.0f, "
+         "\"mb_per_sec\": %.2f,\n"
+         "     \"allocs_per_kloc\": %.1f, \"bytes_per_kloc\": %.0f, "
+         "\"peak_live_bytes\": %zu, \"peak_rss_kb\": %zu,\n"
+         "     \"cache_hit_seconds\": %.6f, \"cache_hit_speedup\": %.1f}",
+         first ? "" : ",\n", corpus_shape_name(shape), len, lines, best.nodes,
+         best.seconds, (double)lines / best.seconds,
+         (double)best.nodes / best.seconds,
+         (double)len / (1024.0 * 1024.0) / best.seconds,
+         (double)best.counts.allocations / kloc,
+         (double)best.counts.allocated / kloc, best.counts.peak, peak_rss_kb(),
+         cache_hit, cache_hit > 0 ? best.seconds / cache_hit : 0.0);
+  fflush(stdout);
+  free(src);
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 2 ? (size_t)strtoul(argv[2], NULL, 10) : 4;
+  int iterations = argc > 3 ? atoi(argv[3]) : 3;
+  if (megabytes == 0)
+    megabytes = 1;
+  if (iterations < 1)
+    iterations = 1;
+
+  CorpusShape only = CORPUS_SHAPE_COUNT;
+  if (argc > 1 && strcmp(argv[1], "all") != 0 &&
+      !corpus_shape_from_name(argv[1], &only)) {
+    fprintf(stderr, "bench_parser: unknown shape '%s'\n", argv[1]);
+    return 1;
+  }
+
+  printf("{\"benchmark\": \"parser\", \"megabytes\": %zu, "
+         "\"iterations\": %d, \"runs\": [\n",
+         megabytes, iterations);
+  bool first = true;
+  for (int i = 0; i < CORPUS_SHAPE_COUNT; i++) {
+    if (only != CORPUS_SHAPE_COUNT && (CorpusShape)i != only)
+      continue;
+    bench_shape((CorpusShape)i, megabytes << 20, iterations, first);
+    first = false;
+  }
+  printf("\n]}\n");
+  return 0;
+}
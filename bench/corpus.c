@@ -0,0 +1,284 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "corpus.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Writer {
+  char *buf;
+  size_t len;
+  size_t cap;
+  uint64_t rng;
+} Writer;
+
+// xorshift64*: tiny, and identical on every platform
+static uint64_t next_random(Writer *w) {
+  w->rng ^= w->rng >> 12;
+  w->rng ^= w->rng << 25;
+  w->rng ^= w->rng >> 27;
+  return w->rng * UINT64_C(2685821657736338717);
+}
+
+static size_t pick(Writer *w, size_t n) { return (size_t)(next_random(w) % n); }
+
+static void emit(Writer *w, const char *fmt, ...) {
+  for (;;) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, args);
+    va_end(args);
+    if (n < 0)
+      return;
+    if (w->len + (size_t)n < w->cap) {
+      w->len += (size_t)n;
+      return;
+    }
+    w->cap = w->cap * 2 + (size_t)n;
+    w->buf = realloc(w->buf, w->cap);
+    if (w->buf == NULL) {
+      fprintf(stderr, "corpus: out of memory\n");
+      exit(1);
+    }
+  }
+}
+
+static void emit_indent(Writer *w, size_t depth) {
+  for (size_t i = 0; i < depth; i++)
+    emit(w, "    ");
+}
+
+static const char *syllables[] = {"ka", "ro", "mi", "tan", "vel", "or",
+                                  "su", "zen", "pa", "lu", "ex", "dri"};
+
+static void emit_name(Writer *w) {
+  size_t n = 2 + pick(w, 4);
+  for (size_t i = 0; i < n; i++) {
+    emit(w, "%s", syllables[pick(w, sizeof(syllables) / sizeof(*syllables))]);
+    if (i + 1 < n && pick(w, 3) == 0)
+      emit(w, "_");
+  }
+}
+
+static const char *words[] = {"the",    "quick", "lexer", "reads",  "every",
+                              "byte",   "once",  "and",   "emits",  "tokens",
+                              "string", "heavy", "input", "should", "stay"};
+
+static void emit_words(Writer *w, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const char *word = words[pick(w, sizeof(words) / sizeof(*words))];
+    emit(w, "%s%s", i ? " " : "", word);
+  }
+}
+
+static void emit_identifier_stmt(Writer *w, size_t depth) {
+  emit_indent(w, depth);
+  if (pick(w, 2) == 0) {
+    emit(w, "let ");
+    emit_name(w);
+    emit(w, " = ");
+  } else {
+    emit_name(w);
+    emit(w, pick(w, 2) ? " += " : " = ");
+  }
+  emit_name(w);
+  emit(w, ".");
+  emit_name(w);
+  emit(w, " * ");
+  emit_name(w);
+  emit(w, "(%zu, ", pick(w, 1000));
+  emit_name(w);
+  emit(w, ");\n");
+}
+
+static void emit_string_stmt(Writer *w, size_t depth) {
+  emit_indent(w, depth);
+  emit(w, "println(\"");
+  emit_words(w, 3 + pick(w, 12));
+  emit(w, "\", \"");
+  emit_words(w, 1 + pick(w, 6));
+  emit(w, "\");\n");
+}
+
+static void emit_comment_stmt(Writer *w, size_t depth) {
+  emit_indent(w, depth);
+  emit(w, "// ");
+  emit_words(w, 4 + pick(w, 10));
+  emit(w, "\n");
+  emit_indent(w, depth);
+  emit(w, "x = x + %zu;\n", pick(w, 100));
+}
+
+// A block nested 8-32 levels deep with one short statement per level
+static void emit_indented_block(Writer *w) {
+  size_t depth = 8 + pick(w, 25);
+  for (size_t i = 0; i < depth; i++) {
+    emit_indent(w, i + 1);
+    emit(w, "if x > %zu {\n", i);
+  }
+  emit_indent(w, depth + 1);
+  emit(w, "x = 0;\n");
+  for (size_t i = depth; i > 0; i--) {
+    emit_indent(w, i);
+    emit(w, "}\n");
+  }
+}
+
+static const char *binary_ops[] = {"+", "-", "*", "/", "%", "<", "==", "!="};
+
+// x = (a + (b * (c - ... z))); with the nesting 16-64 levels deep
+static void emit_deep_expr_stmt(Writer *w, size_t depth) {
+  size_t levels = 16 + pick(w, 49);
+  emit_indent(w, depth);
+  emit(w, "x = ");
+  for (size_t i = 0; i < levels; i++) {
+    size_t op = pick(w, sizeof(binary_ops) / sizeof(*binary_ops));
+    emit(w, "(");
+    emit_name(w);
+    emit(w, " %s ", binary_ops[op]);
+  }
+  emit(w, "%zu", pick(w, 1000));
+  for (size_t i = 0; i < levels; i++)
+    emit(w, ")");
+  emit(w, ";\n");
+}
+
+static void emit_body(Writer *w, CorpusShape shape) {
+  switch (shape) {
+  case CORPUS_IDENTIFIERS:
+    for (int i = 0; i < 8; i++)
+      emit_identifier_stmt(w, 1);
+    break;
+  case CORPUS_STRINGS:
+    for (int i = 0; i < 8; i++)
+      emit_string_stmt(w, 1);
+    break;
+  case CORPUS_COMMENTS:
+    for (int i = 0; i < 8; i++)
+      emit_comment_stmt(w, 1);
+    break;
+  case CORPUS_INDENTED:
+    emit_indented_block(w);
+    break;
+  case CORPUS_SMALL_FNS:
+    emit_indent(w, 1);
+    emit(w, "x += %zu;\n", pick(w, 1000));
+    break;
+  case CORPUS_DEEP_EXPRS:
+    for (int i = 0; i < 4; i++)
+      emit_deep_expr_stmt(w, 1);
+    break;
+  case CORPUS_MIXED:
+  case CORPUS_GIANT_FNS:
+  case CORPUS_TYPE_DECLS:
+  case CORPUS_SHAPE_COUNT:
+    emit_body(w, (CorpusShape)pick(w, CORPUS_MIXED));
+    break;
+  }
+}
+
+static void emit_fn(Writer *w, CorpusShape shape, size_t n) {
+  emit(w, "fn f%zu_", n);
+  emit_name(w);
+  emit(w, "(x: i32) i32 {\n");
+  if (shape == CORPUS_GIANT_FNS) {
+    for (int i = 0; i < 256; i++)
+      emit_body(w, CORPUS_MIXED);
+  } else {
+    emit_body(w, shape);
+  }
+  emit(w, "    return x;\n}\n\n");
+}
+
+static const char *field_types[] = {"i32", "u8", "f64", "bool", "String"};
+
+// A struct of 16-64 fields, then an enum of 16-64 variants
+static void emit_type_decls(Writer *w, size_t n) {
+  emit(w, "type T%zu_", n);
+  emit_name(w);
+  emit(w, " = struct {\n");
+  for (size_t i = 16 + pick(w, 49); i > 0; i--) {
+    emit_indent(w, 1);
+    emit_name(w);
+    emit(w, "%zu: ", i);
+    switch (pick(w, 3)) {
+    case 0:
+      emit(w, "^T%zu_", n);
+      emit_name(w);
+      break;
+    case 1:
+      emit(w, "[%zu]", 1 + pick(w, 64));
+      /* fallthrough */
+    default:
+      emit(w, "%s",
+           field_types[pick(w, sizeof(field_types) / sizeof(*field_types))]);
+      break;
+    }
+    emit(w, ",\n");
+  }
+  emit(w, "}\n\ntype E%zu_", n);
+  emit_name(w);
+  emit(w, " = enum {\n");
+  for (size_t i = 16 + pick(w, 49); i > 0; i--) {
+    emit_indent(w, 1);
+    emit_name(w);
+    if (pick(w, 4) == 0)
+      emit(w, "%zu = %zu", i, pick(w, 1000));
+    else
+      emit(w, "%zu", i);
+    emit(w, ",\n");
+  }
+  emit(w, "}\n\n");
+}
+
+char *generate_corpus(CorpusShape shape, size_t bytes, uint64_t seed) {
+  Writer w = {NULL, 0, 0, seed ? seed : 1};
+  w.cap = bytes + 4096;
+  w.buf = malloc(w.cap);
+  if (w.buf == NULL)
+    return NULL;
+  w.buf[0] = '\0';
+
+  for (size_t n = 0; w.len < bytes; n++) {
+    if (shape == CORPUS_TYPE_DECLS)
+      emit_type_decls(&w, n);
+    else
+      emit_fn(&w, shape, n);
+  }
+  return w.buf;
+}
+
+static const char *shape_names[] = {
+    "identifiers", "strings",   "comments",   "indented",   "mixed",
+    "small_fns",   "giant_fns", "deep_exprs", "type_decls",
+};
+
+const char *corpus_shape_name(CorpusShape shape) {
+  return shape < CORPUS_SHAPE_COUNT ? shape_names[shape] : "unknown";
+}
+
+bool corpus_shape_from_name(const char *name, CorpusShape *shape) {
+  for (int i = 0; i < CORPUS_SHAPE_COUNT; i++) {
+    if (strcmp(name, shape_names[i]) == 0) {
+      *shape = (CorpusShape)i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic dud sources for the benchmarks. Generation is deterministic: the
+// same shape, size and seed always produce the same text.
+typedef enum CorpusShape {
+  CORPUS_IDENTIFIERS, // let/assignment statements over long names
+  CORPUS_STRINGS,     // mostly string literals
+  CORPUS_COMMENTS,    // a comment line for every statement
+  CORPUS_INDENTED,    // deeply nested blocks, so mostly leading whitespace
+  CORPUS_MIXED,       // all of the above, interleaved
+  CORPUS_SMALL_FNS,   // many one-statement functions
+  CORPUS_GIANT_FNS,   // a few functions, each hundreds of KB long
+  CORPUS_DEEP_EXPRS,  // expressions parenthesised 16-64 levels deep
+  CORPUS_TYPE_DECLS,  // large struct and enum declarations
+  CORPUS_SHAPE_COUNT,
+} CorpusShape;
+
+const char *corpus_shape_name(CorpusShape shape);
+bool corpus_shape_from_name(const char *name, CorpusShape *shape);
+
+// A NUL-terminated source of about `bytes` bytes; release it with free()
+char *generate_corpus(CorpusShape shape, size_t bytes, uint64_t seed);
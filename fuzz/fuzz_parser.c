@@ -0,0 +1,314 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Performance fuzzer for scan_token() and parse_program(). Besides crashing
+// (build with -Db_sanitize=address,undefined to catch memory errors), an input
+// fails if the lexer or parser does super-linear work on it: the input is
+// repeated to about SMALL_BYTES, then GROWTH times as many copies, and the
+// work per copy is compared. Repeating a fragment like "((a" or "} else" also
+// deepens the nesting or lengthens the error-recovery run it sets off, which
+// is where quadratic behavior hides.
+//
+// Work is counted as tokens, nodes and allocator calls, which are
+// deterministic, and as wall time, which is only trusted once the larger run
+// takes long enough to measure and a best-of-three rerun agrees.
+//
+// Standalone:
+//
+//   fuzz_parser [-runs=N] [-seed=S] [file...]
+//
+// checks each file, or N generated inputs when no file is given, and saves
+// any slow input as slow-<hash>.dud in the working directory. Built with
+// -DDUD_LIBFUZZER and -fsanitize=fuzzer it is a libFuzzer target instead, and
+// a slow input aborts so libFuzzer keeps it as a crash artifact. fuzz/dud.dict
+// holds the language's tokens for libFuzzer's -dict= option.
+
+#include "src/allocator.h"
+#include "src/ast.h"
+#include "src/flat_ast.h"
+#include "src/lexer.h"
+#include "src/parser.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SMALL_BYTES 16384
+#define GROWTH 8
+#define MAX_INPUT 4096
+
+// Flag work growing more than this much faster than the input: 3x means an
+// exponent above ~1.5 between the two sizes
+#define SLOWDOWN_LIMIT 3.0
+
+// Time ratios below this many seconds of work are noise
+#define MIN_TIMED 0.001
+
+typedef struct Work {
+  size_t tokens;
+  size_t nodes;
+  size_t allocs; // allocator calls, frees included
+  double seconds;
+} Work;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static Work measure(const char *src) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+  Work work = {0, 0, 0, 0};
+  double start = now_seconds();
+
+  Lexer lexer;
+  init_lexer(&lexer, src, &counting);
+  for (;;) {
+    Token token = scan_token(&lexer);
+    free_token_lexeme(&counting, token);
+    work.tokens++;
+    if (token.type == TOKEN_EOF)
+      break;
+  }
+
+  Parser parser;
+  init_lexer(&lexer, src, &counting);
+  init_parser(&parser, &lexer, &counting);
+  Node *program = parse_program(&parser);
+  work.seconds = now_seconds() - start;
+
+  FlatAst flat;
+  if (flatten_ast(&flat, program, &raw_allocator)) {
+    work.nodes = flat.count;
+    free_flat_ast(&flat);
+  }
+  free_node(&counting, program);
+  free_parser(&parser);
+
+  if (ctx.live != 0) {
+    fprintf(stderr, "fuzz_parser: %zu bytes leaked\n", ctx.live);
+    abort();
+  }
+  work.allocs = ctx.allocations + ctx.frees;
+  return work;
+}
+
+static char *repeat(const char *data, size_t size, size_t copies) {
+  char *src = malloc(size * copies + 1);
+  if (src == NULL) {
+    fprintf(stderr, "fuzz_parser: out of memory\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < copies; i++)
+    memcpy(src + i * size, data, size);
+  src[size * copies] = '\0';
+  return src;
+}
+
+static Work best_of_three(const char *src) {
+  Work best = measure(src);
+  for (int i = 0; i < 2; i++) {
+    Work work = measure(src);
+    if (work.seconds < best.seconds)
+      best = work;
+  }
+  return best;
+}
+
+// How much faster than the input a counter grew, 1.0 for linear
+static double slowdown(double small, double large) {
+  return large / (small > 0 ? small : 1) / GROWTH;
+}
+
+// The name of the first counter that grew super-linearly, or NULL
+static const char *check_scaling(const char *data, size_t size) {
+  size_t copies = SMALL_BYTES / size + 1;
+  char *small_src = repeat(data, size, copies);
+  char *large_src = repeat(data, size, copies * GROWTH);
+  Work small = measure(small_src);
+  Work large = measure(large_src);
+
+  const char *metric = NULL;
+  double ratio = slowdown((double)small.tokens, (double)large.tokens);
+  if (ratio > SLOWDOWN_LIMIT)
+    metric = "tokens";
+  else if ((ratio = slowdown((double)small.nodes, (double)large.nodes)) >
+           SLOWDOWN_LIMIT)
+    metric = "nodes";
+  else if ((ratio = slowdown((double)small.allocs, (double)large.allocs)) >
+           SLOWDOWN_LIMIT)
+    metric = "allocator calls";
+  else if (large.seconds >= MIN_TIMED &&
+           slowdown(small.seconds, large.seconds) > SLOWDOWN_LIMIT) {
+    small = best_of_three(small_src);
+    large = best_of_three(large_src);
+    if ((ratio = slowdown(small.seconds, large.seconds)) > SLOWDOWN_LIMIT)
+      metric = "time";
+  }
+
+  if (metric != NULL)
+    fprintf(stderr,
+            "fuzz_parser: super-linear %s on a %zu-byte input: %dx the "
+            "input took %.1fx the %s (tokens %zu->%zu, nodes %zu->%zu, "
+            "allocs %zu->%zu, %.3f->%.3f ms)\n",
+            metric, size, GROWTH, ratio * GROWTH, metric, small.tokens,
+            large.tokens, small.nodes, large.nodes, small.allocs,
+            large.allocs, small.seconds * 1e3, large.seconds * 1e3);
+  free(small_src);
+  free(large_src);
+  return metric;
+}
+
+// Inputs stop at their first NUL, as sources do
+static const char *fuzz_one(const uint8_t *data, size_t size) {
+  const char *end = memchr(data, '\0', size);
+  if (end != NULL)
+    size = (size_t)(end - (const char *)data);
+  if (size == 0 || size > MAX_INPUT)
+    return NULL;
+
+  char *src = repeat((const char *)data, size, 1);
+  measure(src);
+  free(src);
+  return check_scaling((const char *)data, size);
+}
+
+#ifdef DUD_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (fuzz_one(data, size) != NULL)
+    abort();
+  return 0;
+}
+
+#else
+
+static const char *fragments[] = {
+    "fn ",     "let ",   "const ", "type ",   "import ", "pub ",   "if ",
+    "else ",   "while ", "do ",    "for ",    "return ", "break", "continue",
+    "heap ",   "struct", "union",  "enum",    "true",    "false", "null",
+    "(",       ")",      "{",      "}",       "[",       "]",     ",",
+    ".",       ";",      ":",      "^",       "!",       "!=",    "=",
+    "==",      ">",      ">=",     "<",       "<=",      "+",     "++",
+    "+=",      "-",      "--",     "-=",      "*",       "*=",    "/",
+    "/=",      "%",      "%=",     "x",       "name_1",  "42",    "3.14",
+    "0x1f",    "1e9",    "\"s\"",  "\"\\n\"", "\"",      "// c\n", "/* c */",
+    "/*",      " ",      "\n",     "\t",      "@",       "#",     "\xc3\xa9",
+    "\xff",
+};
+
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * UINT64_C(2685821657736338717);
+}
+
+static size_t generate_input(char *buf, size_t cap, uint64_t *rng) {
+  size_t count = sizeof(fragments) / sizeof(*fragments);
+  size_t pieces = 1 + next_random(rng) % 64;
+  size_t len = 0;
+  for (size_t i = 0; i < pieces; i++) {
+    const char *piece = fragments[next_random(rng) % count];
+    size_t n = strlen(piece);
+    if (len + n >= cap)
+      break;
+    memcpy(buf + len, piece, n);
+    len += n;
+  }
+  return len;
+}
+
+static void save_slow_input(const char *data, size_t size) {
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ (unsigned char)data[i]) * UINT64_C(0x100000001b3);
+
+  char name[64];
+  snprintf(name, sizeof(name), "slow-%016llx.dud", (unsigned long long)hash);
+  FILE *f = fopen(name, "wb");
+  if (f == NULL)
+    return;
+  fwrite(data, 1, size, f);
+  fclose(f);
+  fprintf(stderr, "fuzz_parser: saved %s\n", name);
+}
+
+static char *read_file(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return NULL;
+  char *data = malloc(MAX_INPUT + 1);
+  *size = data ? fread(data, 1, MAX_INPUT + 1, f) : 0;
+  fclose(f);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  long runs = 1000;
+  uint64_t rng = (uint64_t)time(NULL);
+  int files = 0, slow = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "-runs=", 6) == 0) {
+      runs = strtol(argv[i] + 6, NULL, 10);
+      continue;
+    }
+    if (strncmp(argv[i], "-seed=", 6) == 0) {
+      rng = strtoull(argv[i] + 6, NULL, 10);
+      continue;
+    }
+
+    size_t size;
+    char *data = read_file(argv[i], &size);
+    if (data == NULL) {
+      fprintf(stderr, "fuzz_parser: can't read '%s'\n", argv[i]);
+      return 1;
+    }
+    files++;
+    if (size > MAX_INPUT)
+      fprintf(stderr, "fuzz_parser: '%s' is over %d bytes, skipped\n",
+              argv[i], MAX_INPUT);
+    else if (fuzz_one((const uint8_t *)data, size) != NULL)
+      slow++;
+    free(data);
+  }
+  if (files > 0)
+    return slow > 0;
+
+  if (rng == 0)
+    rng = 1;
+  printf("fuzz_parser: %ld runs, -seed=%llu\n", runs,
+         (unsigned long long)rng);
+  char buf[MAX_INPUT];
+  for (long run = 0; run < runs; run++) {
+    size_t size = generate_input(buf, sizeof(buf), &rng);
+    if (fuzz_one((const uint8_t *)buf, size) != NULL) {
+      save_slow_input(buf, size);
+      slow++;
+    }
+  }
+  printf("fuzz_parser: %d slow input%s\n", slow, slow == 1 ? "" : "s");
+  return slow > 0;
+}
+
+#endif
@@ -109,12 +109,13 @@ void *tracing_realloc(void *context, void *ptr, size_t old_size,
 
   tracing_free(tc, ptr, old_size, tag);
 
-  return NULL;
+  return new_ptr;
 }
 
 void tracing_free(void *context, void *ptr, size_t size, const char *tag) {
   TracingContext *tc = (TracingContext *)context;
 
+  sink_println(tc->sink, "Freed %zu bytes for %s at %p", size, tag, ptr);
   free(ptr);
   tc->freed += size;
 
@@ -133,8 +134,6 @@ void tracing_free(void *context, void *ptr, size_t size, const char *tag) {
     prev = curr;
     curr = curr->next;
   }
-
-  sink_println(tc->sink, "Freed %zu bytes for %s at %p", size, tag, ptr);
 }
 
 void dump_memory_leaks(TracingContext *context) {
@@ -160,3 +159,46 @@ void dump_memory_leaks(TracingContext *context) {
   sink_println(context->sink, "Memory leaked:   %zu bytes", leaked);
   sink_println(context->sink, "--------------------------");
 }
+
+static void count_alloc(CountingContext *cc, size_t size) {
+  cc->allocations++;
+  cc->allocated += size;
+  cc->live += size;
+  if (cc->live > cc->peak)
+    cc->peak = cc->live;
+}
+
+static void count_free(CountingContext *cc, size_t size) {
+  cc->frees++;
+  cc->freed += size;
+  cc->live -= size;
+}
+
+void *counting_alloc(void *context, size_t size, const char *tag) {
+  (void)tag;
+  void *ptr = malloc(size);
+  if (ptr)
+    count_alloc((CountingContext *)context, size);
+  return ptr;
+}
+
+void *counting_realloc(void *context, void *ptr, size_t old_size,
+                       size_t new_size, const char *tag) {
+  (void)tag;
+  CountingContext *cc = (CountingContext *)context;
+  void *new_ptr = realloc(ptr, new_size);
+  if (new_ptr == NULL)
+    return NULL;
+  if (ptr)
+    count_free(cc, old_size);
+  count_alloc(cc, new_size);
+  return new_ptr;
+}
+
+void counting_free(void *context, void *ptr, size_t size, const char *tag) {
+  (void)tag;
+  if (ptr == NULL)
+    return;
+  free(ptr);
+  count_free((CountingContext *)context, size);
+}
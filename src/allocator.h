@@ -39,6 +39,8 @@ typedef struct LogSink {
   void *context;
 } LogSink;
 
+// One message; the sink ends the line
+void sink_println(LogSink *sink, const char *fmt, ...);
 void console_log(void *context, const char *fmt, va_list args);
 void file_log(void *context, const char *fmt, va_list args);
 
@@ -62,3 +64,19 @@ void *tracing_realloc(void *context, void *ptr, size_t old_size,
 void tracing_free(void *context, void *ptr, size_t size, const char *tag);
 
 void dump_memory_leaks(TracingContext *context);
+
+// Like tracing but with no per-allocation log, just running totals, so it's
+// cheap enough to leave on while benchmarking
+typedef struct CountingContext {
+  size_t allocations; // reallocs count too
+  size_t frees;
+  size_t allocated; // bytes
+  size_t freed;
+  size_t live;
+  size_t peak;
+} CountingContext;
+
+void *counting_alloc(void *context, size_t size, const char *tag);
+void *counting_realloc(void *context, void *ptr, size_t old_size,
+                       size_t new_size, const char *tag);
+void counting_free(void *context, void *ptr, size_t size, const char *tag);
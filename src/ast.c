@@ -16,14 +16,64 @@
 
 #include "ast.h"
 
-#include <stdio.h>
 #include <string.h>
 
+#define NODE_HEADER offsetof(Node, as)
+#define NODE_SIZE(member) (NODE_HEADER + sizeof(((Node *)0)->as.member))
+
+// Bytes actually allocated for a node of each kind: the header plus only the
+// variant it uses, rather than the whole union
+static const size_t node_sizes[] = {
+    [NODE_INT_LIT] = NODE_SIZE(integer),
+    [NODE_FLOAT_LIT] = NODE_SIZE(floating),
+    [NODE_STRING_LIT] = NODE_SIZE(literal),
+    [NODE_BOOL_LIT] = NODE_SIZE(boolean),
+    [NODE_NULL_LIT] = NODE_HEADER,
+    [NODE_IDENT] = NODE_SIZE(ident),
+    [NODE_UNARY] = NODE_SIZE(unary),
+    [NODE_POSTFIX] = NODE_SIZE(unary),
+    [NODE_BINARY] = NODE_SIZE(binary),
+    [NODE_ASSIGN] = NODE_SIZE(assign),
+    [NODE_CALL] = NODE_SIZE(call),
+    [NODE_MEMBER] = NODE_SIZE(member),
+    [NODE_INDEX] = NODE_SIZE(subscript),
+    [NODE_HEAP] = NODE_SIZE(heap),
+    [NODE_TYPE_NAME] = NODE_SIZE(type_name),
+    [NODE_TYPE_PTR] = NODE_SIZE(pointer),
+    [NODE_TYPE_ARR] = NODE_SIZE(array),
+    [NODE_LET] = NODE_SIZE(let),
+    [NODE_EXPR_STMT] = NODE_SIZE(expr_stmt),
+    [NODE_BLOCK] = NODE_SIZE(block),
+    [NODE_IF] = NODE_SIZE(if_stmt),
+    [NODE_WHILE] = NODE_SIZE(while_stmt),
+    [NODE_DO_WHILE] = NODE_SIZE(do_while),
+    [NODE_FOR] = NODE_SIZE(for_stmt),
+    [NODE_RETURN] = NODE_SIZE(ret),
+    [NODE_BREAK] = NODE_HEADER,
+    [NODE_CONTINUE] = NODE_HEADER,
+    [NODE_FN] = NODE_SIZE(fn),
+    [NODE_PARAM] = NODE_SIZE(param),
+    [NODE_TYPE_DECL] = NODE_SIZE(type_decl),
+    [NODE_STRUCT] = NODE_SIZE(record),
+    [NODE_UNION] = NODE_SIZE(record),
+    [NODE_ENUM] = NODE_SIZE(enom),
+    [NODE_FIELD] = NODE_SIZE(field),
+    [NODE_ENUM_VAR] = NODE_SIZE(enum_variant),
+    [NODE_IMPORT] = NODE_SIZE(import),
+    [NODE_PROGRAM] = NODE_SIZE(program),
+};
+
+#undef NODE_SIZE
+#undef NODE_HEADER
+
+size_t node_size(NodeKind kind) { return node_sizes[kind]; }
+
 Node *new_node(Allocator *a, NodeKind kind, size_t line) {
-  Node *node = (Node *)ALLOC(a, sizeof(Node), "Node");
+  size_t size = node_size(kind);
+  Node *node = (Node *)ALLOC(a, size, "Node");
   if (node == NULL)
     return NULL;
-  memset(node, 0, sizeof(Node));
+  memset(node, 0, size);
   node->kind = kind;
   node->line = line;
   return node;
@@ -56,139 +106,798 @@ static void free_str(Allocator *a, char *s) {
     FREE(a, s, strlen(s) + 1, "AstString");
 }
 
-static void free_list(Allocator *a, NodeList *list) {
-  for (size_t i = 0; i < list->count; i++)
-    free_node(a, list->items[i]);
-  if (list->items)
-    FREE(a, list->items, list->cap * sizeof(Node *), "NodeList");
+#define TEXT(variant, field) ((uint8_t)offsetof(Node, as.variant.field))
+#define SLOT(variant, field, flags)                                            \
+  {#field, (uint8_t)offsetof(Node, as.variant.field), flags}
+#define CHILD(variant, field) SLOT(variant, field, 0)
+#define MAYBE(variant, field) SLOT(variant, field, CHILD_OPTIONAL)
+#define LIST(variant, field) SLOT(variant, field, CHILD_LIST)
+
+static const ChildTable child_tables[NODE_PROGRAM + 1] = {
+    [NODE_STRING_LIT] = {.text = TEXT(literal, text)},
+    [NODE_IDENT] = {.text = TEXT(ident, name)},
+    [NODE_UNARY] = {0, 1, {CHILD(unary, operand)}},
+    [NODE_POSTFIX] = {0, 1, {CHILD(unary, operand)}},
+    [NODE_BINARY] = {0, 2, {CHILD(binary, left), CHILD(binary, right)}},
+    [NODE_ASSIGN] = {0, 2, {CHILD(assign, target), CHILD(assign, val)}},
+    [NODE_CALL] = {0, 2, {CHILD(call, callee), LIST(call, args)}},
+    [NODE_MEMBER] = {TEXT(member, field), 1, {CHILD(member, obj)}},
+    [NODE_INDEX] = {0, 2, {CHILD(subscript, obj), CHILD(subscript, idx)}},
+    [NODE_HEAP] = {0, 1, {CHILD(heap, val)}},
+    [NODE_TYPE_NAME] = {.text = TEXT(type_name, name)},
+    [NODE_TYPE_PTR] = {0, 1, {CHILD(pointer, pointee)}},
+    [NODE_TYPE_ARR] = {0, 2, {MAYBE(array, size), CHILD(array, elem)}},
+    [NODE_LET] = {TEXT(let, name), 2, {MAYBE(let, type), MAYBE(let, init)}},
+    [NODE_EXPR_STMT] = {0, 1, {CHILD(expr_stmt, expr)}},
+    [NODE_BLOCK] = {0, 1, {LIST(block, stmts)}},
+    [NODE_IF] = {0,
+                 3,
+                 {CHILD(if_stmt, cond), CHILD(if_stmt, then_branch),
+                  MAYBE(if_stmt, else_branch)}},
+    [NODE_WHILE] = {0, 2, {CHILD(while_stmt, cond), CHILD(while_stmt, body)}},
+    [NODE_DO_WHILE] = {0, 2, {CHILD(do_while, body), CHILD(do_while, cond)}},
+    [NODE_FOR] = {0,
+                  4,
+                  {MAYBE(for_stmt, init), MAYBE(for_stmt, cond),
+                   MAYBE(for_stmt, post), CHILD(for_stmt, body)}},
+    [NODE_RETURN] = {0, 1, {MAYBE(ret, val)}},
+    [NODE_FN] = {TEXT(fn, name),
+                 3,
+                 {LIST(fn, params), MAYBE(fn, ret_type), CHILD(fn, body)}},
+    [NODE_PARAM] = {TEXT(param, name), 1, {MAYBE(param, type)}},
+    [NODE_TYPE_DECL] = {TEXT(type_decl, name), 1, {CHILD(type_decl, def)}},
+    [NODE_STRUCT] = {0, 1, {LIST(record, fields)}},
+    [NODE_UNION] = {0, 1, {LIST(record, fields)}},
+    [NODE_ENUM] = {0, 1, {LIST(enom, variants)}},
+    [NODE_FIELD] = {TEXT(field, name), 1, {CHILD(field, type)}},
+    [NODE_ENUM_VAR] = {TEXT(enum_variant, name),
+                       1,
+                       {MAYBE(enum_variant, val)}},
+    [NODE_IMPORT] = {.text = TEXT(import, path)},
+    [NODE_PROGRAM] = {0, 1, {LIST(program, decls)}},
+};
+
+#undef LIST
+#undef MAYBE
+#undef CHILD
+#undef SLOT
+#undef TEXT
+
+const ChildTable *child_table(NodeKind kind) { return &child_tables[kind]; }
+
+// A node on the path from the root, with a cursor over its children
+typedef struct WalkFrame {
+  Node *node;
+  const ChildSlot *slot; // the slot the cursor is in
+  const ChildSlot *end;  // past the node's last slot
+  size_t next; // list index of the next child, or 1 once a field is taken
+} WalkFrame;
+
+// Frames on the C stack before the walk has to allocate
+#define WALK_INLINE_FRAMES 64
+
+// Move the cursor to the next child, skipping NULLs unless `nulls`; false
+// once there are none left
+static bool next_child(WalkFrame *frame, bool nulls, Node **child) {
+  for (; frame->slot < frame->end; frame->slot++, frame->next = 0) {
+    const ChildSlot *slot = frame->slot;
+    if (slot->flags & CHILD_LIST) {
+      const NodeList *list = slot_list(frame->node, slot);
+      while (frame->next < list->count) {
+        *child = list->items[frame->next++];
+        if (*child || nulls)
+          return true;
+      }
+    } else if (frame->next == 0) {
+      frame->next = 1;
+      *child = slot_node(frame->node, slot);
+      if (*child || nulls)
+        return true;
+    }
+  }
+  return false;
+}
+
+// The position of a node whose parent is frames[depth - 1]
+static void pos_below(WalkPos *pos, const WalkFrame *frames, size_t depth) {
+  pos->depth = depth;
+  if (depth == 0) {
+    pos->parent = NULL;
+    pos->slot = NULL;
+    pos->index = 0;
+    return;
+  }
+  const WalkFrame *up = &frames[depth - 1];
+  pos->parent = up->node;
+  pos->slot = up->slot;
+  pos->index = pos->slot->flags & CHILD_LIST ? up->next - 1 : 0;
+}
+
+static WalkFrame *grow_frames(Allocator *a, WalkFrame *frames,
+                              const WalkFrame *inline_frames, size_t *cap) {
+  size_t new_cap = *cap * 2;
+  WalkFrame *grown =
+      (WalkFrame *)ALLOC(a, new_cap * sizeof(WalkFrame), "WalkStack");
+  if (grown == NULL)
+    return NULL;
+  memcpy(grown, frames, *cap * sizeof(WalkFrame));
+  if (frames != inline_frames)
+    FREE(a, frames, *cap * sizeof(WalkFrame), "WalkStack");
+  *cap = new_cap;
+  return grown;
+}
+
+bool walk_ast(Allocator *a, Node *root, const AstVisitor *visitor) {
+  WalkFrame inline_frames[WALK_INLINE_FRAMES];
+  WalkFrame *frames = inline_frames;
+  size_t count = 0, cap = WALK_INLINE_FRAMES;
+  bool ok = true;
+
+  WalkPos pos;
+  Node *node = root;
+  for (;;) {
+    pos_below(&pos, frames, count);
+    WalkStep step = WALK_CONTINUE;
+    if (visitor->pre && (node || visitor->nulls))
+      step = visitor->pre(node, &pos, visitor->ctx);
+    if (step == WALK_STOP)
+      break;
+    if (step == WALK_CONTINUE && node) {
+      const ChildTable *table = &child_tables[node->kind];
+      if (table->count == 0) {
+        // A leaf is done at once, without a frame
+        if (visitor->post &&
+            visitor->post(node, &pos, visitor->ctx) == WALK_STOP)
+          break;
+      } else {
+        if (count == cap) {
+          WalkFrame *grown = grow_frames(a, frames, inline_frames, &cap);
+          if (grown == NULL) {
+            ok = false;
+            break;
+          }
+          frames = grown;
+        }
+        frames[count++] =
+            (WalkFrame){node, table->slots, table->slots + table->count, 0};
+      }
+    }
+
+    // Climb until some node on the path has a child left
+    while (count > 0 &&
+           !next_child(&frames[count - 1], visitor->nulls, &node)) {
+      Node *done = frames[--count].node;
+      if (visitor->post == NULL)
+        continue;
+      pos_below(&pos, frames, count);
+      if (visitor->post(done, &pos, visitor->ctx) == WALK_STOP)
+        goto out;
+    }
+    if (count == 0)
+      break;
+  }
+
+out:
+  if (frames != inline_frames)
+    FREE(a, frames, cap * sizeof(WalkFrame), "WalkStack");
+  return ok;
+}
+
+// An interned type someone else still holds just loses a reference
+static WalkStep drop_ref(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  (void)ctx;
+  if (node_refs(node) > 1) {
+    node->as.type.refs--;
+    return WALK_SKIP;
+  }
+  return WALK_CONTINUE;
+}
+
+// Children go first, so by now only the node's own memory is left
+static WalkStep free_one(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  Allocator *a = (Allocator *)ctx;
+  const ChildTable *table = &child_tables[node->kind];
+  free_str(a, node_text(node));
+  for (size_t i = 0; i < table->count; i++) {
+    const ChildSlot *slot = &table->slots[i];
+    const NodeList *list = slot_list(node, slot);
+    if (slot->flags & CHILD_LIST && list->items)
+      FREE(a, list->items, list->cap * sizeof(Node *), "NodeList");
+  }
+  FREE(a, node, node_size(node->kind), "Node");
+  return WALK_CONTINUE;
 }
 
 void free_node(Allocator *a, Node *node) {
+  // Out of memory for a deep enough walk, the rest of the tree leaks
+  AstVisitor visitor = {drop_ref, free_one, a, false};
+  walk_ast(a, node, &visitor);
+}
+
+static bool internable(const Node *node) {
+  switch (node->kind) {
+  case NODE_TYPE_NAME:
+    return node->as.type_name.name != NULL;
+  case NODE_TYPE_PTR:
+    return node->as.pointer.pointee && node_refs(node->as.pointer.pointee) > 0;
+  case NODE_TYPE_ARR:
+    return node->as.array.elem && node_refs(node->as.array.elem) > 0 &&
+           (node->as.array.size == NULL ||
+            node->as.array.size->kind == NODE_INT_LIT);
+  default:
+    return false;
+  }
+}
+
+// Children are interned already, so they hash and compare by address
+static uint64_t type_hash(const Node *node) {
+  uint64_t h = (uint64_t)node->kind;
+  switch (node->kind) {
+  case NODE_TYPE_NAME:
+    for (const char *c = node->as.type_name.name; *c; c++)
+      h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    break;
+  case NODE_TYPE_PTR:
+    h ^= (uint64_t)(uintptr_t)node->as.pointer.pointee;
+    break;
+  default:
+    h ^= (uint64_t)(uintptr_t)node->as.array.elem;
+    if (node->as.array.size)
+      h ^= (node->as.array.size->as.integer.val + 1) * 0x9e3779b97f4a7c15ull;
+    break;
+  }
+  h *= 0xff51afd7ed558ccdull;
+  return h ^ h >> 32;
+}
+
+static bool same_type(const Node *a, const Node *b) {
+  if (a->kind != b->kind)
+    return false;
+  switch (a->kind) {
+  case NODE_TYPE_NAME:
+    return strcmp(a->as.type_name.name, b->as.type_name.name) == 0;
+  case NODE_TYPE_PTR:
+    return a->as.pointer.pointee == b->as.pointer.pointee;
+  default: {
+    const Node *as = a->as.array.size, *bs = b->as.array.size;
+    if (a->as.array.elem != b->as.array.elem || (as == NULL) != (bs == NULL))
+      return false;
+    return as == NULL || as->as.integer.val == bs->as.integer.val;
+  }
+  }
+}
+
+void init_type_table(TypeTable *table) {
+  table->slots = NULL;
+  table->count = table->cap = 0;
+}
+
+// The slot holding `probe`'s equal, or the empty one it would go in
+static TypeSlot *find_slot(TypeTable *table, const Node *probe,
+                           uint64_t hash) {
+  size_t mask = table->cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    TypeSlot *slot = &table->slots[i];
+    if (slot->node == NULL ||
+        (slot->hash == hash && same_type(slot->node, probe)))
+      return slot;
+  }
+}
+
+static bool grow_type_table(Allocator *a, TypeTable *table) {
+  size_t new_cap = table->cap < 8 ? 8 : table->cap * 2;
+  TypeSlot *slots =
+      (TypeSlot *)ALLOC(a, new_cap * sizeof(TypeSlot), "TypeTable");
+  if (slots == NULL)
+    return false;
+  memset(slots, 0, new_cap * sizeof(TypeSlot));
+
+  size_t mask = new_cap - 1;
+  for (size_t i = 0; i < table->cap; i++) {
+    TypeSlot slot = table->slots[i];
+    if (slot.node == NULL)
+      continue;
+    size_t at = slot.hash & mask;
+    while (slots[at].node)
+      at = (at + 1) & mask;
+    slots[at] = slot;
+  }
+  if (table->slots)
+    FREE(a, table->slots, table->cap * sizeof(TypeSlot), "TypeTable");
+  table->slots = slots;
+  table->cap = new_cap;
+  return true;
+}
+
+Node *lookup_type(TypeTable *table, const Node *probe) {
+  if (table->count == 0 || !internable(probe))
+    return NULL;
+  Node *found = find_slot(table, probe, type_hash(probe))->node;
+  if (found)
+    found->as.type.refs++;
+  return found;
+}
+
+Node *intern_type(Allocator *a, TypeTable *table, Node *node) {
+  if (node == NULL || node_refs(node) > 0 || !internable(node))
+    return node;
+
+  // Keep the load at most half
+  if ((table->count + 1) * 2 > table->cap && !grow_type_table(a, table))
+    return node; // still correct, just not shared
+  uint64_t hash = type_hash(node);
+  TypeSlot *slot = find_slot(table, node, hash);
+  if (slot->node) {
+    slot->node->as.type.refs++;
+    free_node(a, node);
+    return slot->node;
+  }
+  slot->hash = hash;
+  slot->node = node;
+  table->count++;
+  node->as.type.refs = 2; // the table's and the caller's
+  node->line = 0;
+  // The size literal is the one child not interned itself, so it goes too
+  if (node->kind == NODE_TYPE_ARR && node->as.array.size)
+    node->as.array.size->line = 0;
+  return node;
+}
+
+// Empty slot `i` without breaking the probe run of anything after it
+static void remove_slot(TypeTable *table, size_t i) {
+  size_t mask = table->cap - 1;
+  table->slots[i].node = NULL;
+  table->count--;
+  for (size_t j = (i + 1) & mask; table->slots[j].node; j = (j + 1) & mask) {
+    size_t home = table->slots[j].hash & mask;
+    // Move it back into the hole unless its home lies in (i, j]
+    bool stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+    if (!stays) {
+      table->slots[i] = table->slots[j];
+      table->slots[j].node = NULL;
+      i = j;
+    }
+  }
+}
+
+void sweep_type_table(Allocator *a, TypeTable *table) {
+  // Dropping ^T can leave T held by the table alone, so repeat until a pass
+  // frees nothing
+  for (bool dropped = true; dropped;) {
+    dropped = false;
+    for (size_t i = 0; i < table->cap; i++) {
+      Node *node = table->slots[i].node;
+      while (node && node_refs(node) == 1) {
+        remove_slot(table, i);
+        free_node(a, node);
+        dropped = true;
+        node = table->slots[i].node; // something may have moved into the hole
+      }
+    }
+  }
+}
+
+void free_type_table(Allocator *a, TypeTable *table) {
+  for (size_t i = 0; i < table->cap; i++)
+    free_node(a, table->slots[i].node);
+  if (table->slots)
+    FREE(a, table->slots, table->cap * sizeof(TypeSlot), "TypeTable");
+  init_type_table(table);
+}
+
+// Fields are multiplied by a key for their position and the products summed,
+// which keeps them off one long dependency chain; the finalizer at the end of
+// hash_node() mixes the sum. Lists, of any length, are folded in order
+#define K0 0x9e3779b97f4a7c15ull
+#define K1 0xc2b2ae3d27d4eb4full
+#define K2 0x165667b19e3779f9ull
+#define K3 0xd6e8feb86659fd93ull
+#define K4 0xff51afd7ed558ccdull
+
+static uint64_t child(const Node *node) { return node ? node->hash : 0; }
+
+static uint64_t rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+
+// One step of MurmurHash3's 64-bit mixing: the word is scrambled before it's
+// folded in, so each of its bits reaches most of the state
+static uint64_t fold_word(uint64_t h, uint64_t word) {
+  word *= 0x87c37b91114253d5ull;
+  word = rotl(word, 31);
+  word *= 0x4cf5ad432745937full;
+  h ^= word;
+  return rotl(h, 27) * 5 + 0x52dce729;
+}
+
+uint64_t hash_bytes(const char *bytes, size_t len) {
+  uint64_t h = len * K4;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h = fold_word(h, word);
+  }
+  if (i < len) {
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, len - i);
+    h = fold_word(h, tail);
+  }
+
+  // The finalizer lets every input bit flip about half the output bits
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ h >> 33;
+}
+
+static uint64_t str_hash(const char *s) {
+  if (s == NULL)
+    return 0;
+  return hash_bytes(s, strlen(s)) | 1; // never 0, so "" and NULL differ
+}
+
+static uint64_t list_hash(const NodeList *list) {
+  uint64_t h = list->count;
+  for (size_t i = 0; i < list->count; i++) {
+    h = (h ^ child(list->items[i])) * K0;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+void hash_node(Node *node) {
   if (node == NULL)
     return;
 
-  switch (node->kind) {
+  const Node *n = node;
+  uint64_t h = ((uint64_t)n->kind + 1) * K4;
+  switch (n->kind) {
   case NODE_INT_LIT:
-  case NODE_FLOAT_LIT:
+    h += n->as.integer.val * K0;
+    break;
+  case NODE_FLOAT_LIT: {
+    uint64_t bits;
+    memcpy(&bits, &n->as.floating.val, sizeof bits);
+    h += bits * K0;
+    break;
+  }
   case NODE_STRING_LIT:
-    free_str(a, node->as.literal.text);
+    h += str_hash(n->as.literal.text) * K0;
     break;
   case NODE_BOOL_LIT:
+    h += n->as.boolean.val * K0;
+    break;
   case NODE_NULL_LIT:
   case NODE_BREAK:
   case NODE_CONTINUE:
     break;
   case NODE_IDENT:
-    free_str(a, node->as.ident.name);
+    h += str_hash(n->as.ident.name) * K0;
     break;
   case NODE_UNARY:
   case NODE_POSTFIX:
-    free_node(a, node->as.unary.operand);
+    h += n->as.unary.op * K0 + child(n->as.unary.operand) * K1;
     break;
   case NODE_BINARY:
-    free_node(a, node->as.binary.left);
-    free_node(a, node->as.binary.right);
+    h += n->as.binary.op * K0 + child(n->as.binary.left) * K1 +
+         child(n->as.binary.right) * K2;
     break;
   case NODE_ASSIGN:
-    free_node(a, node->as.assign.target);
-    free_node(a, node->as.assign.val);
+    h += n->as.assign.op * K0 + child(n->as.assign.target) * K1 +
+         child(n->as.assign.val) * K2;
     break;
   case NODE_CALL:
-    free_node(a, node->as.call.callee);
-    free_list(a, &node->as.call.args);
+    h += child(n->as.call.callee) * K0 + list_hash(&n->as.call.args) * K1;
     break;
   case NODE_MEMBER:
-    free_node(a, node->as.member.obj);
-    free_str(a, node->as.member.field);
+    h += child(n->as.member.obj) * K0 + str_hash(n->as.member.field) * K1;
     break;
   case NODE_INDEX:
-    free_node(a, node->as.subscript.obj);
-    free_node(a, node->as.subscript.idx);
+    h += child(n->as.subscript.obj) * K0 + child(n->as.subscript.idx) * K1;
     break;
   case NODE_HEAP:
-    free_node(a, node->as.heap.val);
+    h += child(n->as.heap.val) * K0;
     break;
   case NODE_TYPE_NAME:
-    free_str(a, node->as.type_name.name);
+    h += str_hash(n->as.type_name.name) * K0;
     break;
   case NODE_TYPE_PTR:
-    free_node(a, node->as.pointer.pointee);
+    h += child(n->as.pointer.pointee) * K0;
     break;
   case NODE_TYPE_ARR:
-    free_node(a, node->as.array.size);
-    free_node(a, node->as.array.elem);
+    h += child(n->as.array.size) * K0 + child(n->as.array.elem) * K1;
     break;
   case NODE_LET:
-    free_str(a, node->as.let.name);
-    free_node(a, node->as.let.type);
-    free_node(a, node->as.let.init);
+    h += n->as.let.is_const * K0 + str_hash(n->as.let.name) * K1 +
+         child(n->as.let.type) * K2 + child(n->as.let.init) * K3;
     break;
   case NODE_EXPR_STMT:
-    free_node(a, node->as.expr_stmt.expr);
+    h += child(n->as.expr_stmt.expr) * K0;
     break;
   case NODE_BLOCK:
-    free_list(a, &node->as.block.stmts);
+    h += list_hash(&n->as.block.stmts) * K0;
     break;
   case NODE_IF:
-    free_node(a, node->as.if_stmt.cond);
-    free_node(a, node->as.if_stmt.then_branch);
-    free_node(a, node->as.if_stmt.else_branch);
+    h += child(n->as.if_stmt.cond) * K0 +
+         child(n->as.if_stmt.then_branch) * K1 +
+         child(n->as.if_stmt.else_branch) * K2;
     break;
   case NODE_WHILE:
-    free_node(a, node->as.while_stmt.cond);
-    free_node(a, node->as.while_stmt.body);
+    h += child(n->as.while_stmt.cond) * K0 + child(n->as.while_stmt.body) * K1;
     break;
   case NODE_DO_WHILE:
-    free_node(a, node->as.do_while.body);
-    free_node(a, node->as.do_while.cond);
+    h += child(n->as.do_while.body) * K0 + child(n->as.do_while.cond) * K1;
     break;
   case NODE_FOR:
-    free_node(a, node->as.for_stmt.init);
-    free_node(a, node->as.for_stmt.cond);
-    free_node(a, node->as.for_stmt.post);
-    free_node(a, node->as.for_stmt.body);
+    h += child(n->as.for_stmt.init) * K0 + child(n->as.for_stmt.cond) * K1 +
+         child(n->as.for_stmt.post) * K2 + child(n->as.for_stmt.body) * K3;
     break;
   case NODE_RETURN:
-    free_node(a, node->as.ret.val);
+    h += child(n->as.ret.val) * K0;
     break;
   case NODE_FN:
-    free_str(a, node->as.fn.name);
-    free_list(a, &node->as.fn.params);
-    free_node(a, node->as.fn.ret_type);
-    free_node(a, node->as.fn.body);
+    h += (str_hash(n->as.fn.name) ^ n->as.fn.is_pub) * K0 +
+         list_hash(&n->as.fn.params) * K1 + child(n->as.fn.ret_type) * K2 +
+         (n->as.fn.body ? child(n->as.fn.body) : n->as.fn.body_hash) * K3;
     break;
   case NODE_PARAM:
-    free_str(a, node->as.param.name);
-    free_node(a, node->as.param.type);
+    h += str_hash(n->as.param.name) * K0 + child(n->as.param.type) * K1;
     break;
   case NODE_TYPE_DECL:
-    free_str(a, node->as.type_decl.name);
-    free_node(a, node->as.type_decl.def);
+    h += n->as.type_decl.is_pub * K0 + str_hash(n->as.type_decl.name) * K1 +
+         child(n->as.type_decl.def) * K2;
     break;
   case NODE_STRUCT:
   case NODE_UNION:
-    free_list(a, &node->as.record.fields);
+    h += list_hash(&n->as.record.fields) * K0;
     break;
   case NODE_ENUM:
-    free_list(a, &node->as.enom.variants);
+    h += list_hash(&n->as.enom.variants) * K0;
     break;
   case NODE_FIELD:
-    free_str(a, node->as.field.name);
-    free_node(a, node->as.field.type);
+    h += str_hash(n->as.field.name) * K0 + child(n->as.field.type) * K1;
     break;
   case NODE_ENUM_VAR:
-    free_str(a, node->as.enum_variant.name);
-    free_node(a, node->as.enum_variant.val);
+    h += str_hash(n->as.enum_variant.name) * K0 +
+         child(n->as.enum_variant.val) * K1;
     break;
   case NODE_IMPORT:
-    free_str(a, node->as.import.path);
+    h += str_hash(n->as.import.path) * K0;
     break;
   case NODE_PROGRAM:
-    free_list(a, &node->as.program.decls);
+    h += list_hash(&n->as.program.decls) * K0;
     break;
   }
+  h ^= h >> 32;
+  h *= K0;
+  node->hash = h ^ h >> 29;
+}
+
+#undef K0
+#undef K1
+#undef K2
+#undef K3
+#undef K4
+
+void init_subtree_index(SubtreeIndex *index) {
+  index->slots = NULL;
+  index->count = index->cap = 0;
+  index->entries = NULL;
+  index->entry_count = index->entry_cap = 0;
+}
+
+static bool grow_subtree_index(Allocator *a, SubtreeIndex *index) {
+  size_t new_cap = index->cap < 8 ? 8 : index->cap * 2;
+  SubtreeSlot *slots =
+      (SubtreeSlot *)ALLOC(a, new_cap * sizeof(SubtreeSlot), "SubtreeIndex");
+  if (slots == NULL)
+    return false;
+  memset(slots, 0, new_cap * sizeof(SubtreeSlot));
+
+  size_t mask = new_cap - 1;
+  for (size_t i = 0; i < index->cap; i++) {
+    SubtreeSlot slot = index->slots[i];
+    if (slot.head == 0)
+      continue;
+    size_t j = slot.hash & mask;
+    while (slots[j].head)
+      j = (j + 1) & mask;
+    slots[j] = slot;
+  }
+  if (index->slots)
+    FREE(a, index->slots, index->cap * sizeof(SubtreeSlot), "SubtreeIndex");
+  index->slots = slots;
+  index->cap = new_cap;
+  return true;
+}
 
-  FREE(a, node, sizeof(Node), "Node");
+static SubtreeSlot *find_hash(const SubtreeIndex *index, uint64_t hash) {
+  size_t mask = index->cap - 1;
+  size_t i = hash & mask;
+  while (index->slots[i].head && index->slots[i].hash != hash)
+    i = (i + 1) & mask;
+  return &index->slots[i];
+}
+
+// False only when out of memory
+static bool index_node(Allocator *a, SubtreeIndex *index, const Node *node) {
+  if ((index->count + 1) * 2 > index->cap && !grow_subtree_index(a, index))
+    return false;
+  if (index->entry_count + 1 > index->entry_cap) {
+    size_t old_cap = index->entry_cap;
+    size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+    SubtreeEntry *entries = (SubtreeEntry *)REALLOC(
+        a, index->entries, old_cap * sizeof(SubtreeEntry),
+        new_cap * sizeof(SubtreeEntry), "SubtreeIndex");
+    if (entries == NULL)
+      return false;
+    index->entries = entries;
+    index->entry_cap = new_cap;
+  }
+
+  SubtreeSlot *slot = find_hash(index, node->hash);
+  if (slot->head == 0) {
+    slot->hash = node->hash;
+    index->count++;
+  }
+  index->entries[index->entry_count].node = node;
+  index->entries[index->entry_count].next = slot->head;
+  slot->head = ++index->entry_count;
+  return true;
+}
+
+// Whether an interned type is in the index already
+static bool has_node(const SubtreeIndex *index, const Node *node) {
+  if (index->cap == 0)
+    return false;
+  for (size_t e = find_hash(index, node->hash)->head; e;
+       e = index->entries[e - 1].next)
+    if (index->entries[e - 1].node == node)
+      return true;
+  return false;
+}
+
+typedef struct IndexWalk {
+  Allocator *allocator;
+  SubtreeIndex *index;
+  bool ok;
+} IndexWalk;
+
+static WalkStep index_one(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  IndexWalk *walk = (IndexWalk *)ctx;
+  if (node_refs(node) > 0 && has_node(walk->index, node))
+    return WALK_SKIP; // an interned type met again
+  if (!index_node(walk->allocator, walk->index, node)) {
+    walk->ok = false;
+    return WALK_STOP;
+  }
+  return WALK_CONTINUE;
+}
+
+bool index_subtrees(Allocator *a, SubtreeIndex *index, const Node *root) {
+  IndexWalk walk = {a, index, true};
+  AstVisitor visitor = {index_one, NULL, &walk, false};
+  return walk_ast(a, (Node *)root, &visitor) && walk.ok;
+}
+
+size_t find_subtrees(const SubtreeIndex *index, uint64_t hash,
+                     const Node **out, size_t max) {
+  if (index->cap == 0)
+    return 0;
+
+  size_t found = 0;
+  for (size_t e = find_hash(index, hash)->head; e;
+       e = index->entries[e - 1].next) {
+    if (found < max)
+      out[found] = index->entries[e - 1].node;
+    found++;
+  }
+  return found;
+}
+
+void free_subtree_index(Allocator *a, SubtreeIndex *index) {
+  if (index->slots)
+    FREE(a, index->slots, index->cap * sizeof(SubtreeSlot), "SubtreeIndex");
+  if (index->entries)
+    FREE(a, index->entries, index->entry_cap * sizeof(SubtreeEntry),
+         "SubtreeIndex");
+  init_subtree_index(index);
+}
+
+typedef struct MemoryWalk {
+  Allocator *allocator;
+  AstMemory *memory;
+  SubtreeIndex seen; // interned types counted already
+  bool ok;
+} MemoryWalk;
+
+static WalkStep measure_one(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  MemoryWalk *walk = (MemoryWalk *)ctx;
+  if (node_refs(node) > 0) {
+    if (has_node(&walk->seen, node))
+      return WALK_SKIP;
+    if (!index_node(walk->allocator, &walk->seen, node)) {
+      walk->ok = false;
+      return WALK_STOP;
+    }
+  }
+
+  KindMemory *kind = &walk->memory->kinds[node->kind];
+  kind->nodes++;
+  kind->node_bytes += node_size(node->kind);
+  const char *text = node_text(node);
+  if (text)
+    kind->string_bytes += strlen(text) + 1;
+  const ChildTable *table = &child_tables[node->kind];
+  for (size_t i = 0; i < table->count; i++) {
+    if (!(table->slots[i].flags & CHILD_LIST))
+      continue;
+    const NodeList *list = slot_list(node, &table->slots[i]);
+    kind->list_bytes += list->cap * sizeof(Node *);
+    kind->list_slack += list->cap - list->count;
+  }
+  return WALK_CONTINUE;
+}
+
+bool measure_ast_memory(Allocator *a, const Node *root, AstMemory *out) {
+  memset(out, 0, sizeof(*out));
+  MemoryWalk walk = {a, out, {0}, true};
+  init_subtree_index(&walk.seen);
+  AstVisitor visitor = {measure_one, NULL, &walk, false};
+  bool ok = walk_ast(a, (Node *)root, &visitor) && walk.ok;
+  free_subtree_index(a, &walk.seen);
+
+  for (int k = 0; k <= NODE_PROGRAM; k++) {
+    const KindMemory *kind = &out->kinds[k];
+    out->total.nodes += kind->nodes;
+    out->total.node_bytes += kind->node_bytes;
+    out->total.string_bytes += kind->string_bytes;
+    out->total.list_bytes += kind->list_bytes;
+    out->total.list_slack += kind->list_slack;
+  }
+  return ok;
+}
+
+static void report_kind(LogSink *sink, const char *name,
+                        const KindMemory *kind) {
+  sink_println(sink, "%-12s %9zu %11zu %11zu %11zu %7zu", name, kind->nodes,
+               kind->node_bytes, kind->string_bytes, kind->list_bytes,
+               kind->list_slack);
+}
+
+void report_ast_memory(LogSink *sink, const AstMemory *memory, size_t lines) {
+  sink_println(sink, "--- AST MEMORY REPORT ---");
+  sink_println(sink, "%-12s %9s %11s %11s %11s %7s", "Kind", "Nodes",
+               "Node bytes", "Strings", "Lists", "Slack");
+  for (int k = 0; k <= NODE_PROGRAM; k++)
+    if (memory->kinds[k].nodes > 0)
+      report_kind(sink, node_kind_to_string((NodeKind)k), &memory->kinds[k]);
+  report_kind(sink, "Total", &memory->total);
+
+  const KindMemory *total = &memory->total;
+  size_t bytes = total->node_bytes + total->string_bytes + total->list_bytes;
+  sink_println(sink, "Total bytes: %zu", bytes);
+  if (lines > 0)
+    sink_println(sink, "Bytes per line: %.1f (%zu lines)",
+                 (double)bytes / (double)lines, lines);
+  sink_println(sink, "-------------------------");
+}
+
+static WalkStep shift_line(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  if (node_refs(node) > 0)
+    return WALK_SKIP; // interned types have no line of their own
+  node->line += *(size_t *)ctx; // wraps around for a negative delta
+  return WALK_CONTINUE;
+}
+
+void shift_node_lines(Allocator *a, Node *node, size_t delta) {
+  AstVisitor visitor = {shift_line, NULL, &delta, false};
+  walk_ast(a, node, &visitor);
 }
 
 const char *node_kind_to_string(NodeKind kind) {
@@ -270,185 +979,3 @@ const char *node_kind_to_string(NodeKind kind) {
   }
   return "Unknown";
 }
-
-static void print_indent(int indent) {
-  for (int i = 0; i < indent; i++)
-    printf("  ");
-}
-
-static void print_list(const char *label, const NodeList *list, int indent) {
-  if (list->count == 0)
-    return;
-  print_indent(indent);
-  printf("%s:\n", label);
-  for (size_t i = 0; i < list->count; i++)
-    ast_print(list->items[i], indent + 1);
-}
-
-void ast_print(const Node *node, int indent) {
-  if (node == NULL) {
-    print_indent(indent);
-    printf("<null>\n");
-    return;
-  }
-
-  print_indent(indent);
-  printf("%s", node_kind_to_string(node->kind));
-
-  switch (node->kind) {
-  case NODE_INT_LIT:
-  case NODE_FLOAT_LIT:
-  case NODE_STRING_LIT:
-    printf(" %s\n", node->as.literal.text ? node->as.literal.text : "");
-    break;
-  case NODE_BOOL_LIT:
-    printf(" %s\n", node->as.boolean.val ? "true" : "false");
-    break;
-  case NODE_NULL_LIT:
-  case NODE_BREAK:
-  case NODE_CONTINUE:
-    printf("\n");
-    break;
-  case NODE_IDENT:
-    printf(" %s\n", node->as.ident.name);
-    break;
-  case NODE_UNARY:
-  case NODE_POSTFIX:
-    printf(" (%s)\n", token_type_to_string(node->as.unary.op));
-    ast_print(node->as.unary.operand, indent + 1);
-    break;
-  case NODE_BINARY:
-    printf(" (%s)\n", token_type_to_string(node->as.binary.op));
-    ast_print(node->as.binary.left, indent + 1);
-    ast_print(node->as.binary.right, indent + 1);
-    break;
-  case NODE_ASSIGN:
-    printf(" (%s)\n", token_type_to_string(node->as.assign.op));
-    ast_print(node->as.assign.target, indent + 1);
-    ast_print(node->as.assign.val, indent + 1);
-    break;
-  case NODE_CALL:
-    printf("\n");
-    ast_print(node->as.call.callee, indent + 1);
-    print_list("args", &node->as.call.args, indent + 1);
-    break;
-  case NODE_MEMBER:
-    printf(" .%s\n", node->as.member.field);
-    ast_print(node->as.member.obj, indent + 1);
-    break;
-  case NODE_INDEX:
-    printf("\n");
-    ast_print(node->as.subscript.obj, indent + 1);
-    ast_print(node->as.subscript.idx, indent + 1);
-    break;
-  case NODE_HEAP:
-    printf("\n");
-    ast_print(node->as.heap.val, indent + 1);
-    break;
-  case NODE_TYPE_NAME:
-    printf(" %s\n", node->as.type_name.name);
-    break;
-  case NODE_TYPE_PTR:
-    printf("\n");
-    ast_print(node->as.pointer.pointee, indent + 1);
-    break;
-  case NODE_TYPE_ARR:
-    printf("\n");
-    if (node->as.array.size) {
-      print_indent(indent + 1);
-      printf("size:\n");
-      ast_print(node->as.array.size, indent + 2);
-    }
-    ast_print(node->as.array.elem, indent + 1);
-    break;
-  case NODE_LET:
-    printf(" %s%s\n", node->as.let.is_const ? "const " : "", node->as.let.name);
-    if (node->as.let.type)
-      ast_print(node->as.let.type, indent + 1);
-    if (node->as.let.init)
-      ast_print(node->as.let.init, indent + 1);
-    break;
-  case NODE_EXPR_STMT:
-    printf("\n");
-    ast_print(node->as.expr_stmt.expr, indent + 1);
-    break;
-  case NODE_BLOCK:
-    printf("\n");
-    print_list("stmts", &node->as.block.stmts, indent + 1);
-    break;
-  case NODE_IF:
-    printf("\n");
-    ast_print(node->as.if_stmt.cond, indent + 1);
-    ast_print(node->as.if_stmt.then_branch, indent + 1);
-    if (node->as.if_stmt.else_branch)
-      ast_print(node->as.if_stmt.else_branch, indent + 1);
-    break;
-  case NODE_WHILE:
-    printf("\n");
-    ast_print(node->as.while_stmt.cond, indent + 1);
-    ast_print(node->as.while_stmt.body, indent + 1);
-    break;
-  case NODE_DO_WHILE:
-    printf("\n");
-    ast_print(node->as.do_while.body, indent + 1);
-    ast_print(node->as.do_while.cond, indent + 1);
-    break;
-  case NODE_FOR:
-    printf("\n");
-    ast_print(node->as.for_stmt.init, indent + 1);
-    ast_print(node->as.for_stmt.cond, indent + 1);
-    ast_print(node->as.for_stmt.post, indent + 1);
-    ast_print(node->as.for_stmt.body, indent + 1);
-    break;
-  case NODE_RETURN:
-    printf("\n");
-    if (node->as.ret.val)
-      ast_print(node->as.ret.val, indent + 1);
-    break;
-  case NODE_FN:
-    printf(" %s%s\n", node->as.fn.is_pub ? "pub " : "", node->as.fn.name);
-    print_list("params", &node->as.fn.params, indent + 1);
-    if (node->as.fn.ret_type) {
-      print_indent(indent + 1);
-      printf("returns:\n");
-      ast_print(node->as.fn.ret_type, indent + 2);
-    }
-    ast_print(node->as.fn.body, indent + 1);
-    break;
-  case NODE_PARAM:
-    printf(" %s\n", node->as.param.name);
-    if (node->as.param.type)
-      ast_print(node->as.param.type, indent + 1);
-    break;
-  case NODE_TYPE_DECL:
-    printf(" %s%s\n", node->as.type_decl.is_pub ? "pub " : "",
-           node->as.type_decl.name);
-    ast_print(node->as.type_decl.def, indent + 1);
-    break;
-  case NODE_STRUCT:
-  case NODE_UNION:
-    printf("\n");
-    print_list("fields", &node->as.record.fields, indent + 1);
-    break;
-  case NODE_ENUM:
-    printf("\n");
-    print_list("variants", &node->as.enom.variants, indent + 1);
-    break;
-  case NODE_FIELD:
-    printf(" %s\n", node->as.field.name);
-    ast_print(node->as.field.type, indent + 1);
-    break;
-  case NODE_ENUM_VAR:
-    printf(" %s\n", node->as.enum_variant.name);
-    if (node->as.enum_variant.val)
-      ast_print(node->as.enum_variant.val, indent + 1);
-    break;
-  case NODE_IMPORT:
-    printf(" %s\n", node->as.import.path);
-    break;
-  case NODE_PROGRAM:
-    printf("\n");
-    print_list("decls", &node->as.program.decls, indent + 1);
-    break;
-  }
-}
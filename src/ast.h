@@ -18,6 +18,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "allocator.h"
 #include "lexer.h"
@@ -71,13 +72,24 @@ typedef enum NodeKind {
   NODE_PROGRAM,
 } NodeKind;
 
+// Nodes are allocated at node_size(kind), which covers the header and only the
+// `as` variant for that kind, so a leaf doesn't pay for the whole union. Reach
+// fields through the matching `as.*` member only, and never copy a Node by
+// value
 struct Node {
   NodeKind kind;
-  size_t line;
+  uint32_t line; // 32 bits, as in FlatAst, to keep the header at 16 bytes
+  uint64_t hash; // structural hash of the subtree, see hash_node()
   union {
     struct {
       char *text;
-    } literal;
+    } literal; // string literals; numbers are decoded by the lexer
+    struct {
+      uint64_t val;
+    } integer;
+    struct {
+      double val;
+    } floating;
     struct {
       bool val;
     } boolean;
@@ -114,12 +126,18 @@ struct Node {
       Node *val;
     } heap;
     struct {
+      uint32_t refs; // owners of an interned node, see node_refs()
+    } type; // how every TYPE_* variant starts
+    struct {
+      uint32_t refs;
       char *name;
     } type_name;
     struct {
+      uint32_t refs;
       Node *pointee;
     } pointer;
     struct {
+      uint32_t refs;
       Node *size; // NULL => slice []T, otherwise sized array [N]T
       Node *elem;
     } array;
@@ -162,7 +180,10 @@ struct Node {
       char *name;
       NodeList params;
       Node *ret_type; // may be NULL
-      Node *body;
+      Node *body;     // NULL while a lazily skipped body is pending
+      size_t body_start; // byte span of the body braces, set when skipped
+      size_t body_end;
+      uint64_t body_hash; // of the bytes in that span, hashed in for the body
     } fn;
     struct {
       char *name;
@@ -196,14 +217,196 @@ struct Node {
   } as;
 };
 
+// Bytes allocated for a node of this kind
+size_t node_size(NodeKind kind);
 Node *new_node(Allocator *a, NodeKind kind, size_t line);
 void free_node(Allocator *a, Node *node);
 void node_list_push(Allocator *a, NodeList *list, Node *node);
 
+// Owners of an interned type node, the table included; 0 for every other node
+static inline uint32_t node_refs(const Node *node) {
+  return node->kind >= NODE_TYPE_NAME && node->kind <= NODE_TYPE_ARR
+             ? node->as.type.refs
+             : 0;
+}
+
+// Where a kind keeps its children, in source order: Node * fields and
+// NodeLists, found by offset, so a pass can reach any node's children without
+// its own switch over NodeKind. A kind has at most one string (a name, path or
+// string literal), at `text`
+#define CHILD_LIST 1     // a NodeList rather than a Node *
+#define CHILD_OPTIONAL 2 // NULL is a normal value, not a parse error
+
+typedef struct ChildSlot {
+  const char *name; // the field's name above, e.g. "left" or "args"
+  uint8_t offset;
+  uint8_t flags;
+} ChildSlot;
+
+typedef struct ChildTable {
+  uint8_t text; // offset of the string field, 0 if the kind has none
+  uint8_t count;
+  ChildSlot slots[4];
+} ChildTable;
+
+const ChildTable *child_table(NodeKind kind);
+
+static inline Node *slot_node(const Node *node, const ChildSlot *slot) {
+  return *(Node *const *)((const char *)node + slot->offset);
+}
+
+static inline const NodeList *slot_list(const Node *node,
+                                        const ChildSlot *slot) {
+  return (const NodeList *)((const char *)node + slot->offset);
+}
+
+// The node's name, path or string literal, or NULL
+static inline char *node_text(const Node *node) {
+  uint8_t text = child_table(node->kind)->text;
+  return text ? *(char *const *)((const char *)node + text) : NULL;
+}
+
+// Depth-first traversal without recursion. The path from the root is kept on
+// an explicit stack, so trees of any depth are safe to walk
+typedef enum WalkStep {
+  WALK_CONTINUE,
+  WALK_SKIP, // from pre: leave out the node's children and its post call
+  WALK_STOP, // end the walk here
+} WalkStep;
+
+// Where the walk met a node
+typedef struct WalkPos {
+  const Node *parent;    // NULL for the root
+  const ChildSlot *slot; // the parent's slot holding the node
+  size_t index;          // position in a CHILD_LIST slot, else 0
+  size_t depth;          // 0 for the root
+} WalkPos;
+
+typedef struct AstVisitor {
+  // Before the node's children; NULL to always continue
+  WalkStep (*pre)(Node *node, const WalkPos *pos, void *ctx);
+  // After them. The walk doesn't look at the node again, so post may free it
+  WalkStep (*post)(Node *node, const WalkPos *pos, void *ctx);
+  void *ctx;
+  bool nulls; // call pre with NULL for empty fields and list items too
+} AstVisitor;
+
+// False only if the stack couldn't grow, which ends the walk early. Short
+// paths need no allocation at all
+bool walk_ast(Allocator *a, Node *root, const AstVisitor *visitor);
+
+// Add `delta` to the line of every node in the tree, e.g. a declaration that
+// moved because lines were inserted or removed above it. Unsigned wraparound
+// makes (size_t)-n move it up by n lines
+void shift_node_lines(Allocator *a, Node *node, size_t delta);
+
+// A 64-bit hash of `len` bytes, mixed well enough that inputs differing in a
+// few bytes anywhere hash apart; for names, and for source text
+uint64_t hash_bytes(const char *bytes, size_t len);
+
+// Set node->hash from the node's kind, names, literal values, operators and
+// flags, and the hashes of its children in order, which must be set already.
+// Lines and body spans are left out, so equal subtrees hash equal wherever
+// they sit in the source. A lazily skipped fn body counts by a hash of its
+// bytes until parse_fn_body() parses it, so functions that differ only there
+// still hash apart. The parser calls this as each node completes, so every
+// node it returns carries its hash (NULL-safe)
+void hash_node(Node *node);
+
+// Nodes of a tree by structural hash, e.g. to find a subtree seen before or
+// functions that are duplicates of each other. Interned types go in once,
+// however many places use them. The index borrows the nodes: it's stale once
+// the tree changes
+typedef struct SubtreeEntry {
+  const Node *node;
+  size_t next; // 1 + index of the next node with this hash, 0 at the end
+} SubtreeEntry;
+
+typedef struct SubtreeSlot {
+  uint64_t hash;
+  size_t head; // 1 + index of its first entry, 0 when the slot is empty
+} SubtreeSlot;
+
+typedef struct SubtreeIndex {
+  SubtreeSlot *slots; // one per distinct hash, open addressing
+  size_t count;
+  size_t cap; // 0 or a power of two
+  SubtreeEntry *entries; // every node, chained from its hash's slot
+  size_t entry_count;
+  size_t entry_cap;
+} SubtreeIndex;
+
+void init_subtree_index(SubtreeIndex *index);
+
+// Add every node under `root`. False if out of memory, with the index holding
+// only part of the tree
+bool index_subtrees(Allocator *a, SubtreeIndex *index, const Node *root);
+
+// Store up to `max` nodes with this hash in `out`, the last indexed first, and
+// return how many the index holds in all. Equal hashes mean equal subtrees up
+// to a 64-bit collision
+size_t find_subtrees(const SubtreeIndex *index, uint64_t hash,
+                     const Node **out, size_t max);
+void free_subtree_index(Allocator *a, SubtreeIndex *index);
+
+// Memory a tree holds, by node kind. Interned types count once, however many
+// places use them
+typedef struct KindMemory {
+  size_t nodes;
+  size_t node_bytes;   // at node_size(), header included
+  size_t string_bytes; // names, paths and literals the nodes own, with NULs
+  size_t list_bytes;   // NodeList arrays at their capacity
+  size_t list_slack;   // entries allocated but unused: cap - count
+} KindMemory;
+
+typedef struct AstMemory {
+  KindMemory kinds[NODE_PROGRAM + 1];
+  KindMemory total;
+} AstMemory;
+
+// Walk the tree under `root` and fill `out`. False if out of memory, with
+// `out` covering only part of the tree
+bool measure_ast_memory(Allocator *a, const Node *root, AstMemory *out);
+
+// One line per kind present, then the totals and the bytes per line of a
+// `lines`-line source (0 to leave that out)
+void report_ast_memory(LogSink *sink, const AstMemory *memory, size_t lines);
+
+// Hash-consing table for type nodes. Structurally equal TYPE_NAME, TYPE_PTR
+// and TYPE_ARR (slices, or sized by an integer literal) share one immutable
+// node, so two interned types are equal exactly when the pointers are. An
+// interned node counts its owners in `refs`, the table included, and
+// free_node() just drops a reference while others remain. Shared by every
+// occurrence, interned nodes carry line 0; positions come from the
+// declaration using the type
+typedef struct TypeSlot {
+  uint64_t hash;
+  Node *node; // NULL when empty
+} TypeSlot;
+
+typedef struct TypeTable {
+  TypeSlot *slots; // open addressing, linear probing
+  size_t count;
+  size_t cap; // 0 or a power of two
+} TypeTable;
+
+void init_type_table(TypeTable *table);
+
+// The interned node equal to `probe`, with a reference taken for the caller,
+// or NULL. `probe` may live on the stack
+Node *lookup_type(TypeTable *table, const Node *probe);
+
+// Take ownership of `node`, whose type children must already be interned, and
+// return the caller's reference to its interned equal: `node` itself, now in
+// the table, or an existing node, in which case `node` is freed. Nodes that
+// can't be interned, like [n]T, come back unchanged
+Node *intern_type(Allocator *a, TypeTable *table, Node *node);
+
+// Drop the nodes nothing but the table refers to any more
+void sweep_type_table(Allocator *a, TypeTable *table);
+void free_type_table(Allocator *a, TypeTable *table);
+
 // Duplicate a NUL-terminated string into allocator-owned memory (NULL-safe)
 char *ast_copy_str(Allocator *a, const char *s);
 
-// Pretty-print a node tree to stdout for debugging
-void ast_print(const Node *node, int indent);
-
 const char *node_kind_to_string(NodeKind kind);
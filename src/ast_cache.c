@@ -0,0 +1,182 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ast_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define AST_CACHE_MAGIC 0x41445544u // "DUDA" read little-endian
+
+// Native byte order throughout: a cache from a machine of the other byte
+// order fails the magic check and is treated as a miss
+typedef struct CacheHeader {
+  uint32_t magic;
+  uint32_t format;
+  uint64_t key;
+  uint32_t count;
+  uint32_t extra_count;
+  uint32_t strings_len;
+  uint32_t reserved;
+} CacheHeader;
+
+static uint64_t mix(uint64_t h, uint64_t word) {
+  h = (h << 29 | h >> 35) ^ word;
+  return h * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+uint64_t ast_cache_key(const char *src, size_t len) {
+  uint64_t h = mix(AST_CACHE_FORMAT, NODE_PROGRAM + 1);
+  for (const char *v = DUD_VERSION; *v; v++)
+    h = mix(h, (unsigned char)*v);
+  h = mix(h, len);
+
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, src + i, 8);
+    h = mix(h, word);
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, src + i, len - i);
+  h = mix(h, tail);
+
+  // Final avalanche so nearby sources land on unrelated names
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  return h;
+}
+
+static bool entry_path(char *path, size_t size, const char *dir, uint64_t key,
+                       const char *suffix) {
+  int n = snprintf(path, size, "%s/%016llx.ast%s", dir,
+                   (unsigned long long)key, suffix);
+  return n > 0 && (size_t)n < size;
+}
+
+static size_t payload_size(const CacheHeader *h) {
+  return flat_block_size(h->count, h->extra_count, h->strings_len);
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+bool store_cached_ast(const char *dir, uint64_t key, const FlatAst *ast) {
+  if (ast->data == NULL)
+    return false;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+    return false;
+
+  CacheHeader header = {AST_CACHE_MAGIC, AST_CACHE_FORMAT, key,
+                        ast->count,      ast->extra_count, ast->strings_len,
+                        0};
+  if (payload_size(&header) != ast->size)
+    return false;
+
+  // Write beside the entry, then rename over it
+  char tmp[4096], path[4096];
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+  if (!entry_path(tmp, sizeof(tmp), dir, key, suffix) ||
+      !entry_path(path, sizeof(path), dir, key, ""))
+    return false;
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    return false;
+  bool ok = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, ast->data, ast->size);
+  ok = close(fd) == 0 && ok;
+  if (ok && rename(tmp, path) == 0)
+    return true;
+  unlink(tmp);
+  return false;
+}
+
+bool load_cached_ast(CachedAst *cached, const char *dir, uint64_t key) {
+  memset(cached, 0, sizeof(*cached));
+
+  char path[4096];
+  if (!entry_path(path, sizeof(path), dir, key, ""))
+    return false;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t map_size = (size_t)st.st_size;
+  void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  const CacheHeader *header = (const CacheHeader *)map;
+  size_t size = payload_size(header);
+  if (header->magic != AST_CACHE_MAGIC ||
+      header->format != AST_CACHE_FORMAT || header->key != key ||
+      header->count == 0 || sizeof(CacheHeader) + size != map_size ||
+      (header->strings_len > 0 &&
+       ((const char *)map)[map_size - 1] != '\0')) {
+    munmap(map, map_size);
+    return false;
+  }
+
+  // The header keeps the block 8-byte aligned
+  FlatAst *ast = &cached->ast;
+  ast->count = header->count;
+  ast->extra_count = header->extra_count;
+  ast->strings_len = header->strings_len;
+  ast->size = size;
+  layout_flat_block(ast, (char *)map + sizeof(CacheHeader), header->count,
+                    header->extra_count);
+  // The header only vouches for the sizes; an index in the payload could
+  // still point anywhere
+  if (!check_flat_ast(ast)) {
+    munmap(map, map_size);
+    memset(cached, 0, sizeof(*cached));
+    return false;
+  }
+  cached->map = map;
+  cached->map_size = map_size;
+  return true;
+}
+
+void unload_cached_ast(CachedAst *cached) {
+  if (cached->map != NULL)
+    munmap(cached->map, cached->map_size);
+  memset(cached, 0, sizeof(*cached));
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flat_ast.h"
+
+// On-disk cache of flattened ASTs. An entry is a small header followed by the
+// FlatAst block exactly as flatten_ast() lays it out: children are indices, so
+// the bytes mean the same thing wherever they're mapped. A hit maps the file
+// and points a FlatAst into it; nothing is allocated or copied per node.
+//
+// Entries are named after a key that covers the source bytes, the compiler
+// version and AST_CACHE_FORMAT; bump the format whenever NodeKind or the
+// FlatAst payload layout changes.
+#define AST_CACHE_FORMAT 1
+
+#ifndef DUD_VERSION
+#define DUD_VERSION "dev"
+#endif
+
+typedef struct CachedAst {
+  FlatAst ast; // read-only view of the mapping: never free_flat_ast() it
+  void *map;
+  size_t map_size;
+} CachedAst;
+
+uint64_t ast_cache_key(const char *src, size_t len);
+
+// Write `ast` to `dir`, creating the directory if needed. The entry appears
+// atomically, so a concurrent reader sees either nothing or the whole file
+bool store_cached_ast(const char *dir, uint64_t key, const FlatAst *ast);
+
+// Map the entry for `key`. False on a miss or an entry that doesn't match the
+// key, this format or its own size, or that fails check_flat_ast()
+bool load_cached_ast(CachedAst *cached, const char *dir, uint64_t key);
+void unload_cached_ast(CachedAst *cached);
@@ -0,0 +1,476 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ast_dump.h"
+
+#include <math.h>
+#include <string.h>
+
+static void init_writer(AstWriter *writer) {
+  writer->file = NULL;
+  writer->sink = NULL;
+  writer->allocator = NULL;
+  writer->buf = writer->inline_buf;
+  writer->len = 0;
+  writer->cap = AST_WRITER_BUFFER;
+  writer->failed = false;
+}
+
+void init_file_writer(AstWriter *writer, FILE *file) {
+  init_writer(writer);
+  writer->file = file;
+}
+
+void init_sink_writer(AstWriter *writer, LogSink *sink) {
+  init_writer(writer);
+  writer->sink = sink;
+}
+
+void init_memory_writer(AstWriter *writer, Allocator *allocator) {
+  init_writer(writer);
+  writer->allocator = allocator;
+  writer->buf = NULL;
+  writer->cap = 0;
+}
+
+void free_ast_writer(AstWriter *writer) {
+  if (writer->allocator && writer->buf)
+    FREE(writer->allocator, writer->buf, writer->cap, "AstText");
+  if (writer->allocator)
+    init_memory_writer(writer, writer->allocator);
+}
+
+// Hand the buffered text on. A sink gets whole lines, keeping a partial one
+// back unless it's the end of the dump or fills the buffer by itself
+static void drain(AstWriter *writer, bool all) {
+  if (writer->file) {
+    if (fwrite(writer->buf, 1, writer->len, writer->file) != writer->len)
+      writer->failed = true;
+    writer->len = 0;
+    return;
+  }
+
+  char *line = writer->buf;
+  char *end = writer->buf + writer->len;
+  for (char *nl; (nl = memchr(line, '\n', (size_t)(end - line)));
+       line = nl + 1)
+    sink_println(writer->sink, "%.*s", (int)(nl - line), line);
+  if (line < end && (all || line == writer->buf)) {
+    sink_println(writer->sink, "%.*s", (int)(end - line), line);
+    line = end;
+  }
+  writer->len = (size_t)(end - line);
+  memmove(writer->buf, line, writer->len);
+}
+
+static bool grow(AstWriter *writer, size_t need) {
+  size_t new_cap = writer->cap < 256 ? 256 : writer->cap * 2;
+  while (new_cap - writer->len < need)
+    new_cap *= 2;
+  char *buf = (char *)REALLOC(writer->allocator, writer->buf, writer->cap,
+                              new_cap, "AstText");
+  if (buf == NULL) {
+    writer->failed = true;
+    return false;
+  }
+  writer->buf = buf;
+  writer->cap = new_cap;
+  return true;
+}
+
+static void put(AstWriter *writer, const char *s, size_t n) {
+  while (n > writer->cap - writer->len) {
+    if (writer->allocator) {
+      if (!grow(writer, n))
+        return;
+      break;
+    }
+    size_t room = writer->cap - writer->len;
+    memcpy(writer->buf + writer->len, s, room);
+    writer->len += room;
+    s += room;
+    n -= room;
+    drain(writer, false);
+  }
+  memcpy(writer->buf + writer->len, s, n);
+  writer->len += n;
+}
+
+static void put_char(AstWriter *writer, char c) {
+  if (writer->len < writer->cap)
+    writer->buf[writer->len++] = c;
+  else
+    put(writer, &c, 1);
+}
+
+static void put_str(AstWriter *writer, const char *s) {
+  put(writer, s, strlen(s));
+}
+
+static void put_u64(AstWriter *writer, uint64_t val) {
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[sizeof(digits) - ++n] = (char)('0' + val % 10);
+    val /= 10;
+  } while (val);
+  put(writer, digits + sizeof(digits) - n, n);
+}
+
+static void put_f64(AstWriter *writer, double val) {
+  char text[32];
+  int n = snprintf(text, sizeof(text), "%.17g", val);
+  put(writer, text, (size_t)n);
+}
+
+// A JSON string, which also reads back as an S-expression one. Bytes other
+// than quotes, backslashes and control characters are copied in runs
+static void put_quoted(AstWriter *writer, const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  put_char(writer, '"');
+  const char *run = s;
+  for (;; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    put(writer, run, (size_t)(s - run));
+    if (c == '\0')
+      break;
+    char esc[6] = {'\\', (char)c};
+    size_t n = 2;
+    if (c == '\n')
+      esc[1] = 'n';
+    else if (c == '\t')
+      esc[1] = 't';
+    else if (c == '\r')
+      esc[1] = 'r';
+    else if (c < 0x20) {
+      memcpy(esc + 1, "u00", 3);
+      esc[4] = hex[c >> 4];
+      esc[5] = hex[c & 15];
+      n = 6;
+    }
+    put(writer, esc, n);
+    run = s + 1;
+  }
+  put_char(writer, '"');
+}
+
+// The end of a dump: everything goes out, and memory gets its terminator
+static bool flush(AstWriter *writer) {
+  if (writer->allocator) {
+    if (writer->len < writer->cap || grow(writer, 1))
+      writer->buf[writer->len] = '\0';
+  } else if (writer->len > 0) {
+    drain(writer, true);
+  }
+  if (writer->file && fflush(writer->file) != 0)
+    writer->failed = true;
+  return !writer->failed;
+}
+
+typedef struct DumpState {
+  AstWriter *writer;
+  AstFormat format;
+  int indent; // tree format only
+} DumpState;
+
+// "TOKEN_PLUS" without its prefix
+static const char *op_name(TokenType op) {
+  const char *name = token_type_to_string(op);
+  return strncmp(name, "TOKEN_", 6) == 0 ? name + 6 : name;
+}
+
+static TokenType node_op(const Node *node) {
+  switch (node->kind) {
+  case NODE_BINARY:
+    return node->as.binary.op;
+  case NODE_ASSIGN:
+    return node->as.assign.op;
+  default:
+    return node->as.unary.op;
+  }
+}
+
+static void put_indent(AstWriter *writer, int indent) {
+  for (int i = 0; i < indent; i++)
+    put(writer, "  ", 2);
+}
+
+// What follows the kind on a node's line
+static void put_details(AstWriter *writer, const Node *node) {
+  switch (node->kind) {
+  case NODE_INT_LIT:
+    put_char(writer, ' ');
+    put_u64(writer, node->as.integer.val);
+    break;
+  case NODE_FLOAT_LIT:
+    put_char(writer, ' ');
+    put_f64(writer, node->as.floating.val);
+    break;
+  case NODE_BOOL_LIT:
+    put_str(writer, node->as.boolean.val ? " true" : " false");
+    break;
+  case NODE_UNARY:
+  case NODE_POSTFIX:
+  case NODE_BINARY:
+  case NODE_ASSIGN:
+    put_str(writer, " (");
+    put_str(writer, token_type_to_string(node_op(node)));
+    put_char(writer, ')');
+    break;
+  case NODE_MEMBER:
+    put_str(writer, " .");
+    break;
+  case NODE_LET:
+    put_str(writer, node->as.let.is_const ? " const " : " ");
+    break;
+  case NODE_FN:
+    put_str(writer, node->as.fn.is_pub ? " pub " : " ");
+    break;
+  case NODE_TYPE_DECL:
+    put_str(writer, node->as.type_decl.is_pub ? " pub " : " ");
+    break;
+  case NODE_STRING_LIT:
+  case NODE_IDENT:
+  case NODE_TYPE_NAME:
+  case NODE_PARAM:
+  case NODE_FIELD:
+  case NODE_ENUM_VAR:
+  case NODE_IMPORT:
+    put_char(writer, ' ');
+    break;
+  default:
+    break;
+  }
+  const char *text = node_text(node);
+  if (text)
+    put_str(writer, text);
+  put_char(writer, '\n');
+}
+
+// Lists and optional children sit under a line naming their field, since
+// their position alone doesn't say which one they are
+static bool labelled(const WalkPos *pos) {
+  return pos->slot && pos->slot->flags & (CHILD_LIST | CHILD_OPTIONAL);
+}
+
+static WalkStep tree_pre(Node *node, const WalkPos *pos, void *ctx) {
+  DumpState *st = (DumpState *)ctx;
+  if (labelled(pos)) {
+    if (node == NULL && pos->slot->flags & CHILD_OPTIONAL)
+      return WALK_SKIP;
+    if (pos->index == 0) {
+      put_indent(st->writer, st->indent);
+      put_str(st->writer, pos->slot->name);
+      put(st->writer, ":\n", 2);
+    }
+    st->indent++;
+  }
+
+  put_indent(st->writer, st->indent);
+  if (node == NULL) {
+    put_str(st->writer, "<null>\n");
+    if (labelled(pos))
+      st->indent--;
+    return WALK_SKIP;
+  }
+  put_str(st->writer, node_kind_to_string(node->kind));
+  put_details(st->writer, node);
+  st->indent++;
+  return WALK_CONTINUE;
+}
+
+static WalkStep tree_post(Node *node, const WalkPos *pos, void *ctx) {
+  (void)node;
+  DumpState *st = (DumpState *)ctx;
+  st->indent--;
+  if (labelled(pos))
+    st->indent--;
+  return WALK_CONTINUE;
+}
+
+// Start a field: its name in JSON, where "kind" always came first, and just a
+// separator in an S-expression
+static void put_key(DumpState *st, const char *name) {
+  if (st->format == AST_FORMAT_SEXPR) {
+    put_char(st->writer, ' ');
+    return;
+  }
+  put(st->writer, ",\"", 2);
+  put_str(st->writer, name);
+  put(st->writer, "\":", 2);
+}
+
+// A flag S-expressions only mention when it's set
+static void put_flag(DumpState *st, const char *name, bool set) {
+  if (st->format == AST_FORMAT_SEXPR) {
+    if (set) {
+      put_char(st->writer, ' ');
+      put_str(st->writer, name);
+    }
+    return;
+  }
+  put_key(st, name);
+  put_str(st->writer, set ? "true" : "false");
+}
+
+static void put_name(DumpState *st, const char *key, const char *name) {
+  put_key(st, key);
+  if (name == NULL)
+    put_str(st->writer, st->format == AST_FORMAT_SEXPR ? "nil" : "null");
+  else if (st->format == AST_FORMAT_SEXPR)
+    put_str(st->writer, name);
+  else
+    put_quoted(st->writer, name);
+}
+
+static void put_fields(DumpState *st, const Node *node) {
+  AstWriter *writer = st->writer;
+  switch (node->kind) {
+  case NODE_INT_LIT:
+    put_key(st, "value");
+    put_u64(writer, node->as.integer.val);
+    return;
+  case NODE_FLOAT_LIT:
+    put_key(st, "value");
+    if (st->format == AST_FORMAT_JSON && !isfinite(node->as.floating.val))
+      put_str(writer, "null");
+    else
+      put_f64(writer, node->as.floating.val);
+    return;
+  case NODE_STRING_LIT:
+    put_key(st, "value");
+    put_quoted(writer, node->as.literal.text ? node->as.literal.text : "");
+    return;
+  case NODE_BOOL_LIT:
+    put_key(st, "value");
+    put_str(writer, node->as.boolean.val ? "true" : "false");
+    return;
+  case NODE_UNARY:
+  case NODE_POSTFIX:
+  case NODE_BINARY:
+  case NODE_ASSIGN:
+    put_name(st, "op", op_name(node_op(node)));
+    return;
+  case NODE_MEMBER:
+    put_name(st, "field", node->as.member.field);
+    return;
+  case NODE_IMPORT:
+    put_name(st, "path", node->as.import.path);
+    return;
+  case NODE_LET:
+    put_flag(st, "const", node->as.let.is_const);
+    break;
+  case NODE_FN:
+    put_flag(st, "pub", node->as.fn.is_pub);
+    break;
+  case NODE_TYPE_DECL:
+    put_flag(st, "pub", node->as.type_decl.is_pub);
+    break;
+  default:
+    break;
+  }
+  if (child_table(node->kind)->text)
+    put_name(st, "name", node_text(node));
+}
+
+static bool empty_list(const Node *node, const ChildSlot *slot) {
+  return slot->flags & CHILD_LIST && slot_list(node, slot)->count == 0;
+}
+
+// Called on reaching slot `s` of `parent`, or its slot count at the end.
+// Closes the list before it if one is open, then writes the empty lists in
+// between, which the walk never visits
+static void skip_to_slot(DumpState *st, const Node *parent, size_t s) {
+  const ChildSlot *slots = child_table(parent->kind)->slots;
+  size_t first = s;
+  while (first > 0 && empty_list(parent, &slots[first - 1]))
+    first--;
+  if (first > 0 && slots[first - 1].flags & CHILD_LIST)
+    put_char(st->writer, ']');
+  for (size_t i = first; i < s; i++) {
+    put_key(st, slots[i].name);
+    put(st->writer, "[]", 2);
+  }
+}
+
+static WalkStep flat_pre(Node *node, const WalkPos *pos, void *ctx) {
+  DumpState *st = (DumpState *)ctx;
+  bool sexpr = st->format == AST_FORMAT_SEXPR;
+  if (pos->parent) {
+    const ChildSlot *slot = pos->slot;
+    if (pos->index > 0) {
+      put_char(st->writer, sexpr ? ' ' : ',');
+    } else {
+      skip_to_slot(st, pos->parent,
+                   (size_t)(slot - child_table(pos->parent->kind)->slots));
+      put_key(st, slot->name);
+      if (slot->flags & CHILD_LIST)
+        put_char(st->writer, '[');
+    }
+  }
+
+  if (node == NULL) {
+    put_str(st->writer, sexpr ? "nil" : "null");
+    return WALK_SKIP;
+  }
+  if (sexpr) {
+    put_char(st->writer, '(');
+    put_str(st->writer, node_kind_to_string(node->kind));
+  } else {
+    put_str(st->writer, "{\"kind\":\"");
+    put_str(st->writer, node_kind_to_string(node->kind));
+    put_str(st->writer, "\",\"line\":");
+    put_u64(st->writer, node->line);
+  }
+  put_fields(st, node);
+  return WALK_CONTINUE;
+}
+
+static WalkStep flat_post(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  DumpState *st = (DumpState *)ctx;
+  skip_to_slot(st, node, child_table(node->kind)->count);
+  put_char(st->writer, st->format == AST_FORMAT_SEXPR ? ')' : '}');
+  return WALK_CONTINUE;
+}
+
+static bool dump(AstWriter *writer, const Node *node, AstFormat format,
+                 int indent) {
+  DumpState st = {writer, format, indent};
+  AstVisitor visitor = {tree_pre, tree_post, &st, true};
+  if (format != AST_FORMAT_TREE) {
+    visitor.pre = flat_pre;
+    visitor.post = flat_post;
+  }
+  Allocator *a = writer->allocator ? writer->allocator : &raw_allocator;
+  if (!walk_ast(a, (Node *)node, &visitor))
+    writer->failed = true;
+  if (format != AST_FORMAT_TREE)
+    put_char(writer, '\n');
+  return flush(writer);
+}
+
+bool dump_ast(AstWriter *writer, const Node *node, AstFormat format) {
+  return dump(writer, node, format, 0);
+}
+
+void ast_print(const Node *node, int indent) {
+  AstWriter writer;
+  init_file_writer(&writer, stdout);
+  dump(&writer, node, AST_FORMAT_TREE, indent);
+}
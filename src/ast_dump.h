@@ -0,0 +1,66 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "allocator.h"
+#include "ast.h"
+
+typedef enum AstFormat {
+  // Indented, one node per line, children under their field's name
+  AST_FORMAT_TREE,
+  // One line: (Kind details children...), nil for an empty field and
+  // [items...] for a list
+  AST_FORMAT_SEXPR,
+  // One line: {"kind": ..., "line": ..., details, then children by field
+  // name}, null for an empty field and arrays for lists
+  AST_FORMAT_JSON,
+} AstFormat;
+
+// Bytes held before they go to a file or sink
+#define AST_WRITER_BUFFER 16384
+
+// Buffered output for AST dumps. Text is appended to `buf` and only handed on
+// when it fills up or the dump ends, so a dump of millions of nodes is a few
+// hundred writes rather than a printf per node
+typedef struct AstWriter {
+  FILE *file;
+  LogSink *sink;
+  Allocator *allocator; // set for memory writers
+  char *buf;            // a memory writer's whole output, NUL-terminated
+  size_t len;
+  size_t cap;
+  bool failed; // a write or allocation failed; the output is incomplete
+  char inline_buf[AST_WRITER_BUFFER];
+} AstWriter;
+
+void init_file_writer(AstWriter *writer, FILE *file);
+// Each line goes to the sink as one message; a line longer than the buffer
+// arrives in pieces
+void init_sink_writer(AstWriter *writer, LogSink *sink);
+// Collects everything in `buf`, growing it from `allocator`
+void init_memory_writer(AstWriter *writer, Allocator *allocator);
+void free_ast_writer(AstWriter *writer);
+
+// Write `node` and a newline, then flush. False if anything was lost
+bool dump_ast(AstWriter *writer, const Node *node, AstFormat format);
+
+// Pretty-print a node tree to stdout for debugging
+void ast_print(const Node *node, int indent);
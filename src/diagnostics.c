@@ -0,0 +1,207 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "diagnostics.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+static const char *const messages[DIAG_COUNT] = {
+    [DIAG_BAD_TOKEN] = "Bad token.",
+    [DIAG_EXPECTED_DECL] = "Expected a declaration.",
+    [DIAG_EXPECTED_FN_OR_TYPE_AFTER_PUB] =
+        "Exected 'fn' or 'type' after 'pub'.",
+    [DIAG_EXPECTED_MODULE_NAME] = "Expected module name after 'import'.",
+    [DIAG_EXPECTED_SEMI_AFTER_IMPORT] = "Expected ';' after import.",
+    [DIAG_EXPECTED_FN_NAME] = "Expected function name.",
+    [DIAG_EXPECTED_PAREN_AFTER_FN_NAME] = "Expected '(' after function name.",
+    [DIAG_EXPECTED_PARAM_NAME] = "Expected parameter name.",
+    [DIAG_EXPECTED_PARAM_TYPE] =
+        "Expected ':' after parameter name; parameters must have a type.",
+    [DIAG_EXPECTED_PAREN_AFTER_PARAMS] = "Expected ')' after parameters.",
+    [DIAG_EXPECTED_BRACE] = "Expected '{'",
+    [DIAG_EXPECTED_BRACE_AFTER_BLOCK] = "Exected '}' after block.",
+    [DIAG_EXPECTED_TYPE_DECL_NAME] = "Expected type name.",
+    [DIAG_EXPECTED_EQUAL_IN_TYPE_DECL] = "Expected '=' in type declaration.",
+    [DIAG_EXPECTED_SEMI_AFTER_TYPE_DECL] =
+        "Expected ';' after type declaration.",
+    [DIAG_EXPECTED_BRACE_BEFORE_FIELDS] = "Expected '{' to begin fields.",
+    [DIAG_EXPECTED_FIELD_NAME] = "Expected field name.",
+    [DIAG_EXPECTED_FIELD_TYPE] = "Expected ':' after field name",
+    [DIAG_EXPECTED_BRACE_AFTER_FIELDS] = "Expected '}' after fields.",
+    [DIAG_EXPECTED_BRACE_BEFORE_VARIANTS] = "Expected '{' to begin variants.",
+    [DIAG_EXPECTED_VARIANT_NAME] = "Expected variant name.",
+    [DIAG_EXPECTED_BRACE_AFTER_VARIANTS] = "Expected '}' after variants.",
+    [DIAG_EXPECTED_SEMI_AFTER_LOOP_COND] = "Expected ';' after loop condition",
+    [DIAG_EXPECTED_SEMI_AFTER_BREAK] = "Expected ';' after 'break'.",
+    [DIAG_EXPECTED_SEMI_AFTER_CONTINUE] = "Expected ';' after 'continue'.",
+    [DIAG_EXPECTED_SEMI_AFTER_EXPR] = "Expected ';' after expression.",
+    [DIAG_EXPECTED_VAR_NAME] = "Expected variable name.",
+    [DIAG_EXPECTED_SEMI_AFTER_VAR] = "Expected ';' after variable declaration.",
+    [DIAG_EXPECTED_SEMI_AFTER_RETURN] = "Expected ';' after return.",
+    [DIAG_EXPECTED_WHILE_AFTER_DO] = "Expected 'while' after do-block.",
+    [DIAG_EXPECTED_SEMI_AFTER_DO_WHILE] =
+        "Exected ';' after do-while condition.",
+    [DIAG_EXPECTED_BRACKET_IN_ARRAY_TYPE] = "Expected ']' in array type.",
+    [DIAG_EXPECTED_TYPE] = "Expected a type name.",
+    [DIAG_EXPECTED_PROPERTY_NAME] = "Expected property name after '.'.",
+    [DIAG_EXPECTED_PAREN_AFTER_EXPR] = "Expected ')' after expression.",
+    [DIAG_EXPECTED_PAREN_AFTER_ARGS] = "Expected ')' after arguments",
+    [DIAG_EXPECTED_BRACKET_AFTER_INDEX] = "Expected ']' after index.",
+    [DIAG_EXPECTED_EXPR] = "Expected an expression.",
+    [DIAG_BLOCK_TOO_DEEP] = "Blocks nested too deeply.",
+    [DIAG_TYPE_TOO_DEEP] = "Type nested too deeply.",
+    [DIAG_EXPR_TOO_DEEP] = "Expression nested too deeply.",
+};
+
+const char *diag_message(DiagId id) {
+  return id < DIAG_COUNT ? messages[id] : "Unknown error.";
+}
+
+struct DiagChunk {
+  DiagChunk *next;
+  size_t used;
+  size_t cap;
+  char bytes[];
+};
+
+#define DIAG_CHUNK_SIZE 4096
+
+static const char *arena_copy(Diagnostics *diags, const char *s) {
+  size_t len = strlen(s) + 1;
+  DiagChunk *chunk = diags->chunks;
+  if (chunk == NULL || chunk->cap - chunk->used < len) {
+    size_t cap = len > DIAG_CHUNK_SIZE ? len : DIAG_CHUNK_SIZE;
+    chunk = (DiagChunk *)ALLOC(diags->allocator, sizeof(DiagChunk) + cap,
+                               "DiagChunk");
+    if (chunk == NULL)
+      return NULL;
+    chunk->next = diags->chunks;
+    chunk->used = 0;
+    chunk->cap = cap;
+    diags->chunks = chunk;
+  }
+  char *copy = chunk->bytes + chunk->used;
+  memcpy(copy, s, len);
+  chunk->used += len;
+  return copy;
+}
+
+void init_diagnostics(Diagnostics *diags, Allocator *allocator) {
+  diags->items = NULL;
+  diags->count = diags->cap = 0;
+  diags->chunks = NULL;
+  diags->allocator = allocator;
+}
+
+void add_diagnostic(Diagnostics *diags, DiagKind kind, DiagId id,
+                    size_t offset, size_t length, const char *arg) {
+  if (diags->count + 1 > diags->cap) {
+    size_t old_cap = diags->cap;
+    size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+    Diagnostic *items = (Diagnostic *)REALLOC(
+        diags->allocator, diags->items, old_cap * sizeof(Diagnostic),
+        new_cap * sizeof(Diagnostic), "Diagnostics");
+    if (items == NULL)
+      return;
+    diags->items = items;
+    diags->cap = new_cap;
+  }
+
+  Diagnostic *diag = &diags->items[diags->count++];
+  diag->kind = kind;
+  diag->id = id;
+  diag->offset = offset;
+  diag->length = length;
+  diag->arg = arg ? arena_copy(diags, arg) : NULL;
+}
+
+// The rendered text, grown as needed and written out in one go
+typedef struct TextBuffer {
+  char *data;
+  size_t len;
+  size_t cap;
+  Allocator *allocator;
+} TextBuffer;
+
+static void append(TextBuffer *buf, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+  va_end(args);
+  if (n < 0)
+    return;
+
+  if ((size_t)n >= buf->cap - buf->len) {
+    size_t old_cap = buf->cap;
+    size_t new_cap = old_cap * 2;
+    while (new_cap - buf->len <= (size_t)n)
+      new_cap *= 2;
+    char *data = (char *)REALLOC(buf->allocator, buf->data, old_cap, new_cap,
+                                 "DiagText");
+    if (data == NULL)
+      return;
+    buf->data = data;
+    buf->cap = new_cap;
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+    va_end(args);
+  }
+  buf->len += (size_t)n;
+}
+
+void render_diagnostics(const Diagnostics *diags, const LineIndex *lines,
+                        FILE *out) {
+  if (diags->count == 0)
+    return;
+
+  TextBuffer buf = {NULL, 0, 256, diags->allocator};
+  buf.data = (char *)ALLOC(buf.allocator, buf.cap, "DiagText");
+  if (buf.data == NULL)
+    return;
+
+  for (size_t i = 0; i < diags->count; i++) {
+    const Diagnostic *diag = &diags->items[i];
+    SourcePos pos = line_index_lookup(lines, diag->offset);
+    append(&buf, "[line %zu:%zu] Error", pos.line, pos.column);
+    if (diag->id == DIAG_BAD_TOKEN) {
+      append(&buf, ": %s\n", diag->arg ? diag->arg : "lex error");
+      continue;
+    }
+    if (diag->arg)
+      append(&buf, " at '%s'", diag->arg);
+    else if (diag->length == 0)
+      append(&buf, " at end");
+    append(&buf, ": %s\n", diag_message(diag->id));
+  }
+
+  fwrite(buf.data, 1, buf.len, out);
+  FREE(buf.allocator, buf.data, buf.cap, "DiagText");
+}
+
+void free_diagnostics(Diagnostics *diags) {
+  if (diags->items)
+    FREE(diags->allocator, diags->items, diags->cap * sizeof(Diagnostic),
+         "Diagnostics");
+  DiagChunk *chunk = diags->chunks;
+  while (chunk) {
+    DiagChunk *next = chunk->next;
+    FREE(diags->allocator, chunk, sizeof(DiagChunk) + chunk->cap,
+         "DiagChunk");
+    chunk = next;
+  }
+  init_diagnostics(diags, diags->allocator);
+}
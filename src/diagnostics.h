@@ -0,0 +1,113 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "allocator.h"
+#include "lexer.h"
+
+typedef enum DiagKind {
+  DIAG_LEX_ERROR,    // the lexer couldn't make a token
+  DIAG_SYNTAX_ERROR, // the parser didn't find what it expected
+} DiagKind;
+
+// Every message the parser reports. The wording lives in one table (see
+// diag_message()), so tools can match on the id rather than the text
+typedef enum DiagId {
+  DIAG_BAD_TOKEN, // the lexer's own message is the argument
+  DIAG_EXPECTED_DECL,
+  DIAG_EXPECTED_FN_OR_TYPE_AFTER_PUB,
+  DIAG_EXPECTED_MODULE_NAME,
+  DIAG_EXPECTED_SEMI_AFTER_IMPORT,
+  DIAG_EXPECTED_FN_NAME,
+  DIAG_EXPECTED_PAREN_AFTER_FN_NAME,
+  DIAG_EXPECTED_PARAM_NAME,
+  DIAG_EXPECTED_PARAM_TYPE,
+  DIAG_EXPECTED_PAREN_AFTER_PARAMS,
+  DIAG_EXPECTED_BRACE,
+  DIAG_EXPECTED_BRACE_AFTER_BLOCK,
+  DIAG_EXPECTED_TYPE_DECL_NAME,
+  DIAG_EXPECTED_EQUAL_IN_TYPE_DECL,
+  DIAG_EXPECTED_SEMI_AFTER_TYPE_DECL,
+  DIAG_EXPECTED_BRACE_BEFORE_FIELDS,
+  DIAG_EXPECTED_FIELD_NAME,
+  DIAG_EXPECTED_FIELD_TYPE,
+  DIAG_EXPECTED_BRACE_AFTER_FIELDS,
+  DIAG_EXPECTED_BRACE_BEFORE_VARIANTS,
+  DIAG_EXPECTED_VARIANT_NAME,
+  DIAG_EXPECTED_BRACE_AFTER_VARIANTS,
+  DIAG_EXPECTED_SEMI_AFTER_LOOP_COND,
+  DIAG_EXPECTED_SEMI_AFTER_BREAK,
+  DIAG_EXPECTED_SEMI_AFTER_CONTINUE,
+  DIAG_EXPECTED_SEMI_AFTER_EXPR,
+  DIAG_EXPECTED_VAR_NAME,
+  DIAG_EXPECTED_SEMI_AFTER_VAR,
+  DIAG_EXPECTED_SEMI_AFTER_RETURN,
+  DIAG_EXPECTED_WHILE_AFTER_DO,
+  DIAG_EXPECTED_SEMI_AFTER_DO_WHILE,
+  DIAG_EXPECTED_BRACKET_IN_ARRAY_TYPE,
+  DIAG_EXPECTED_TYPE,
+  DIAG_EXPECTED_PROPERTY_NAME,
+  DIAG_EXPECTED_PAREN_AFTER_EXPR,
+  DIAG_EXPECTED_PAREN_AFTER_ARGS,
+  DIAG_EXPECTED_BRACKET_AFTER_INDEX,
+  DIAG_EXPECTED_EXPR,
+  DIAG_BLOCK_TOO_DEEP,
+  DIAG_TYPE_TOO_DEEP,
+  DIAG_EXPR_TOO_DEEP,
+  DIAG_COUNT
+} DiagId;
+
+typedef struct Diagnostic {
+  DiagKind kind;
+  DiagId id;
+  size_t offset; // the source bytes it's about
+  size_t length;
+  // The offending token's text, owned by the Diagnostics. NULL for
+  // punctuation and for the end of input (the only span of length 0). For
+  // DIAG_BAD_TOKEN it's the lexer's message
+  const char *arg;
+} Diagnostic;
+
+// Strings the diagnostics point into, bump-allocated from a list of chunks
+typedef struct DiagChunk DiagChunk;
+
+// Diagnostics in the order they were recorded. Nothing is printed until
+// render_diagnostics(), so a run that never renders pays only for recording
+typedef struct Diagnostics {
+  Diagnostic *items;
+  size_t count;
+  size_t cap;
+  DiagChunk *chunks;
+  Allocator *allocator;
+} Diagnostics;
+
+void init_diagnostics(Diagnostics *diags, Allocator *allocator);
+void add_diagnostic(Diagnostics *diags, DiagKind kind, DiagId id,
+                    size_t offset, size_t length, const char *arg);
+
+// The message for `id`, e.g. "Expected a declaration."; for DIAG_BAD_TOKEN
+// the argument says what was wrong
+const char *diag_message(DiagId id);
+
+// Write one line per diagnostic, "[line L:C] Error at 'x': message", with a
+// single write to `out`. `lines` indexes the source the offsets are in
+void render_diagnostics(const Diagnostics *diags, const LineIndex *lines,
+                        FILE *out);
+void free_diagnostics(Diagnostics *diags);
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flat_ast.h"
+
+#include <string.h>
+
+// The tree is sized first so the whole flat form fits in one exactly-sized
+// allocation, then emitted in pre-order with child slots reserved up front.
+// Both passes go through walk_ast(), so no depth of tree overflows the stack
+
+typedef struct FlatSizes {
+  size_t nodes;
+  size_t extra;
+  size_t strings;
+} FlatSizes;
+
+// Extra slots a node of this kind reserves for its own fields, lists aside
+static size_t fixed_extra(NodeKind kind) {
+  switch (kind) {
+  case NODE_LET:
+  case NODE_IF:
+    return 2;
+  case NODE_FN:
+    return 3;
+  case NODE_FOR:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+static WalkStep measure(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  FlatSizes *sizes = (FlatSizes *)ctx;
+  const ChildTable *table = child_table(node->kind);
+  sizes->nodes++;
+  sizes->extra += fixed_extra(node->kind);
+  if (table->text) {
+    const char *text = node_text(node);
+    sizes->strings += (text ? strlen(text) : 0) + 1;
+  }
+  for (size_t i = 0; i < table->count; i++)
+    if (table->slots[i].flags & CHILD_LIST)
+      sizes->extra += 1 + slot_list(node, &table->slots[i])->count;
+  return WALK_CONTINUE;
+}
+
+// Emitting state: `path` holds the flat index of each node from the root down
+// to the one being visited, so a child can fill in its parent's slot
+typedef struct FlatEmit {
+  FlatAst *ast;
+  FlatIndex *path;
+  size_t path_cap;
+  FlatIndex *inline_path;
+  bool ok;
+} FlatEmit;
+
+static uint32_t emit_str(FlatAst *ast, const char *s) {
+  uint32_t offset = ast->strings_len;
+  size_t len = s ? strlen(s) : 0;
+  memcpy(ast->strings + offset, s ? s : "", len + 1);
+  ast->strings_len += (uint32_t)len + 1;
+  return offset;
+}
+
+// Slots start out FLAT_NONE and are filled in as the children are emitted
+static uint32_t reserve_extra(FlatAst *ast, uint32_t n) {
+  uint32_t at = ast->extra_count;
+  memset(ast->extra + at, 0, n * sizeof(uint32_t));
+  ast->extra_count += n;
+  return at;
+}
+
+static uint32_t reserve_list(FlatAst *ast, const NodeList *list) {
+  uint32_t at = reserve_extra(ast, 1 + (uint32_t)list->count);
+  ast->extra[at] = (uint32_t)list->count;
+  return at;
+}
+
+// Where child `index` of slot `slot` of the node at `parent` goes, following
+// the layout in flat_ast.h
+static uint32_t *child_dest(const FlatAst *ast, FlatIndex parent, size_t slot,
+                            size_t index) {
+  FlatData *d = &ast->data[parent];
+  switch (flat_kind(ast, parent)) {
+  case NODE_CALL:
+    return slot == 0 ? &d->lhs : &ast->extra[d->rhs + 1 + index];
+  case NODE_LET:
+    return &ast->extra[d->rhs + slot];
+  case NODE_BLOCK:
+  case NODE_STRUCT:
+  case NODE_UNION:
+  case NODE_ENUM:
+  case NODE_PROGRAM:
+    return &ast->extra[d->lhs + 1 + index];
+  case NODE_IF:
+    return slot == 0 ? &d->lhs : &ast->extra[d->rhs + slot - 1];
+  case NODE_FOR:
+    return &ast->extra[d->lhs + slot];
+  case NODE_FN:
+    if (slot == 0)
+      return &ast->extra[ast->extra[d->rhs] + 1 + index];
+    return &ast->extra[d->rhs + slot];
+  case NODE_PARAM:
+  case NODE_TYPE_DECL:
+  case NODE_FIELD:
+  case NODE_ENUM_VAR:
+    return &d->rhs; // the name is in lhs
+  default:
+    return slot == 0 ? &d->lhs : &d->rhs;
+  }
+}
+
+// Levels of path kept on the C stack before it moves to the heap
+#define FLAT_INLINE_PATH 64
+
+static bool grow_path(Allocator *a, FlatEmit *e) {
+  size_t new_cap = e->path_cap * 2;
+  FlatIndex *path =
+      (FlatIndex *)ALLOC(a, new_cap * sizeof(FlatIndex), "FlatPath");
+  if (path == NULL)
+    return false;
+  memcpy(path, e->path, e->path_cap * sizeof(FlatIndex));
+  if (e->path != e->inline_path)
+    FREE(a, e->path, e->path_cap * sizeof(FlatIndex), "FlatPath");
+  e->path = path;
+  e->path_cap = new_cap;
+  return true;
+}
+
+static WalkStep emit(Node *node, const WalkPos *pos, void *ctx) {
+  FlatEmit *e = (FlatEmit *)ctx;
+  FlatAst *ast = e->ast;
+  if (pos->depth == e->path_cap && !grow_path(ast->allocator, e)) {
+    e->ok = false;
+    return WALK_STOP;
+  }
+
+  FlatIndex self = ast->count++;
+  e->path[pos->depth] = self;
+  if (pos->parent) {
+    size_t slot = (size_t)(pos->slot - child_table(pos->parent->kind)->slots);
+    *child_dest(ast, e->path[pos->depth - 1], slot, pos->index) = self;
+  }
+
+  ast->kinds[self] = (uint8_t)node->kind;
+  ast->ops[self] = 0;
+  ast->lines[self] = (uint32_t)node->line;
+  FlatData d = {0, 0};
+  if (child_table(node->kind)->text) {
+    uint32_t text = emit_str(ast, node_text(node));
+    if (node->kind == NODE_MEMBER)
+      d.rhs = text; // the object is in lhs
+    else
+      d.lhs = text;
+  }
+
+  switch (node->kind) {
+  case NODE_INT_LIT:
+    d.lhs = (uint32_t)node->as.integer.val;
+    d.rhs = (uint32_t)(node->as.integer.val >> 32);
+    break;
+  case NODE_FLOAT_LIT: {
+    uint64_t bits;
+    memcpy(&bits, &node->as.floating.val, sizeof(bits));
+    d.lhs = (uint32_t)bits;
+    d.rhs = (uint32_t)(bits >> 32);
+    break;
+  }
+  case NODE_BOOL_LIT:
+    d.lhs = node->as.boolean.val;
+    break;
+  case NODE_UNARY:
+  case NODE_POSTFIX:
+    ast->ops[self] = (uint8_t)node->as.unary.op;
+    break;
+  case NODE_BINARY:
+    ast->ops[self] = (uint8_t)node->as.binary.op;
+    break;
+  case NODE_ASSIGN:
+    ast->ops[self] = (uint8_t)node->as.assign.op;
+    break;
+  case NODE_CALL:
+    d.rhs = reserve_list(ast, &node->as.call.args);
+    break;
+  case NODE_LET:
+    ast->ops[self] = node->as.let.is_const;
+    d.rhs = reserve_extra(ast, 2);
+    break;
+  case NODE_BLOCK:
+    d.lhs = reserve_list(ast, &node->as.block.stmts);
+    break;
+  case NODE_IF:
+    d.rhs = reserve_extra(ast, 2);
+    break;
+  case NODE_FOR:
+    d.lhs = reserve_extra(ast, 4);
+    break;
+  case NODE_FN:
+    ast->ops[self] = node->as.fn.is_pub;
+    d.rhs = reserve_extra(ast, 3);
+    ast->extra[d.rhs] = reserve_list(ast, &node->as.fn.params);
+    break;
+  case NODE_TYPE_DECL:
+    ast->ops[self] = node->as.type_decl.is_pub;
+    break;
+  case NODE_STRUCT:
+  case NODE_UNION:
+    d.lhs = reserve_list(ast, &node->as.record.fields);
+    break;
+  case NODE_ENUM:
+    d.lhs = reserve_list(ast, &node->as.enom.variants);
+    break;
+  case NODE_PROGRAM:
+    d.lhs = reserve_list(ast, &node->as.program.decls);
+    break;
+  default:
+    break;
+  }
+
+  ast->data[self] = d;
+  return WALK_CONTINUE;
+}
+
+size_t flat_block_size(size_t nodes, size_t extra, size_t strings) {
+  return nodes * (sizeof(FlatData) + sizeof(uint32_t) + 2) +
+         extra * sizeof(uint32_t) + strings;
+}
+
+// 4-byte arrays first so every array stays aligned without padding
+void layout_flat_block(FlatAst *ast, char *block, size_t nodes, size_t extra) {
+  size_t data_bytes = nodes * sizeof(FlatData);
+  size_t lines_bytes = nodes * sizeof(uint32_t);
+  size_t extra_bytes = extra * sizeof(uint32_t);
+  ast->data = (FlatData *)block;
+  ast->lines = (uint32_t *)(block + data_bytes);
+  ast->extra = (uint32_t *)(block + data_bytes + lines_bytes);
+  ast->kinds = (uint8_t *)(block + data_bytes + lines_bytes + extra_bytes);
+  ast->ops = ast->kinds + nodes;
+  ast->strings = (char *)(ast->ops + nodes);
+}
+
+bool flatten_ast(FlatAst *ast, const Node *program, Allocator *allocator) {
+  memset(ast, 0, sizeof(*ast));
+  ast->allocator = allocator;
+  if (program == NULL)
+    return false;
+
+  FlatSizes sizes = {0, 0, 0};
+  AstVisitor sizer = {measure, NULL, &sizes, false};
+  if (!walk_ast(allocator, (Node *)program, &sizer))
+    return false;
+  if (sizes.nodes > UINT32_MAX || sizes.extra > UINT32_MAX ||
+      sizes.strings > UINT32_MAX)
+    return false;
+
+  size_t size = flat_block_size(sizes.nodes, sizes.extra, sizes.strings);
+  char *block = (char *)ALLOC(allocator, size, "FlatAst");
+  if (block == NULL)
+    return false;
+
+  ast->size = size;
+  layout_flat_block(ast, block, sizes.nodes, sizes.extra);
+  FlatIndex inline_path[FLAT_INLINE_PATH];
+  FlatEmit e = {ast, inline_path, FLAT_INLINE_PATH, inline_path, true};
+  AstVisitor emitter = {emit, NULL, &e, false};
+  bool ok = walk_ast(allocator, (Node *)program, &emitter) && e.ok;
+  if (e.path != inline_path)
+    FREE(allocator, e.path, e.path_cap * sizeof(FlatIndex), "FlatPath");
+  if (!ok)
+    free_flat_ast(ast);
+  return ok;
+}
+
+void free_flat_ast(FlatAst *ast) {
+  if (ast->data != NULL)
+    FREE(ast->allocator, ast->data, ast->size, "FlatAst");
+  memset(ast, 0, sizeof(*ast));
+}
+
+// `n` slots of extra[] from `at` on
+static bool extra_in_bounds(const FlatAst *ast, uint32_t at, uint32_t n) {
+  return at <= ast->extra_count && n <= ast->extra_count - at;
+}
+
+// A count at `at` followed by that many slots
+static bool list_in_bounds(const FlatAst *ast, uint32_t at) {
+  return extra_in_bounds(ast, at, 1) &&
+         extra_in_bounds(ast, at + 1, ast->extra[at]);
+}
+
+// Find the node's one list in extra[], if its kind has one, and check that it
+// lies in bounds
+static bool find_list(const FlatAst *ast, FlatIndex i, uint32_t *list) {
+  FlatData d = ast->data[i];
+  switch (flat_kind(ast, i)) {
+  case NODE_CALL:
+    *list = d.rhs;
+    break;
+  case NODE_BLOCK:
+  case NODE_STRUCT:
+  case NODE_UNION:
+  case NODE_ENUM:
+  case NODE_PROGRAM:
+    *list = d.lhs;
+    break;
+  case NODE_FN:
+    if (!extra_in_bounds(ast, d.rhs, 1))
+      return false;
+    *list = ast->extra[d.rhs];
+    break;
+  default:
+    return true;
+  }
+  return list_in_bounds(ast, *list);
+}
+
+bool check_flat_ast(const FlatAst *ast) {
+  if (ast->count == 0 || flat_kind(ast, 0) != NODE_PROGRAM)
+    return false;
+
+  for (FlatIndex i = 0; i < ast->count; i++) {
+    if (ast->kinds[i] > NODE_PROGRAM)
+      return false;
+    NodeKind kind = flat_kind(ast, i);
+    const ChildTable *table = child_table(kind);
+    FlatData d = ast->data[i];
+
+    uint32_t text = kind == NODE_MEMBER ? d.rhs : d.lhs;
+    if (table->text && text >= ast->strings_len)
+      return false;
+    uint32_t fixed = kind == NODE_FOR ? d.lhs : d.rhs;
+    if (fixed_extra(kind) > 0 &&
+        !extra_in_bounds(ast, fixed, (uint32_t)fixed_extra(kind)))
+      return false;
+    uint32_t list = 0;
+    if (!find_list(ast, i, &list))
+      return false;
+
+    // Pre-order puts every child after its parent, which also rules out cycles
+    for (size_t slot = 0; slot < table->count; slot++) {
+      bool is_list = table->slots[slot].flags & CHILD_LIST;
+      uint32_t n = is_list ? ast->extra[list] : 1;
+      for (uint32_t k = 0; k < n; k++) {
+        uint32_t child = *child_dest(ast, i, slot, k);
+        if (child != FLAT_NONE && (child <= i || child >= ast->count))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+uint64_t flat_integer(const FlatAst *ast, FlatIndex i) {
+  return (uint64_t)ast->data[i].rhs << 32 | ast->data[i].lhs;
+}
+
+double flat_floating(const FlatAst *ast, FlatIndex i) {
+  uint64_t bits = (uint64_t)ast->data[i].rhs << 32 | ast->data[i].lhs;
+  double val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
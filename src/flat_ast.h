@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+#include "ast.h"
+
+// An index into a FlatAst's node arrays. The root program is always node 0 and
+// is never anyone's child, so 0 doubles as "no node" in child slots
+typedef uint32_t FlatIndex;
+#define FLAT_NONE ((FlatIndex)0)
+
+// Two 32-bit payload words per node; what they hold depends on the kind:
+//
+//   INT_LIT                    lhs/rhs = low/high half of the value
+//   FLOAT_LIT                  lhs/rhs = low/high half of the IEEE-754 bits
+//   BOOL_LIT                   lhs = value
+//   STRING_LIT IDENT TYPE_NAME lhs = string offset
+//   IMPORT
+//   UNARY POSTFIX              lhs = operand (op in ops[])
+//   BINARY ASSIGN              lhs = left/target, rhs = right/value
+//                              (op in ops[])
+//   CALL                       lhs = callee, rhs = extra list of args
+//   MEMBER                     lhs = object, rhs = string offset of the field
+//   INDEX                      lhs = object, rhs = index
+//   HEAP TYPE_PTR EXPR_STMT    lhs = child
+//   RETURN
+//   TYPE_ARR                   lhs = size (or FLAT_NONE), rhs = element type
+//   LET                        lhs = name, rhs = extra [type, init]
+//                              (is_const in ops[])
+//   BLOCK STRUCT UNION ENUM    lhs = extra list of children
+//   PROGRAM
+//   IF                         lhs = cond, rhs = extra [then, else]
+//   WHILE                      lhs = cond, rhs = body
+//   DO_WHILE                   lhs = body, rhs = cond
+//   FOR                        lhs = extra [init, cond, post, body]
+//   FN                         lhs = name, rhs = extra [params, ret, body]
+//                              (is_pub in ops[], params is an extra list)
+//   PARAM FIELD                lhs = name, rhs = type
+//   TYPE_DECL                  lhs = name, rhs = def (is_pub in ops[])
+//   ENUM_VAR                   lhs = name, rhs = value (or FLAT_NONE)
+//
+// An "extra list" is an index into extra[] holding a count followed by that
+// many node indices
+typedef struct FlatData {
+  uint32_t lhs;
+  uint32_t rhs;
+} FlatData;
+
+// Nodes are laid out in pre-order, so a linear scan over the arrays visits the
+// tree depth-first. All arrays share one allocation: dropping the tree is one
+// free
+typedef struct FlatAst {
+  uint32_t count;
+  uint8_t *kinds;  // NodeKind
+  uint8_t *ops;    // operator TokenType, or is_const/is_pub flag
+  uint32_t *lines; // 1-based source line
+  FlatData *data;
+  uint32_t *extra;
+  uint32_t extra_count;
+  char *strings; // NUL-terminated names and string literals
+  uint32_t strings_len;
+  size_t size; // bytes in the single allocation
+  Allocator *allocator;
+} FlatAst;
+
+typedef struct FlatList {
+  const uint32_t *items;
+  uint32_t count;
+} FlatList;
+
+// Lower a parsed program into its flat form. Returns false if the tree is too
+// large for 32-bit indices or the allocation fails
+bool flatten_ast(FlatAst *ast, const Node *program, Allocator *allocator);
+void free_flat_ast(FlatAst *ast);
+
+// Bytes in the single block for a tree of these sizes, and pointing `ast`'s
+// arrays into such a block. For code that keeps the block somewhere other
+// than the allocator, like the on-disk cache
+size_t flat_block_size(size_t nodes, size_t extra, size_t strings);
+void layout_flat_block(FlatAst *ast, char *block, size_t nodes, size_t extra);
+
+// Whether every kind, child index, extra list and string offset in `ast` is in
+// bounds and every child comes after its parent, for a block read from
+// outside the process. O(nodes)
+bool check_flat_ast(const FlatAst *ast);
+
+static inline NodeKind flat_kind(const FlatAst *ast, FlatIndex i) {
+  return (NodeKind)ast->kinds[i];
+}
+
+static inline const char *flat_string(const FlatAst *ast, uint32_t offset) {
+  return ast->strings + offset;
+}
+
+static inline FlatList flat_list(const FlatAst *ast, uint32_t extra_index) {
+  FlatList list = {ast->extra + extra_index + 1, ast->extra[extra_index]};
+  return list;
+}
+
+uint64_t flat_integer(const FlatAst *ast, FlatIndex i);
+double flat_floating(const FlatAst *ast, FlatIndex i);
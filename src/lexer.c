@@ -15,11 +15,15 @@
  */
 
 #include "lexer.h"
+#include "unicode.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static bool is_at_end(Lexer *lexer) { return *lexer->current == '\0'; }
 
@@ -36,19 +40,9 @@ static char peek_next(Lexer *lexer) {
   return lexer->current[1];
 }
 
-static bool match(Lexer *lexer, char expected) {
-  if (is_at_end(lexer))
-    return false;
-  if (*lexer->current != expected)
-    return false;
-  lexer->current++;
-  return true;
-}
-
 static Token make_token(Lexer *lexer, TokenType type) {
   Token token;
   token.type = type;
-  token.line = lexer->line;
   token.lexeme = NULL;
 
   if (type == TOKEN_IDENTIFIER || type == TOKEN_STRING || type == TOKEN_ERROR ||
@@ -69,7 +63,6 @@ static Token make_token(Lexer *lexer, TokenType type) {
 static Token make_error_token(Lexer *lexer, const char *message) {
   Token token;
   token.type = TOKEN_ERROR;
-  token.line = lexer->line;
 
   size_t len = strlen(message);
   token.lexeme = (char *)ALLOC(lexer->allocator, len + 1, "TokenError");
@@ -80,39 +73,36 @@ static Token make_error_token(Lexer *lexer, const char *message) {
   return token;
 }
 
-static void skip_whitespace(Lexer *lexer) {
+// Returns true when it stops inside a line comment, at the end of the source
+static bool skip_whitespace(Lexer *lexer) {
   for (;;) {
     char c = peek(lexer);
     switch (c) {
     case ' ':
     case '\r':
     case '\t':
-      advance(lexer);
-      break;
     case '\n':
-      lexer->line++;
       advance(lexer);
       break;
     case '/':
       if (peek_next(lexer) == '/') {
         while (peek(lexer) != '\n' && !is_at_end(lexer))
           advance(lexer);
+        if (is_at_end(lexer))
+          return true;
       } else {
-        return;
+        return false;
       }
       break;
     default:
-      return;
+      return false;
     }
   }
 }
 
 static Token make_string_token(Lexer *lexer) {
-  while (peek(lexer) != '"' && !is_at_end(lexer)) {
-    if (peek(lexer) == '\n')
-      lexer->line++;
+  while (peek(lexer) != '"' && !is_at_end(lexer))
     advance(lexer);
-  }
 
   if (is_at_end(lexer))
     return make_error_token(lexer, "Unterminated string.");
@@ -125,22 +115,137 @@ static Token make_string_token(Lexer *lexer) {
   return token;
 }
 
-static Token make_number_token(Lexer *lexer) {
-  bool is_float = false;
+static unsigned digit_value(char c) {
+  if (c >= '0' && c <= '9')
+    return (unsigned)(c - '0');
+  if (c >= 'a' && c <= 'f')
+    return (unsigned)(c - 'a' + 10);
+  if (c >= 'A' && c <= 'F')
+    return (unsigned)(c - 'A' + 10);
+  return 16; // not a digit in any base we accept
+}
 
-  while (isdigit(peek(lexer)))
+// Consume a run of base-`base` digits and '_' separators, accumulating their
+// value into `val`. Returns the number of digits (separators not counted), or
+// 0 if a separator isn't between two digits
+static size_t scan_digits(Lexer *lexer, unsigned base, uint64_t *val,
+                          bool *overflow) {
+  size_t digits = 0;
+  for (;;) {
+    char c = peek(lexer);
+    if (c == '_') {
+      if (digits == 0 || lexer->current[-1] == '_')
+        return 0;
+      advance(lexer);
+      continue;
+    }
+    unsigned d = digit_value(c);
+    if (d >= base)
+      return lexer->current[-1] == '_' ? 0 : digits;
+    if (*val > (UINT64_MAX - d) / base)
+      *overflow = true;
+    else
+      *val = *val * base + d;
     advance(lexer);
+    digits++;
+  }
+}
 
-  if (peek(lexer) == '.' && isdigit(peek_next(lexer))) {
+// 10^0 through 10^22 are exactly representable as doubles
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// The slow path: strtod is correctly rounded but wants the digits without '_'
+static double parse_float_slow(Lexer *lexer) {
+  size_t len = (size_t)(lexer->current - lexer->start);
+  char *buf = (char *)ALLOC(lexer->allocator, len + 1, "FloatDigits");
+  if (buf == NULL)
+    return 0.0;
+
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++)
+    if (lexer->start[i] != '_')
+      buf[n++] = lexer->start[i];
+  buf[n] = '\0';
+
+  double val = strtod(buf, NULL);
+  FREE(lexer->allocator, buf, len + 1, "FloatDigits");
+  return val;
+}
+
+// Take the rest of a malformed literal along, so it's one error rather than
+// a number followed by whatever its tail lexes as
+static Token make_invalid_number_token(Lexer *lexer) {
+  while (isalnum(peek(lexer)) || peek(lexer) == '_' ||
+         (peek(lexer) == '.' && isdigit(peek_next(lexer))))
+    advance(lexer);
+  return make_error_token(lexer, "Invalid number literal");
+}
+
+static Token make_number_token(Lexer *lexer) {
+  unsigned base = 10;
+  if (lexer->start[0] == '0') {
+    switch (peek(lexer)) {
+    case 'x':
+    case 'X':
+      base = 16;
+      break;
+    case 'o':
+    case 'O':
+      base = 8;
+      break;
+    case 'b':
+    case 'B':
+      base = 2;
+      break;
+    }
+  }
+
+  uint64_t val = 0;
+  bool overflow = false;
+  if (base != 10) {
+    advance(lexer); // the prefix letter
+    // A digit or letter straight after the digits is one the base lacks, and
+    // only decimal literals have a fraction
+    if (scan_digits(lexer, base, &val, &overflow) == 0 ||
+        isalnum(peek(lexer)) || peek(lexer) == '.')
+      return make_invalid_number_token(lexer);
+  } else {
+    lexer->current = lexer->start; // rescan the first digit with the rest
+    if (scan_digits(lexer, 10, &val, &overflow) == 0)
+      return make_invalid_number_token(lexer);
+  }
+
+  bool is_float = false;
+  size_t frac_digits = 0;
+  if (base == 10 && peek(lexer) == '.' && isdigit(peek_next(lexer))) {
     is_float = true;
     advance(lexer);
-    while (isdigit(peek(lexer)))
-      advance(lexer);
+    frac_digits = scan_digits(lexer, 10, &val, &overflow);
+    if (frac_digits == 0)
+      return make_invalid_number_token(lexer);
   } else if (peek(lexer) == '.' && !isdigit(peek_next(lexer))) {
     return make_error_token(lexer, "Invalid number literal");
   }
 
-  return make_token(lexer, is_float ? TOKEN_FLOAT : TOKEN_INTEGER);
+  if (!is_float) {
+    if (overflow)
+      return make_error_token(lexer, "Integer literal is too large.");
+    Token token = make_token(lexer, TOKEN_INTEGER);
+    token.value.integer = val;
+    return token;
+  }
+
+  // Clinger's fast path: with an exact mantissa and an exact power of ten a
+  // single IEEE division is already the correctly rounded result
+  Token token = make_token(lexer, TOKEN_FLOAT);
+  if (!overflow && val <= (UINT64_C(1) << 53) && frac_digits <= 22)
+    token.value.floating = (double)val / exact_powers_of_ten[frac_digits];
+  else
+    token.value.floating = parse_float_slow(lexer);
+  return token;
 }
 
 static TokenType check_keyword(Lexer *lexer, size_t start, size_t len,
@@ -239,18 +344,97 @@ static TokenType identifier_type(Lexer *lexer) {
 }
 
 static Token make_identifier_or_keyword(Lexer *lexer) {
-  while (isalnum(peek(lexer)) || peek(lexer) == '_')
-    advance(lexer);
+  for (;;) {
+    unsigned char c = (unsigned char)peek(lexer);
+    if (c < 0x80) {
+      if (!isalnum(c) && c != '_')
+        break;
+      advance(lexer);
+      continue;
+    }
+
+    size_t len;
+    if (!unicode_is_xid_continue(utf8_decode(lexer->current, &len)))
+      break;
+    lexer->current += len;
+  }
   return make_token(lexer, identifier_type(lexer));
 }
 
+// A token whose first byte isn't ASCII: an identifier or an error
+static Token make_non_ascii_token(Lexer *lexer) {
+  size_t len;
+  uint32_t cp = utf8_decode(lexer->start, &len);
+  lexer->current = lexer->start + len;
+  if (unicode_is_xid_start(cp))
+    return make_identifier_or_keyword(lexer);
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "Unexpected character '%.*s'.", (int)len,
+           lexer->start);
+  return make_error_token(lexer, buf);
+}
+
+// The token just scanned, or the space in front of it, ran over malformed
+// UTF-8. Only the bad sequence is reported: a token it was part of is dropped,
+// but one it merely preceded, in a comment, is scanned again next time
+static Token make_invalid_utf8_token(Lexer *lexer, Token token) {
+  free_token_lexeme(lexer->allocator, token);
+  const char *bad = lexer->invalid_utf8;
+  size_t len = 1; // the lead byte and any continuation bytes after it
+  while (len < 4 && ((unsigned char)bad[len] & 0xC0) == 0x80)
+    len++;
+
+  const char *resume = lexer->current;
+  if (bad < lexer->start)
+    resume = lexer->start;
+  else if (resume < bad + len)
+    resume = bad + len;
+  const char *from = bad < lexer->start ? bad + len : resume;
+
+  Token error = make_error_token(lexer, "Invalid UTF-8 sequence.");
+  error.offset = (size_t)(bad - lexer->source);
+  error.length = len;
+  lexer->current = resume;
+  lexer->invalid_utf8 = from;
+  lexer->checked = from;
+  return error;
+}
+
+// Validate on from `checked` through `upto`, and on past any continuation
+// bytes there so a sequence is never judged half-read
+static void check_utf8(Lexer *lexer, const char *upto) {
+  while (upto < lexer->end && ((unsigned char)*upto & 0xC0) == 0x80)
+    upto++;
+  if (lexer->invalid_utf8 == lexer->checked) {
+    const char *from = lexer->checked;
+    lexer->invalid_utf8 = from + utf8_validate(from, (size_t)(upto - from));
+  }
+  lexer->checked = upto;
+}
+
 void init_lexer(Lexer *lexer, const char *src, Allocator *allocator) {
+  size_t len = strlen(src);
+  lexer->source = src;
+  lexer->end = src + len;
   lexer->start = src;
   lexer->current = src;
-  lexer->line = 1;
+  lexer->invalid_utf8 = src + utf8_validate(src, len);
+  lexer->checked = lexer->end;
   lexer->allocator = allocator;
 }
 
+void rewind_lexer(Lexer *lexer, size_t offset, size_t length) {
+  const char *from = lexer->source + offset;
+  size_t valid = utf8_validate(from, length);
+  lexer->start = from;
+  lexer->current = from;
+  // Past the span only a lookahead token gets scanned, and the first pass
+  // already reported whatever it holds
+  lexer->invalid_utf8 = valid < length ? from + valid : lexer->end;
+  lexer->checked = lexer->end;
+}
+
 void free_token_lexeme(Allocator *allocator, Token token) {
   if (token.lexeme != NULL) {
     size_t len = strlen(token.lexeme) + 1;
@@ -258,7 +442,96 @@ void free_token_lexeme(Allocator *allocator, Token token) {
   }
 }
 
-Token scan_token(Lexer *lexer) {
+// Operators are recognised from their first two bytes with one table lookup.
+// Each byte that can start or continue an operator maps to a small class so
+// the table stays compact; column OP_OTHER holds the one-character token, and
+// maximal munch is "take the pair if it exists, otherwise that column"
+enum {
+  OP_OTHER,
+  OP_LEFT_PAREN,
+  OP_RIGHT_PAREN,
+  OP_LEFT_BRACE,
+  OP_RIGHT_BRACE,
+  OP_LEFT_BRACKET,
+  OP_RIGHT_BRACKET,
+  OP_COMMA,
+  OP_DOT,
+  OP_SEMICOLON,
+  OP_COLON,
+  OP_CARET,
+  OP_BANG,
+  OP_EQUAL,
+  OP_GREATER,
+  OP_LESS,
+  OP_PLUS,
+  OP_MINUS,
+  OP_MUL,
+  OP_DIV,
+  OP_REM,
+  OP_AMPERSAND,
+  OP_PIPE,
+  OP_CLASS_COUNT
+};
+
+static const unsigned char op_class[256] = {
+    ['('] = OP_LEFT_PAREN,   [')'] = OP_RIGHT_PAREN, ['{'] = OP_LEFT_BRACE,
+    ['}'] = OP_RIGHT_BRACE,  ['['] = OP_LEFT_BRACKET, [']'] = OP_RIGHT_BRACKET,
+    [','] = OP_COMMA,        ['.'] = OP_DOT,          [';'] = OP_SEMICOLON,
+    [':'] = OP_COLON,        ['^'] = OP_CARET,        ['!'] = OP_BANG,
+    ['='] = OP_EQUAL,        ['>'] = OP_GREATER,      ['<'] = OP_LESS,
+    ['+'] = OP_PLUS,         ['-'] = OP_MINUS,        ['*'] = OP_MUL,
+    ['/'] = OP_DIV,          ['%'] = OP_REM,          ['&'] = OP_AMPERSAND,
+    ['|'] = OP_PIPE,
+};
+
+typedef struct OpRule {
+  unsigned char type;   // TokenType
+  unsigned char length; // 0 when the bytes don't start an operator
+} OpRule;
+
+#define OP1(a, t) [a][OP_OTHER] = {t, 1}
+#define OP2(a, b, t) [a][b] = {t, 2}
+
+// '&' and '|' have classes but no rules yet: `&&`, `||`, `<<`, `>>` or `->`
+// only need an OP2 entry here once their token types exist
+static const OpRule op_rules[OP_CLASS_COUNT][OP_CLASS_COUNT] = {
+    OP1(OP_LEFT_PAREN, TOKEN_LEFT_PAREN),
+    OP1(OP_RIGHT_PAREN, TOKEN_RIGHT_PAREN),
+    OP1(OP_LEFT_BRACE, TOKEN_LEFT_BRACE),
+    OP1(OP_RIGHT_BRACE, TOKEN_RIGHT_BRACE),
+    OP1(OP_LEFT_BRACKET, TOKEN_LEFT_BRACKET),
+    OP1(OP_RIGHT_BRACKET, TOKEN_RIGHT_BRACKET),
+    OP1(OP_COMMA, TOKEN_COMMA),
+    OP1(OP_DOT, TOKEN_DOT),
+    OP1(OP_SEMICOLON, TOKEN_SEMICOLON),
+    OP1(OP_COLON, TOKEN_COLON),
+    OP1(OP_CARET, TOKEN_CARET),
+    OP1(OP_BANG, TOKEN_BANG),
+    OP2(OP_BANG, OP_EQUAL, TOKEN_BANG_EQUAL),
+    OP1(OP_EQUAL, TOKEN_EQUAL),
+    OP2(OP_EQUAL, OP_EQUAL, TOKEN_EQUAL_EQUAL),
+    OP1(OP_GREATER, TOKEN_GREATER),
+    OP2(OP_GREATER, OP_EQUAL, TOKEN_GREATER_EQUAL),
+    OP1(OP_LESS, TOKEN_LESS),
+    OP2(OP_LESS, OP_EQUAL, TOKEN_LESS_EQUAL),
+    OP1(OP_PLUS, TOKEN_PLUS),
+    OP2(OP_PLUS, OP_PLUS, TOKEN_PLUS_PLUS),
+    OP2(OP_PLUS, OP_EQUAL, TOKEN_PLUS_EQUAL),
+    OP1(OP_MINUS, TOKEN_MINUS),
+    OP2(OP_MINUS, OP_MINUS, TOKEN_MINUS_MINUS),
+    OP2(OP_MINUS, OP_EQUAL, TOKEN_MINUS_EQUAL),
+    OP1(OP_MUL, TOKEN_MUL),
+    OP2(OP_MUL, OP_EQUAL, TOKEN_MUL_EQUAL),
+    OP1(OP_DIV, TOKEN_DIV),
+    OP2(OP_DIV, OP_EQUAL, TOKEN_DIV_EQUAL),
+    OP1(OP_REM, TOKEN_REM),
+    OP2(OP_REM, OP_EQUAL, TOKEN_REM_EQUAL),
+};
+
+#undef OP1
+#undef OP2
+
+static Token next_token(Lexer *lexer) {
   skip_whitespace(lexer);
 
   lexer->start = lexer->current;
@@ -267,68 +540,356 @@ Token scan_token(Lexer *lexer) {
     return make_token(lexer, TOKEN_EOF);
 
   char c = advance(lexer);
+  if ((unsigned char)c >= 0x80)
+    return make_non_ascii_token(lexer);
   if (isalpha(c) || c == '_')
     return make_identifier_or_keyword(lexer);
   if (isdigit(c))
     return make_number_token(lexer);
 
-  switch (c) {
-  case '(':
-    return make_token(lexer, TOKEN_LEFT_PAREN);
-  case ')':
-    return make_token(lexer, TOKEN_RIGHT_PAREN);
-  case '{':
-    return make_token(lexer, TOKEN_LEFT_BRACE);
-  case '}':
-    return make_token(lexer, TOKEN_RIGHT_BRACE);
-  case '[':
-    return make_token(lexer, TOKEN_LEFT_BRACKET);
-  case ']':
-    return make_token(lexer, TOKEN_RIGHT_BRACKET);
-  case ';':
-    return make_token(lexer, TOKEN_SEMICOLON);
-  case ',':
-    return make_token(lexer, TOKEN_COMMA);
-  case '.':
-    return make_token(lexer, TOKEN_DOT);
-  case ':':
-    return make_token(lexer, TOKEN_COLON);
-  case '^':
-    return make_token(lexer, TOKEN_CARET);
-
-  case '!':
-    return make_token(lexer, match(lexer, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
-  case '=':
-    return make_token(lexer,
-                      match(lexer, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
-  case '>':
-    return make_token(lexer,
-                      match(lexer, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-  case '<':
-    return make_token(lexer, match(lexer, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
-  case '+':
-    return make_token(lexer, match(lexer, '+')   ? TOKEN_PLUS_PLUS
-                             : match(lexer, '=') ? TOKEN_PLUS_EQUAL
-                                                 : TOKEN_PLUS);
-  case '-':
-    return make_token(lexer, match(lexer, '-')   ? TOKEN_MINUS_MINUS
-                             : match(lexer, '=') ? TOKEN_MINUS_EQUAL
-                                                 : TOKEN_MINUS);
-  case '*':
-    return make_token(lexer, match(lexer, '=') ? TOKEN_MUL_EQUAL : TOKEN_MUL);
-  case '/':
-    return make_token(lexer, match(lexer, '=') ? TOKEN_DIV_EQUAL : TOKEN_DIV);
-  case '%':
-    return make_token(lexer, match(lexer, '=') ? TOKEN_REM_EQUAL : TOKEN_REM);
-  case '"':
-    return make_string_token(lexer);
+  const OpRule *row = op_rules[op_class[(unsigned char)c]];
+  OpRule pair = row[op_class[(unsigned char)peek(lexer)]];
+  OpRule rule = pair.length == 2 ? pair : row[OP_OTHER];
+  if (rule.length != 0) {
+    lexer->current += rule.length - 1;
+    return make_token(lexer, (TokenType)rule.type);
   }
 
+  if (c == '"')
+    return make_string_token(lexer);
+
   char buf[30];
   snprintf(buf, sizeof(buf), "%s%c%s", "Unexpected character '", c, "'.");
   return make_error_token(lexer, buf);
 }
 
+Token scan_token(Lexer *lexer) {
+  Token token = next_token(lexer);
+  if (lexer->checked < lexer->current)
+    check_utf8(lexer, lexer->current);
+  if (lexer->invalid_utf8 < lexer->current)
+    return make_invalid_utf8_token(lexer, token);
+  token.offset = (size_t)(lexer->start - lexer->source);
+  token.length = (size_t)(lexer->current - lexer->start);
+  return token;
+}
+
+static void reserve_tokens(Allocator *allocator, TokenBuffer *tokens,
+                           size_t needed) {
+  if (needed <= tokens->cap)
+    return;
+
+  size_t old_cap = tokens->cap;
+  size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+  while (new_cap < needed)
+    new_cap *= 2;
+  tokens->items =
+      (Token *)REALLOC(allocator, tokens->items, old_cap * sizeof(Token),
+                       new_cap * sizeof(Token), "TokenBuffer");
+  tokens->cap = new_cap;
+}
+
+static void push_token(Allocator *allocator, TokenBuffer *tokens, Token token) {
+  reserve_tokens(allocator, tokens, tokens->count + 1);
+  tokens->items[tokens->count++] = token;
+}
+
+void lex_all(Lexer *lexer, TokenBuffer *tokens) {
+  for (;;) {
+    Token token = scan_token(lexer);
+    push_token(lexer->allocator, tokens, token);
+    if (token.type == TOKEN_EOF)
+      break;
+  }
+}
+
+void free_token_buffer(Allocator *allocator, TokenBuffer *tokens) {
+  for (size_t i = 0; i < tokens->count; i++)
+    free_token_lexeme(allocator, tokens->items[i]);
+  if (tokens->items)
+    FREE(allocator, tokens->items, tokens->cap * sizeof(Token), "TokenBuffer");
+  tokens->items = NULL;
+  tokens->count = 0;
+  tokens->cap = 0;
+}
+
+RelexResult relex(TokenBuffer *tokens, const char *src, TextEdit edit,
+                  Allocator *allocator) {
+  Token *old = tokens->items;
+  size_t count = tokens->count;
+
+  // Binary search for the first token ending at or after the edit. An edit
+  // right behind a token can extend it ("a" + "b"), so that one is re-scanned,
+  // and so is the token before it, as it's the last boundary known to be safe
+  size_t lo = 0, hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (old[mid].offset + old[mid].length < edit.offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t first = lo > 0 ? lo - 1 : 0;
+
+  // An invalid UTF-8 error sits at the bad byte, which can be inside a string
+  // or comment, so scanning never restarts at one
+  while (first > 0 && old[first].type == TOKEN_ERROR)
+    first--;
+
+  // The old EOF token sits at the old length, which saves a strlen() over
+  // the new source
+  size_t len;
+  if (count > 0 && old[count - 1].type == TOKEN_EOF)
+    len = old[count - 1].offset + edit.inserted - edit.removed;
+  else
+    len = strlen(src);
+
+  // With no token ending before the edit, the edit may sit in leading
+  // whitespace or a comment, or have removed the text the first token started
+  // at, so scanning starts over from the top. UTF-8 is checked as the scan
+  // goes, so a relex costs what it rescans rather than a pass over the file
+  const char *from = src;
+  if (first < count && old[first].offset < edit.offset &&
+      old[first].type != TOKEN_ERROR)
+    from = src + old[first].offset;
+  Lexer lexer;
+  lexer.source = src;
+  lexer.end = src + len;
+  lexer.start = from;
+  lexer.current = from;
+  lexer.invalid_utf8 = from;
+  lexer.checked = from;
+  lexer.allocator = allocator;
+
+  // Old tokens from `resume` on start past the edit, so their text survived
+  size_t resume = first;
+  while (resume < count && old[resume].offset < edit.offset + edit.removed)
+    resume++;
+
+  TokenBuffer fresh = {0};
+  for (;;) {
+    Token token = scan_token(&lexer);
+
+    // The lexer carries no state between tokens, so once a new token starts
+    // where an old one did (in unedited text) the rest of the streams agree.
+    // Errors don't count: a UTF-8 one can sit at a bad byte mid-string
+    if (token.offset >= edit.offset + edit.inserted &&
+        token.type != TOKEN_ERROR) {
+      size_t old_offset = token.offset - edit.inserted + edit.removed;
+      while (resume < count && old[resume].offset < old_offset)
+        resume++;
+      if (resume < count && old[resume].offset == old_offset) {
+        free_token_lexeme(allocator, token);
+        break;
+      }
+    }
+
+    push_token(allocator, &fresh, token);
+    if (token.type == TOKEN_EOF) {
+      resume = count;
+      break;
+    }
+  }
+
+  for (size_t i = first; i < resume; i++)
+    free_token_lexeme(allocator, old[i]);
+
+  size_t tail = count - resume;
+  reserve_tokens(allocator, tokens, first + fresh.count + tail);
+  Token *items = tokens->items;
+  memmove(items + first + fresh.count, items + resume, tail * sizeof(Token));
+  if (fresh.count > 0)
+    memcpy(items + first, fresh.items, fresh.count * sizeof(Token));
+
+  for (size_t i = first + fresh.count; i < first + fresh.count + tail; i++)
+    items[i].offset = items[i].offset + edit.inserted - edit.removed;
+  tokens->count = first + fresh.count + tail;
+
+  if (fresh.items)
+    FREE(allocator, fresh.items, fresh.cap * sizeof(Token), "TokenBuffer");
+
+  RelexResult result = {first, resume - first, fresh.count};
+  return result;
+}
+
+// Bytes at the end of buf[0, len) that start a UTF-8 sequence the read cut
+// short; they wait in the carry so the lexer never sees half a character
+static size_t split_sequence_length(const char *buf, size_t len) {
+  size_t i = len;
+  while (i > 0 && len - i < 3 && ((unsigned char)buf[i - 1] & 0xC0) == 0x80)
+    i--;
+  if (i == 0)
+    return 0;
+
+  unsigned char lead = (unsigned char)buf[i - 1];
+  size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  size_t have = len - (i - 1);
+  return have < need ? have : 0;
+}
+
+// Slide buf[keep, len) to the front of the window and top it up from the fd
+static void refill(StreamLexer *stream, size_t keep) {
+  size_t kept = stream->len - keep;
+  memmove(stream->buf, stream->buf + keep, kept);
+  stream->base += keep;
+  stream->len = kept;
+
+  memcpy(stream->buf + stream->len, stream->carry, stream->carried);
+  stream->len += stream->carried;
+  stream->carried = 0;
+
+  if (stream->len > (stream->cap - 1) / 2) {
+    size_t old_cap = stream->cap;
+    stream->buf = (char *)REALLOC(stream->lexer.allocator, stream->buf,
+                                  old_cap, old_cap * 2, "StreamWindow");
+    stream->cap = old_cap * 2;
+  }
+
+  ssize_t n;
+  do {
+    n = read(stream->fd, stream->buf + stream->len,
+             stream->cap - 1 - stream->len);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    stream->eof = true; // a read error ends the stream like EOF does
+  } else {
+    stream->len += (size_t)n;
+    stream->carried = split_sequence_length(stream->buf, stream->len);
+    stream->len -= stream->carried;
+    memcpy(stream->carry, stream->buf + stream->len, stream->carried);
+  }
+  stream->buf[stream->len] = '\0';
+
+  Lexer *lexer = &stream->lexer;
+  lexer->source = stream->buf;
+  lexer->end = stream->buf + stream->len;
+  lexer->start = stream->buf;
+  lexer->current = stream->buf;
+  lexer->invalid_utf8 = stream->buf + utf8_validate(stream->buf, stream->len);
+  lexer->checked = lexer->end;
+}
+
+void init_stream_lexer(StreamLexer *stream, int fd, size_t window,
+                       Allocator *allocator) {
+  if (window < 16)
+    window = 16;
+
+  stream->fd = fd;
+  stream->cap = window + 1;
+  stream->buf = (char *)ALLOC(allocator, stream->cap, "StreamWindow");
+  stream->len = 0;
+  stream->base = 0;
+  stream->carried = 0;
+  stream->eof = false;
+  stream->in_comment = false;
+  stream->lexer.allocator = allocator;
+  refill(stream, 0);
+}
+
+// Skip trivia here rather than in scan_token(), dropping it from the window as
+// it runs off the edge; a comment still open there carries over in
+// `in_comment`, so however much trivia there is the window holds none of it
+static void skip_stream_trivia(StreamLexer *stream) {
+  Lexer *lexer = &stream->lexer;
+  for (;;) {
+    if (stream->in_comment) {
+      while (peek(lexer) != '\n' && !is_at_end(lexer))
+        advance(lexer);
+    }
+    if (!is_at_end(lexer))
+      stream->in_comment = skip_whitespace(lexer);
+
+    // Malformed UTF-8 in what's been skipped must be reported before it's
+    // dropped; scan_token() does that from here
+    size_t left = (size_t)(lexer->end - lexer->current);
+    if (stream->eof || left > 1 || lexer->invalid_utf8 < lexer->current)
+      return;
+    refill(stream, (size_t)(lexer->current - stream->buf));
+  }
+}
+
+Token stream_scan_token(StreamLexer *stream) {
+  Lexer *lexer = &stream->lexer;
+  for (;;) {
+    skip_stream_trivia(stream);
+    const char *before = lexer->current;
+    Token token = scan_token(lexer);
+
+    // Number and comment scanning peek one byte past the token, so a token
+    // ending that close to the window's edge might continue in unread input.
+    // An error for malformed UTF-8 in the trivia is whole already
+    size_t left = (size_t)(lexer->end - lexer->current);
+    bool in_trivia = token.offset < (size_t)(before - stream->buf);
+    if (stream->eof || left > 1 || in_trivia) {
+      token.offset += stream->base;
+      return token;
+    }
+
+    free_token_lexeme(lexer->allocator, token);
+    refill(stream, (size_t)(before - stream->buf));
+  }
+}
+
+void free_stream_lexer(StreamLexer *stream) {
+  if (stream->buf)
+    FREE(stream->lexer.allocator, stream->buf, stream->cap, "StreamWindow");
+  stream->buf = NULL;
+}
+
+static void push_line_start(Allocator *allocator, LineIndex *index,
+                            size_t offset) {
+  if (index->count + 1 > index->cap) {
+    size_t old_cap = index->cap;
+    size_t new_cap = old_cap < 64 ? 64 : old_cap * 2;
+    index->starts =
+        (size_t *)REALLOC(allocator, index->starts, old_cap * sizeof(size_t),
+                          new_cap * sizeof(size_t), "LineIndex");
+    index->cap = new_cap;
+  }
+  index->starts[index->count++] = offset;
+}
+
+void build_line_index(LineIndex *index, const char *src, Allocator *allocator) {
+  index->starts = NULL;
+  index->count = 0;
+  index->cap = 0;
+  push_line_start(allocator, index, 0);
+
+  // strlen and memchr are the vectorized scans libc already ships
+  const char *end = src + strlen(src);
+  const char *p = src;
+  while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+    p++;
+    push_line_start(allocator, index, (size_t)(p - src));
+  }
+}
+
+void free_line_index(Allocator *allocator, LineIndex *index) {
+  if (index->starts)
+    FREE(allocator, index->starts, index->cap * sizeof(size_t), "LineIndex");
+  index->starts = NULL;
+  index->count = 0;
+  index->cap = 0;
+}
+
+SourcePos line_index_lookup(const LineIndex *index, size_t offset) {
+  // The last line starting at or before `offset`
+  size_t lo = 0, hi = index->count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->starts[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  SourcePos pos;
+  pos.line = lo + 1;
+  pos.column = offset - (index->count > 0 ? index->starts[lo] : 0) + 1;
+  return pos;
+}
+
 const char *token_type_to_string(TokenType type) {
   switch (type) {
   case (TOKEN_LEFT_PAREN):
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -90,21 +91,117 @@ typedef enum TokenType {
   TOKEN_EOF
 } TokenType;
 
+// Tokens only carry byte offsets; a LineIndex turns those into line/column
+// positions when something (a diagnostic, a node) actually needs one
 typedef struct Token {
   TokenType type;
-  size_t line;
+  size_t offset; // byte offset of the token's first character in the source
+  size_t length; // source bytes covered (a string includes its quotes)
   char *lexeme;
+  union {
+    uint64_t integer; // TOKEN_INTEGER
+    double floating;  // TOKEN_FLOAT
+  } value;
 } Token;
 
 typedef struct Lexer {
+  const char *source;
+  const char *end; // the source's NUL terminator
   const char *start;
   const char *current;
-  size_t line;
+  // Bytes before `checked` have been validated as UTF-8: init_lexer() checks
+  // the whole source up front, relex() only what it scans. `invalid_utf8` is
+  // the first malformed byte among them, or `checked` when there is none
+  const char *invalid_utf8;
+  const char *checked;
   Allocator *allocator;
 } Lexer;
 
 void init_lexer(Lexer *lexer, const char *src, Allocator *allocator);
 
+// Move a lexer back to `offset` to scan [offset, offset + length) again, e.g.
+// a function body a lazy parse skipped. Only that span is revalidated, so it
+// costs O(length) rather than a pass over the rest of the source
+void rewind_lexer(Lexer *lexer, size_t offset, size_t length);
+
 Token scan_token(Lexer *lexer);
 void free_token_lexeme(Allocator *allocator, Token token);
 const char *token_type_to_string(TokenType type);
+
+// A growable array of tokens that owns their lexemes
+typedef struct TokenBuffer {
+  Token *items;
+  size_t count;
+  size_t cap;
+} TokenBuffer;
+
+// Scan the rest of the lexer's input into `tokens`, up to and including EOF
+void lex_all(Lexer *lexer, TokenBuffer *tokens);
+void free_token_buffer(Allocator *allocator, TokenBuffer *tokens);
+
+// An edit that replaced `removed` bytes at `offset` with `inserted` new bytes
+typedef struct TextEdit {
+  size_t offset;
+  size_t removed;
+  size_t inserted;
+} TextEdit;
+
+// Tokens [first, first + new_count) of the buffer were re-scanned; they
+// replaced `old_count` tokens of the previous stream
+typedef struct RelexResult {
+  size_t first;
+  size_t old_count;
+  size_t new_count;
+} RelexResult;
+
+// Bring `tokens`, a full scan of the text before `edit`, up to date with `src`,
+// the text after it. Scanning restarts at the last token boundary before the
+// edit and stops as soon as a new token lands on the start of an old one past
+// the edit; from there on the old tokens are kept and only their offsets are
+// shifted.
+RelexResult relex(TokenBuffer *tokens, const char *src, TextEdit edit,
+                  Allocator *allocator);
+
+// Lexes input read from a file descriptor through a fixed-size window, so
+// memory stays bounded however much is piped in. Tokens are scanned by the
+// same scan_token() as in-memory sources; one that runs into the end of the
+// window is thrown away and re-scanned after the unconsumed tail is moved to
+// the front and the rest refilled. The window only grows to fit a single
+// token longer than half of it. Lexemes are copies, so tokens stay valid
+// across refills, and offsets count from the start of the stream.
+typedef struct StreamLexer {
+  Lexer lexer;
+  int fd;
+  char *buf;     // the window, NUL-terminated at buf[len]
+  size_t cap;    // bytes allocated for buf
+  size_t len;    // bytes of buf the lexer may look at
+  size_t base;   // stream offset of buf[0]
+  char carry[4]; // a UTF-8 sequence split by the last read
+  size_t carried;
+  bool eof;
+  bool in_comment; // the window starts inside a line comment
+} StreamLexer;
+
+void init_stream_lexer(StreamLexer *stream, int fd, size_t window,
+                       Allocator *allocator);
+Token stream_scan_token(StreamLexer *stream);
+void free_stream_lexer(StreamLexer *stream);
+
+// Offsets of the first byte of every line, in source order
+typedef struct LineIndex {
+  size_t *starts;
+  size_t count;
+  size_t cap;
+} LineIndex;
+
+// 1-based line and byte column of a source offset
+typedef struct SourcePos {
+  size_t line;
+  size_t column;
+} SourcePos;
+
+void build_line_index(LineIndex *index, const char *src, Allocator *allocator);
+void free_line_index(Allocator *allocator, LineIndex *index);
+
+// O(log n) in the number of lines
+SourcePos line_index_lookup(const LineIndex *index, size_t offset);
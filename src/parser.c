@@ -18,51 +18,38 @@
 #include "src/ast.h"
 #include "src/lexer.h"
 
-#include <stdio.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <string.h>
 
 static Node *parse_declaration(Parser *p);
 static Node *parse_import(Parser *p);
 static Node *parse_fn(Parser *p, bool is_pub);
+static void skip_fn_body(Parser *p, Node *fn);
 static Node *parse_type_decl(Parser *p, bool is_pub);
 static Node *parse_record(Parser *p, NodeKind kind);
 static Node *parse_enum(Parser *p);
-static Node *parse_statement(Parser *p);
 static Node *parse_var_decl(Parser *p, bool is_const);
 static Node *parse_let_stmt(Parser *p, bool is_const);
-static Node *parse_if(Parser *p);
-static Node *parse_while(Parser *p);
-static Node *parse_do_while(Parser *p);
-static Node *parse_for(Parser *p);
 static Node *parse_return(Parser *p);
 static Node *parse_block(Parser *p);
 static Node *parse_type(Parser *p);
 static Node *parse_expr(Parser *p);
-static Node *parse_assignment(Parser *p);
-static Node *parse_binary(Parser *p, int min_prec);
-static Node *parse_unary(Parser *p);
-static Node *parse_postfix(Parser *p);
-static Node *parse_primary(Parser *p);
 
-static void error_at(Parser *p, Token *token, const char *msg) {
+static void error_at(Parser *p, Token *token, DiagId id) {
   if (p->panic_mode)
     return;
 
   p->panic_mode = true;
   p->had_error = true;
-
-  fprintf(stderr, "[line %zu] Error", token->line);
-  if (token->type == TOKEN_EOF) {
-    fprintf(stderr, " at end");
-  } else if (token->type == TOKEN_ERROR) {
-    // the lexeme is the message
-  } else if (token->lexeme != NULL) {
-    fprintf(stderr, " at '%s'", token->lexeme);
-  }
-  fprintf(stderr, ": %s\n", msg);
+  DiagKind kind =
+      token->type == TOKEN_ERROR ? DIAG_LEX_ERROR : DIAG_SYNTAX_ERROR;
+  const char *arg = token->type == TOKEN_EOF ? NULL : token->lexeme;
+  add_diagnostic(&p->diags, kind, id, token->offset, token->length, arg);
 }
 
-static void error_at_current(Parser *p, const char *msg) {
-  error_at(p, &p->current, msg);
+static void error_at_current(Parser *p, DiagId id) {
+  error_at(p, &p->current, id);
 }
 
 static void advance(Parser *p) {
@@ -73,7 +60,7 @@ static void advance(Parser *p) {
     p->current = scan_token(p->lexer);
     if (p->current.type != TOKEN_ERROR)
       break;
-    error_at_current(p, p->current.lexeme ? p->current.lexeme : "lex error");
+    error_at_current(p, DIAG_BAD_TOKEN);
     free_token_lexeme(p->allocator, p->current);
   }
 }
@@ -87,12 +74,13 @@ static bool match(Parser *p, TokenType type) {
   return true;
 }
 
-static void consume(Parser *p, TokenType type, const char *msg) {
+static bool consume(Parser *p, TokenType type, DiagId id) {
   if (check(p, type)) {
     advance(p);
-    return;
+    return true;
   }
-  error_at_current(p, msg);
+  error_at_current(p, id);
+  return false;
 }
 
 // After an error, discard tokens until the next likely statement/decl boundary
@@ -124,49 +112,69 @@ static void synchronize(Parser *p) {
   }
 }
 
+// synchronize(), but first step over the token a failed statement started at
+// if it consumed nothing: synchronize() may stop right there again (a ';' just
+// before it, or a keyword like `if` at the top level) and the same statement
+// would fail forever
+static void recover(Parser *p, size_t start) {
+  if (p->current.offset == start && !check(p, TOKEN_EOF))
+    advance(p);
+  synchronize(p);
+}
+
+// Tokens arrive in source order, so the line of the last lookup is nearly
+// always the answer or a few lines short of it
+static size_t line_of(Parser *p, size_t offset) {
+  const LineIndex *lines = &p->lines;
+  size_t i = p->line_hint;
+  if (i >= lines->count || lines->starts[i] > offset) {
+    i = line_index_lookup(lines, offset).line - 1;
+  } else {
+    while (i + 1 < lines->count && lines->starts[i + 1] <= offset)
+      i++;
+  }
+  p->line_hint = i;
+  return i + 1;
+}
+
 static Node *make(Parser *p, NodeKind kind) {
-  return new_node(p->allocator, kind, p->previous.line);
+  return new_node(p->allocator, kind, line_of(p, p->previous.offset));
 }
 
+// The node takes the lexeme over instead of copying it, which leaves advance()
+// nothing to free for this token
 static char *prev_text(Parser *p) {
-  return ast_copy_str(p->allocator, p->previous.lexeme);
+  char *text = p->previous.lexeme;
+  p->previous.lexeme = NULL;
+  return text;
 }
 
-static bool is_assign_op(TokenType t) {
-  switch (t) {
-  case TOKEN_EQUAL:
-  case TOKEN_PLUS_EQUAL:
-  case TOKEN_MINUS_EQUAL:
-  case TOKEN_MUL_EQUAL:
-  case TOKEN_DIV_EQUAL:
-  case TOKEN_REM_EQUAL:
-    return true;
-  default:
-    return false;
-  }
+// Children are gathered on the parser's scratch stack while a list is open and
+// copied into an exactly-sized array when it closes. Nested lists stack on the
+// same buffer, so each finished list is one allocation of its real size
+static size_t open_list(Parser *p) { return p->scratch.count; }
+
+static void list_push(Parser *p, Node *node) {
+  node_list_push(p->allocator, &p->scratch, node);
 }
 
-// 0 means "not a binary operator"
-static int get_precedence(TokenType t) {
-  switch (t) {
-  case TOKEN_EQUAL_EQUAL:
-  case TOKEN_BANG_EQUAL:
-    return 1;
-  case TOKEN_LESS:
-  case TOKEN_LESS_EQUAL:
-  case TOKEN_GREATER:
-  case TOKEN_GREATER_EQUAL:
-    return 2;
-  case TOKEN_PLUS:
-  case TOKEN_MINUS:
-    return 3;
-  case TOKEN_MUL:
-  case TOKEN_DIV:
-  case TOKEN_REM:
-    return 4;
-  default:
-    return 0;
+static void close_list(Parser *p, size_t base, NodeList *list) {
+  size_t n = p->scratch.count - base;
+  p->scratch.count = base;
+  list->items = NULL;
+  list->count = list->cap = 0;
+  if (n == 0)
+    return;
+
+  Node **items = (Node **)ALLOC(p->allocator, n * sizeof(Node *), "NodeList");
+  if (items == NULL) {
+    for (size_t i = 0; i < n; i++)
+      free_node(p->allocator, p->scratch.items[base + i]);
+    return;
   }
+  memcpy(items, p->scratch.items + base, n * sizeof(Node *));
+  list->items = items;
+  list->count = list->cap = n;
 }
 
 static Node *parse_declaration(Parser *p) {
@@ -178,7 +186,7 @@ static Node *parse_declaration(Parser *p) {
     return parse_type_decl(p, is_pub);
 
   if (is_pub) {
-    error_at_current(p, "Exected 'fn' or 'type' after 'pub'.");
+    error_at_current(p, DIAG_EXPECTED_FN_OR_TYPE_AFTER_PUB);
     return NULL;
   }
 
@@ -189,7 +197,7 @@ static Node *parse_declaration(Parser *p) {
   if (match(p, TOKEN_CONST))
     return parse_let_stmt(p, false);
 
-  error_at_current(p, "Expected a declaration.");
+  error_at_current(p, DIAG_EXPECTED_DECL);
   return NULL;
 }
 
@@ -198,10 +206,10 @@ static Node *parse_import(Parser *p) {
   if (!node)
     return NULL;
 
-  consume(p, TOKEN_IDENTIFIER, "Expected module name after 'import'.");
+  consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_MODULE_NAME);
   node->as.import.path = prev_text(p);
-  consume(p, TOKEN_SEMICOLON, "Expected ';' after import.");
-
+  consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_IMPORT);
+  hash_node(node);
   return node;
 }
 
@@ -210,29 +218,32 @@ static Node *parse_fn(Parser *p, bool is_pub) {
   if (!node)
     return NULL;
 
-  consume(p, TOKEN_IDENTIFIER, "Expected function name.");
+  consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_FN_NAME);
   node->as.fn.is_pub = is_pub;
   node->as.fn.name = prev_text(p);
 
-  consume(p, TOKEN_LEFT_PAREN, "Expected '(' after function name.");
+  consume(p, TOKEN_LEFT_PAREN, DIAG_EXPECTED_PAREN_AFTER_FN_NAME);
+  size_t base = open_list(p);
   if (!check(p, TOKEN_RIGHT_PAREN)) {
     do {
       Node *param = make(p, NODE_PARAM);
-      if (!param)
+      if (!param) {
+        close_list(p, base, &node->as.fn.params);
         return NULL;
+      }
 
-      consume(p, TOKEN_IDENTIFIER, "Expected parameter name.");
-      param->line = p->previous.line;
+      consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_PARAM_NAME);
+      param->line = line_of(p, p->previous.offset);
       param->as.param.name = prev_text(p);
-      consume(
-          p, TOKEN_COLON,
-          "Expected ':' after parameter name; parameters must have a type.");
+      consume(p, TOKEN_COLON, DIAG_EXPECTED_PARAM_TYPE);
       param->as.param.type = parse_type(p);
+      hash_node(param);
 
-      node_list_push(p->allocator, &node->as.fn.params, param);
+      list_push(p, param);
     } while (match(p, TOKEN_COMMA));
   }
-  consume(p, TOKEN_RIGHT_PAREN, "Expected ')' after parameters.");
+  close_list(p, base, &node->as.fn.params);
+  consume(p, TOKEN_RIGHT_PAREN, DIAG_EXPECTED_PAREN_AFTER_PARAMS);
 
   // optional return type
   if (!check(p, TOKEN_LEFT_BRACE)) {
@@ -240,21 +251,55 @@ static Node *parse_fn(Parser *p, bool is_pub) {
     node->as.fn.ret_type = ret_type;
   }
 
-  Node *body = parse_block(p);
-  node->as.fn.body = body;
+  if (p->lazy_fn_bodies)
+    skip_fn_body(p, node); // hashed by its text until parse_fn_body()
+  else
+    node->as.fn.body = parse_block(p);
 
+  hash_node(node);
   return node;
 }
 
+// Step over a body by brace matching and record its span for parse_fn_body()
+static void skip_fn_body(Parser *p, Node *fn) {
+  if (!check(p, TOKEN_LEFT_BRACE)) {
+    error_at_current(p, DIAG_EXPECTED_BRACE);
+    return;
+  }
+
+  // Tokens come straight from the lexer rather than through advance(): any
+  // error in the body, a bad token or a missing '}', is for parse_fn_body()
+  // to report, once, when the body is asked for
+  size_t start = p->current.offset;
+  size_t end = p->current.offset + p->current.length;
+  size_t depth = 1;
+  while (depth > 0) {
+    Token token = scan_token(p->lexer);
+    if (token.type == TOKEN_LEFT_BRACE)
+      depth++;
+    else if (token.type == TOKEN_RIGHT_BRACE)
+      depth--;
+    free_token_lexeme(p->allocator, token);
+    if (token.type == TOKEN_EOF)
+      break;
+    end = token.offset + token.length;
+  }
+  advance(p); // past the '{', to the token after the body
+
+  fn->as.fn.body_start = start;
+  fn->as.fn.body_end = end;
+  fn->as.fn.body_hash = hash_bytes(p->lexer->source + start, end - start);
+}
+
 static Node *parse_type_decl(Parser *p, bool is_pub) {
   Node *node = make(p, NODE_TYPE_DECL);
   if (!node)
     return NULL;
 
-  consume(p, TOKEN_IDENTIFIER, "Expected type name.");
+  consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_TYPE_DECL_NAME);
   node->as.type_decl.is_pub = is_pub;
   node->as.type_decl.name = prev_text(p);
-  consume(p, TOKEN_EQUAL, "Expected '=' in type declaration.");
+  consume(p, TOKEN_EQUAL, DIAG_EXPECTED_EQUAL_IN_TYPE_DECL);
 
   Node *def;
   if (match(p, TOKEN_STRUCT)) {
@@ -265,40 +310,45 @@ static Node *parse_type_decl(Parser *p, bool is_pub) {
     def = parse_enum(p);
   } else {
     def = parse_type(p);
-    consume(p, TOKEN_SEMICOLON, "Expected ';' after type declaration.");
+    consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_TYPE_DECL);
   }
 
   node->as.type_decl.def = def;
+  hash_node(node);
   return node;
 }
 
 // struct/union share a field list
 static Node *parse_record(Parser *p, NodeKind kind) {
-  Node *node = make(p, NODE_STRUCT);
+  Node *node = make(p, kind);
   if (!node)
     return NULL;
 
-  node->kind = kind;
-
-  consume(p, TOKEN_LEFT_BRACE, "Expected '{' to begin fields.");
+  consume(p, TOKEN_LEFT_BRACE, DIAG_EXPECTED_BRACE_BEFORE_FIELDS);
+  size_t base = open_list(p);
   while (!check(p, TOKEN_RIGHT_BRACE) && !check(p, TOKEN_EOF)) {
     Node *field = make(p, NODE_FIELD);
-    if (!field)
+    if (!field) {
+      close_list(p, base, &node->as.record.fields);
       return NULL;
+    }
 
-    consume(p, TOKEN_IDENTIFIER, "Expected field name.");
-    field->line = p->previous.line;
+    consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_FIELD_NAME);
+    field->line = line_of(p, p->previous.offset);
     field->as.field.name = prev_text(p);
-    consume(p, TOKEN_COLON, "Expected ':' after field name");
+    consume(p, TOKEN_COLON, DIAG_EXPECTED_FIELD_TYPE);
     Node *ftype = parse_type(p);
     field->as.field.type = ftype;
+    hash_node(field);
 
-    node_list_push(p->allocator, &node->as.record.fields, field);
+    list_push(p, field);
 
     if (!match(p, TOKEN_COMMA))
       break;
   }
-  consume(p, TOKEN_RIGHT_BRACE, "Expected '}' after fields.");
+  close_list(p, base, &node->as.record.fields);
+  consume(p, TOKEN_RIGHT_BRACE, DIAG_EXPECTED_BRACE_AFTER_FIELDS);
+  hash_node(node);
   return node;
 }
 
@@ -307,147 +357,149 @@ static Node *parse_enum(Parser *p) {
   if (!node)
     return NULL;
 
-  consume(p, TOKEN_LEFT_BRACE, "Expected '{' to begin variants.");
+  consume(p, TOKEN_LEFT_BRACE, DIAG_EXPECTED_BRACE_BEFORE_VARIANTS);
+  size_t base = open_list(p);
   while (!check(p, TOKEN_RIGHT_BRACE) && !check(p, TOKEN_EOF)) {
     Node *variant = make(p, NODE_ENUM_VAR);
-    if (!variant)
+    if (!variant) {
+      close_list(p, base, &node->as.enom.variants);
       return NULL;
+    }
 
-    consume(p, TOKEN_IDENTIFIER, "Expected variant name.");
-    variant->line = p->previous.line;
+    consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_VARIANT_NAME);
+    variant->line = line_of(p, p->previous.offset);
     variant->as.enum_variant.name = prev_text(p);
     if (match(p, TOKEN_EQUAL))
       variant->as.enum_variant.val = parse_expr(p);
+    hash_node(variant);
 
-    node_list_push(p->allocator, &node->as.enom.variants, variant);
+    list_push(p, variant);
 
     if (!match(p, TOKEN_COMMA))
       break;
   }
+  close_list(p, base, &node->as.enom.variants);
 
-  consume(p, TOKEN_RIGHT_BRACE, "Expected '}' after variants.");
+  consume(p, TOKEN_RIGHT_BRACE, DIAG_EXPECTED_BRACE_AFTER_VARIANTS);
+  hash_node(node);
   return node;
 }
 
-static Node *parse_statement(Parser *p) {
-  if (match(p, TOKEN_LET))
-    return parse_let_stmt(p, false);
-  if (match(p, TOKEN_CONST))
-    return parse_let_stmt(p, true);
-  if (match(p, TOKEN_IF))
-    return parse_if(p);
-  if (match(p, TOKEN_WHILE))
-    return parse_while(p);
-  if (match(p, TOKEN_DO))
-    return parse_do_while(p);
-  if (match(p, TOKEN_FOR))
-    return parse_for(p);
-  if (match(p, TOKEN_RETURN))
-    return parse_return(p);
-  if (check(p, TOKEN_LEFT_BRACE))
-    return parse_block(p);
-
-  if (match(p, TOKEN_BREAK)) {
-    Node *node = make(p, NODE_BREAK);
-    consume(p, TOKEN_SEMICOLON, "Expected ';' after 'break'.");
-    return node;
-  }
-  if (match(p, TOKEN_CONTINUE)) {
-    Node *node = make(p, NODE_CONTINUE);
-    consume(p, TOKEN_SEMICOLON, "Expected ';' after 'continue'.");
-    return node;
-  }
-
-  Node *node = make(p, NODE_EXPR_STMT);
-  if (!node)
-    return NULL;
-  Node *expr = parse_expr(p);
-  node->as.expr_stmt.expr = expr;
-  consume(p, TOKEN_SEMICOLON, "Expected ';' after expression.");
+/* --------------------------------------------------------------------------
+ * Statements and blocks
+ *
+ * Blocks nest through if/while/do/for and bare braces. Rather than recursing
+ * per level, parse_block() keeps the enclosing statements on p->stmts: a
+ * compound statement pushes a frame and opens its block, and when a block
+ * closes the frame below picks it up (as a then/else branch, a loop body, or
+ * the next statement of an outer block).
+ * -------------------------------------------------------------------------- */
 
-  return node;
+typedef enum StmtFrameKind {
+  STMT_BLOCK,   // collecting statements on the scratch stack
+  STMT_IF_THEN, // then-block of `node` is open; `stmt` heads the else-if chain
+  STMT_IF_ELSE, // final else-block of `node` is open
+  STMT_WHILE,
+  STMT_DO,
+  STMT_FOR,
+} StmtFrameKind;
+
+struct StmtFrame {
+  StmtFrameKind kind;
+  Node *stmt;  // delivered to the frame below once this one is done
+  Node *node;  // the node whose block is open
+  size_t base; // STMT_BLOCK: scratch base of its statements
+};
+
+// What parse_statement() did with the tokens at hand
+typedef enum StmtStep {
+  STEP_DONE,   // parsed a whole statement (possibly NULL after an error)
+  STEP_OPENED, // pushed frames and opened a block
+  STEP_FAILED, // out of memory or nested too deeply; unwind
+} StmtStep;
+
+static bool too_deep(Parser *p) {
+  return p->exprs.count + p->stmts.count >= p->max_depth;
 }
 
-static Node *parse_var_decl(Parser *p, bool is_const) {
-  Node *node = make(p, NODE_LET);
-  if (!node)
-    return NULL;
+static bool push_stmt(Parser *p, StmtFrameKind kind, Node *node) {
+  StmtStack *stack = &p->stmts;
+  if (stack->count + 1 > stack->cap) {
+    size_t old_cap = stack->cap;
+    size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+    StmtFrame *items = (StmtFrame *)REALLOC(
+        p->allocator, stack->items, old_cap * sizeof(StmtFrame),
+        new_cap * sizeof(StmtFrame), "ParserStack");
+    if (items == NULL) {
+      free_node(p->allocator, node);
+      return false;
+    }
+    stack->items = items;
+    stack->cap = new_cap;
+  }
 
-  consume(p, TOKEN_IDENTIFIER, "Expected variable name.");
-  node->as.let.is_const = is_const;
-  node->as.let.name = prev_text(p);
-  if (match(p, TOKEN_COLON))
-    node->as.let.type = parse_type(p);
-  if (match(p, TOKEN_EQUAL))
-    node->as.let.init = parse_expr(p);
+  StmtFrame frame = {kind, node, node, p->scratch.count};
+  stack->items[stack->count++] = frame;
+  return true;
+}
 
-  return node;
+// Free every statement still under construction above `base`
+static Node *unwind_stmts(Parser *p, size_t base) {
+  while (p->stmts.count > base) {
+    StmtFrame *frame = &p->stmts.items[--p->stmts.count];
+    if (frame->kind == STMT_BLOCK)
+      close_list(p, frame->base, &frame->node->as.block.stmts);
+    free_node(p->allocator, frame->stmt);
+  }
+  return NULL;
 }
 
-static Node *parse_let_stmt(Parser *p, bool is_const) {
-  Node *node = parse_var_decl(p, is_const);
-  consume(p, TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
-  return node;
+static bool open_block(Parser *p) {
+  if (too_deep(p)) {
+    error_at_current(p, DIAG_BLOCK_TOO_DEEP);
+    return false;
+  }
+
+  Node *node = make(p, NODE_BLOCK);
+  if (!node)
+    return false;
+  consume(p, TOKEN_LEFT_BRACE, DIAG_EXPECTED_BRACE);
+  return push_stmt(p, STMT_BLOCK, node);
 }
 
-static Node *parse_if(Parser *p) {
+static bool open_if(Parser *p) {
   Node *node = make(p, NODE_IF);
   if (!node)
-    return NULL;
-
-  Node *cond = parse_expr(p);
-  Node *then_branch = parse_block(p);
-
-  Node *else_branch = NULL;
-  if (match(p, TOKEN_ELSE)) {
-    if (match(p, TOKEN_IF))
-      else_branch = parse_if(p);
-    else
-      else_branch = parse_block(p);
-  }
-
-  node->as.if_stmt.cond = cond;
-  node->as.if_stmt.then_branch = then_branch;
-  node->as.if_stmt.else_branch = else_branch;
+    return false;
 
-  return node;
+  node->as.if_stmt.cond = parse_expr(p);
+  return push_stmt(p, STMT_IF_THEN, node) && open_block(p);
 }
 
-static Node *parse_while(Parser *p) {
+static bool open_while(Parser *p) {
   Node *node = make(p, NODE_WHILE);
   if (!node)
-    return NULL;
-
-  Node *cond = parse_expr(p);
-  Node *body = parse_block(p);
-  node->as.while_stmt.cond = cond;
-  node->as.while_stmt.body = body;
+    return false;
 
-  return node;
+  node->as.while_stmt.cond = parse_expr(p);
+  return push_stmt(p, STMT_WHILE, node) && open_block(p);
 }
 
-static Node *parse_do_while(Parser *p) {
+static bool open_do_while(Parser *p) {
   Node *node = make(p, NODE_DO_WHILE);
   if (!node)
-    return NULL;
-
-  Node *body = parse_block(p);
-  consume(p, TOKEN_WHILE, "Expected 'while' after do-block.");
-  Node *cond = parse_expr(p);
-  consume(p, TOKEN_SEMICOLON, "Exected ';' after do-while condition.");
-  node->as.do_while.body = body;
-  node->as.do_while.cond = cond;
+    return false;
 
-  return node;
+  return push_stmt(p, STMT_DO, node) && open_block(p);
 }
 
 // for { ... }                infinite
 // for cond { ... }           while style
 // for init; cond; post {...} C-style three-clause
-static Node *parse_for(Parser *p) {
+static bool open_for(Parser *p) {
   Node *node = make(p, NODE_FOR);
   if (!node)
-    return NULL;
+    return false;
 
   Node *init = NULL, *cond = NULL, *post = NULL;
 
@@ -463,7 +515,7 @@ static Node *parse_for(Parser *p) {
     if (match(p, TOKEN_SEMICOLON)) {
       if (!check(p, TOKEN_SEMICOLON))
         cond = parse_expr(p);
-      consume(p, TOKEN_SEMICOLON, "Expected ';' after loop condition");
+      consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_LOOP_COND);
       if (!check(p, TOKEN_LEFT_BRACE))
         post = parse_expr(p);
     } else {
@@ -473,12 +525,71 @@ static Node *parse_for(Parser *p) {
     }
   }
 
-  Node *body = parse_block(p);
   node->as.for_stmt.init = init;
   node->as.for_stmt.cond = cond;
   node->as.for_stmt.post = post;
-  node->as.for_stmt.body = body;
+  return push_stmt(p, STMT_FOR, node) && open_block(p);
+}
 
+static StmtStep parse_statement(Parser *p, Node **out) {
+  *out = NULL;
+  if (match(p, TOKEN_IF))
+    return open_if(p) ? STEP_OPENED : STEP_FAILED;
+  if (match(p, TOKEN_WHILE))
+    return open_while(p) ? STEP_OPENED : STEP_FAILED;
+  if (match(p, TOKEN_DO))
+    return open_do_while(p) ? STEP_OPENED : STEP_FAILED;
+  if (match(p, TOKEN_FOR))
+    return open_for(p) ? STEP_OPENED : STEP_FAILED;
+  if (check(p, TOKEN_LEFT_BRACE))
+    return open_block(p) ? STEP_OPENED : STEP_FAILED;
+
+  if (match(p, TOKEN_LET)) {
+    *out = parse_let_stmt(p, false);
+  } else if (match(p, TOKEN_CONST)) {
+    *out = parse_let_stmt(p, true);
+  } else if (match(p, TOKEN_RETURN)) {
+    *out = parse_return(p);
+  } else if (match(p, TOKEN_BREAK)) {
+    *out = make(p, NODE_BREAK);
+    hash_node(*out);
+    consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_BREAK);
+  } else if (match(p, TOKEN_CONTINUE)) {
+    *out = make(p, NODE_CONTINUE);
+    hash_node(*out);
+    consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_CONTINUE);
+  } else {
+    Node *node = make(p, NODE_EXPR_STMT);
+    if (node) {
+      node->as.expr_stmt.expr = parse_expr(p);
+      hash_node(node);
+      consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_EXPR);
+    }
+    *out = node;
+  }
+  return STEP_DONE;
+}
+
+static Node *parse_var_decl(Parser *p, bool is_const) {
+  Node *node = make(p, NODE_LET);
+  if (!node)
+    return NULL;
+
+  consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_VAR_NAME);
+  node->as.let.is_const = is_const;
+  node->as.let.name = prev_text(p);
+  if (match(p, TOKEN_COLON))
+    node->as.let.type = parse_type(p);
+  if (match(p, TOKEN_EQUAL))
+    node->as.let.init = parse_expr(p);
+
+  hash_node(node);
+  return node;
+}
+
+static Node *parse_let_stmt(Parser *p, bool is_const) {
+  Node *node = parse_var_decl(p, is_const);
+  consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_VAR);
   return node;
 }
 
@@ -490,290 +601,1217 @@ static Node *parse_return(Parser *p) {
   if (!check(p, TOKEN_SEMICOLON)) {
     node->as.ret.val = parse_expr(p);
   }
+  hash_node(node);
 
-  consume(p, TOKEN_SEMICOLON, "Expected ';' after return.");
+  consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_RETURN);
   return node;
 }
 
+// An else-if chain completes all at once, from `head` down to `last`; hash it
+// from the innermost if out
+static void hash_if_chain(Parser *p, Node *head, Node *last) {
+  size_t base = open_list(p);
+  for (Node *node = head; node != last; node = node->as.if_stmt.else_branch)
+    list_push(p, node);
+  hash_node(last);
+  while (p->scratch.count > base)
+    hash_node(p->scratch.items[--p->scratch.count]);
+}
+
 static Node *parse_block(Parser *p) {
-  Node *node = make(p, NODE_BLOCK);
-  if (!node)
-    return NULL;
+  size_t base = p->stmts.count;
+  if (!open_block(p))
+    return unwind_stmts(p, base);
 
-  consume(p, TOKEN_LEFT_BRACE, "Expected '{'");
-  while (!check(p, TOKEN_RIGHT_BRACE) && !check(p, TOKEN_EOF)) {
-    Node *stmt = parse_statement(p);
-    node_list_push(p->allocator, &node->as.block.stmts, stmt);
+  for (;;) {
+    // The top frame is always the innermost open block here
+    if (!check(p, TOKEN_RIGHT_BRACE) && !check(p, TOKEN_EOF)) {
+      size_t start = p->current.offset;
+      Node *stmt;
+      StmtStep step = parse_statement(p, &stmt);
+      if (step == STEP_FAILED)
+        return unwind_stmts(p, base);
+      if (step == STEP_OPENED)
+        continue;
+
+      list_push(p, stmt);
+      if (p->panic_mode)
+        recover(p, start);
+      continue;
+    }
 
-    if (p->panic_mode)
-      synchronize(p);
+    StmtFrame *block = &p->stmts.items[--p->stmts.count];
+    close_list(p, block->base, &block->node->as.block.stmts);
+    hash_node(block->node);
+    consume(p, TOKEN_RIGHT_BRACE, DIAG_EXPECTED_BRACE_AFTER_BLOCK);
+
+    // Hand the finished block to whatever was waiting on it; statements it
+    // completes are handed down in turn until an open block takes one
+    Node *done = block->node;
+    bool reopened = false;
+    while (!reopened) {
+      if (p->stmts.count == base)
+        return done;
+
+      StmtFrame *top = &p->stmts.items[p->stmts.count - 1];
+      switch (top->kind) {
+      case STMT_BLOCK:
+        list_push(p, done);
+        if (p->panic_mode)
+          synchronize(p);
+        reopened = true;
+        break;
+      case STMT_IF_THEN:
+        top->node->as.if_stmt.then_branch = done;
+        if (match(p, TOKEN_ELSE)) {
+          if (match(p, TOKEN_IF)) {
+            Node *next = make(p, NODE_IF);
+            if (!next)
+              return unwind_stmts(p, base);
+            top->node->as.if_stmt.else_branch = next;
+            top->node = next;
+            next->as.if_stmt.cond = parse_expr(p);
+          } else {
+            top->kind = STMT_IF_ELSE;
+          }
+          if (!open_block(p))
+            return unwind_stmts(p, base);
+          reopened = true;
+          break;
+        }
+        hash_if_chain(p, top->stmt, top->node);
+        done = top->stmt;
+        p->stmts.count--;
+        break;
+      case STMT_IF_ELSE:
+        top->node->as.if_stmt.else_branch = done;
+        hash_if_chain(p, top->stmt, top->node);
+        done = top->stmt;
+        p->stmts.count--;
+        break;
+      case STMT_WHILE:
+        top->node->as.while_stmt.body = done;
+        hash_node(top->node);
+        done = top->stmt;
+        p->stmts.count--;
+        break;
+      case STMT_DO:
+        top->node->as.do_while.body = done;
+        consume(p, TOKEN_WHILE, DIAG_EXPECTED_WHILE_AFTER_DO);
+        top->node->as.do_while.cond = parse_expr(p);
+        consume(p, TOKEN_SEMICOLON, DIAG_EXPECTED_SEMI_AFTER_DO_WHILE);
+        hash_node(top->node);
+        done = top->stmt;
+        p->stmts.count--;
+        break;
+      case STMT_FOR:
+        top->node->as.for_stmt.body = done;
+        hash_node(top->node);
+        done = top->stmt;
+        p->stmts.count--;
+        break;
+      }
+    }
   }
-
-  consume(p, TOKEN_RIGHT_BRACE, "Exected '}' after block.");
-  return node;
 }
 
-static Node *parse_type(Parser *p) {
-  if (match(p, TOKEN_CARET)) {
-    Node *node = make(p, NODE_TYPE_PTR);
-    if (!node)
-      return NULL;
+static Node *intern(Parser *p, Node *type) {
+  return p->types ? intern_type(p->allocator, p->types, type) : type;
+}
 
-    Node *pointee = parse_type(p);
-    node->as.pointer.pointee = pointee;
-    return node;
+// Wrap `type` in the pointer/array wrappers on the scratch stack above `base`,
+// innermost (last pushed) first, interning each layer
+static Node *wrap_type(Parser *p, size_t base, Node *type) {
+  while (p->scratch.count > base) {
+    Node *wrapper = p->scratch.items[--p->scratch.count];
+    if (wrapper->kind == NODE_TYPE_PTR)
+      wrapper->as.pointer.pointee = type;
+    else
+      wrapper->as.array.elem = type;
+    hash_node(wrapper);
+    type = intern(p, wrapper);
   }
+  return type;
+}
 
-  if (match(p, TOKEN_LEFT_BRACKET)) {
-    Node *node = make(p, NODE_TYPE_ARR);
-    if (!node)
-      return NULL;
-
-    Node *size = NULL;
-    if (!check(p, TOKEN_RIGHT_BRACKET))
-      size = parse_expr(p); // sized [N]T; empty brackets -> slice []T
-    consume(p, TOKEN_RIGHT_BRACKET, "Expected ']' in array type.");
-    Node *elem = parse_type(p);
-    if (!elem)
-      return NULL;
-
-    node->as.array.size = size;
-    node->as.array.elem = elem;
-
-    return node;
+static Node *parse_type_name(Parser *p) {
+  // A name that's interned already costs no allocation at all
+  if (p->types && check(p, TOKEN_IDENTIFIER)) {
+    Node probe = {.kind = NODE_TYPE_NAME};
+    probe.as.type_name.name = p->current.lexeme;
+    Node *type = lookup_type(p->types, &probe);
+    if (type) {
+      advance(p);
+      return type;
+    }
   }
 
   Node *node = make(p, NODE_TYPE_NAME);
-  consume(p, TOKEN_IDENTIFIER, "Expected a type name.");
-  node->as.type_name.name = prev_text(p);
-  return node;
+  if (node) {
+    // Without the name, the token before it may still hold text of its own
+    if (consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_TYPE))
+      node->as.type_name.name = prev_text(p);
+    hash_node(node);
+  }
+  return intern(p, node);
 }
 
-static Node *parse_expr(Parser *p) { return parse_assignment(p); }
+// Pointer and array prefixes wrap the type that follows them. They wait on the
+// scratch stack until the name at the bottom is known, so the type can be
+// interned from the inside out
+static Node *parse_type(Parser *p) {
+  size_t base = open_list(p);
 
-static Node *parse_assignment(Parser *p) {
-  Node *target = parse_binary(p, 1);
-  if (!target)
-    return NULL;
+  for (size_t depth = 0;; depth++) {
+    if (depth >= p->max_depth) {
+      error_at_current(p, DIAG_TYPE_TOO_DEEP);
+      break;
+    }
 
-  if (is_assign_op(p->current.type)) {
-    TokenType op = p->current.type;
-    advance(p);
+    if (match(p, TOKEN_CARET)) {
+      Node *node = make(p, NODE_TYPE_PTR);
+      if (!node)
+        break;
+      list_push(p, node);
+      continue;
+    }
 
-    Node *node = make(p, NODE_ASSIGN);
-    if (!node)
-      return NULL;
+    if (match(p, TOKEN_LEFT_BRACKET)) {
+      Node *node = make(p, NODE_TYPE_ARR);
+      if (!node)
+        break;
 
-    Node *val = parse_assignment(p); // right associative
-    node->as.assign.op = op;
-    node->as.assign.target = target;
-    node->as.assign.val = val;
-    return node;
+      if (!check(p, TOKEN_RIGHT_BRACKET))
+        node->as.array.size = parse_expr(p); // sized [N]T; [] -> slice []T
+      consume(p, TOKEN_RIGHT_BRACKET, DIAG_EXPECTED_BRACKET_IN_ARRAY_TYPE);
+      list_push(p, node);
+      continue;
+    }
+
+    return wrap_type(p, base, parse_type_name(p));
   }
 
-  return target;
+  for (size_t i = base; i < p->scratch.count; i++)
+    free_node(p->allocator, p->scratch.items[i]);
+  p->scratch.count = base;
+  return NULL;
 }
 
-static Node *parse_binary(Parser *p, int min_prec) {
-  Node *left = parse_unary(p);
-  if (!left)
-    return NULL;
+// Intern a type built with interning off
+static Node *intern_type_tree(Parser *p, Node *type) {
+  size_t base = open_list(p);
+  while (type && node_refs(type) == 0 &&
+         (type->kind == NODE_TYPE_PTR || type->kind == NODE_TYPE_ARR)) {
+    list_push(p, type);
+    type = type->kind == NODE_TYPE_PTR ? type->as.pointer.pointee
+                                       : type->as.array.elem;
+  }
+  return wrap_type(p, base, intern(p, type));
+}
 
-  for (;;) {
-    int prec = get_precedence(p->current.type);
-    if (prec == 0 || prec < min_prec)
+// Intern every type in a declaration parsed with interning off, as the
+// parallel workers do. Types only appear in declarations and statements, never
+// inside expressions
+static void intern_decl_types(Parser *p, Node *decl) {
+  size_t base = open_list(p);
+  list_push(p, decl);
+  while (p->scratch.count > base) {
+    Node *node = p->scratch.items[--p->scratch.count];
+    if (node == NULL)
+      continue;
+
+    switch (node->kind) {
+    case NODE_FN: {
+      NodeList *params = &node->as.fn.params;
+      for (size_t i = 0; i < params->count; i++) {
+        Node *param = params->items[i];
+        param->as.param.type = intern_type_tree(p, param->as.param.type);
+      }
+      node->as.fn.ret_type = intern_type_tree(p, node->as.fn.ret_type);
+      list_push(p, node->as.fn.body);
       break;
-
-    TokenType op = p->current.type;
-    advance(p);
-
-    Node *node = make(p, NODE_BINARY);
-    if (!node)
-      return NULL;
-
-    Node *right = parse_binary(p, prec + 1);
-    node->as.binary.op = op;
-    node->as.binary.left = left;
-    node->as.binary.right = right;
-    left = node;
+    }
+    case NODE_LET:
+      node->as.let.type = intern_type_tree(p, node->as.let.type);
+      break;
+    case NODE_TYPE_DECL: {
+      Node *def = node->as.type_decl.def;
+      if (def && (def->kind == NODE_STRUCT || def->kind == NODE_UNION)) {
+        NodeList *fields = &def->as.record.fields;
+        for (size_t i = 0; i < fields->count; i++) {
+          Node *field = fields->items[i];
+          field->as.field.type = intern_type_tree(p, field->as.field.type);
+        }
+      } else if (def && def->kind != NODE_ENUM) {
+        node->as.type_decl.def = intern_type_tree(p, def);
+      }
+      break;
+    }
+    case NODE_BLOCK:
+      for (size_t i = 0; i < node->as.block.stmts.count; i++)
+        list_push(p, node->as.block.stmts.items[i]);
+      break;
+    case NODE_IF:
+      list_push(p, node->as.if_stmt.then_branch);
+      list_push(p, node->as.if_stmt.else_branch);
+      break;
+    case NODE_WHILE:
+      list_push(p, node->as.while_stmt.body);
+      break;
+    case NODE_DO_WHILE:
+      list_push(p, node->as.do_while.body);
+      break;
+    case NODE_FOR:
+      list_push(p, node->as.for_stmt.init);
+      list_push(p, node->as.for_stmt.body);
+      break;
+    default:
+      break;
+    }
   }
-
-  return left;
 }
 
-static Node *parse_unary(Parser *p) {
-  if (check(p, TOKEN_BANG) || check(p, TOKEN_MINUS)) {
-    TokenType op = p->current.type;
-    advance(p);
+/* --------------------------------------------------------------------------
+ * Expressions
+ *
+ * A Pratt parser driven by two tables indexed by TokenType: what a token does
+ * at the start of an operand, and what it does after one (with its binding
+ * power). parse_expr() is a single loop over an explicit frame stack
+ * (p->exprs) that dispatches once per token through those tables, so adding
+ * an operator is a table entry and never deepens a call chain. A frame is a
+ * construct waiting for an operand: a prefix operator, the right side of a
+ * binary operator or assignment, a parenthesised expression, a call argument
+ * or an index. Nesting is bounded by p->max_depth rather than the C stack.
+ * -------------------------------------------------------------------------- */
 
-    Node *node = make(p, NODE_UNARY);
-    if (!node)
-      return NULL;
+// Binding powers, loosest first
+enum {
+  PREC_NONE,
+  PREC_ASSIGN,     // = += -= *= /= %=, right associative
+  PREC_EQUALITY,   // == !=
+  PREC_COMPARISON, // < <= > >=
+  PREC_TERM,       // + -
+  PREC_FACTOR,     // * / %
+  PREC_UNARY,      // ! - heap
+  PREC_POSTFIX,    // calls, members, indexing, ++ --
+};
+
+typedef enum PrefixAction {
+  PREFIX_NONE, // can't start an operand
+  PREFIX_UNARY,
+  PREFIX_HEAP,
+  PREFIX_GROUP,
+  PREFIX_INTEGER,
+  PREFIX_FLOAT,
+  PREFIX_STRING,
+  PREFIX_BOOL,
+  PREFIX_NULL,
+  PREFIX_IDENT,
+} PrefixAction;
+
+typedef enum InfixAction {
+  INFIX_NONE, // ends the operand
+  INFIX_BINARY,
+  INFIX_ASSIGN,
+  INFIX_CALL,
+  INFIX_MEMBER,
+  INFIX_INDEX,
+  INFIX_POSTFIX,
+} InfixAction;
+
+typedef struct InfixRule {
+  uint8_t action; // InfixAction
+  uint8_t prec;
+  bool right_assoc;
+} InfixRule;
+
+static const uint8_t prefix_rules[TOKEN_EOF + 1] = {
+    [TOKEN_BANG] = PREFIX_UNARY,      [TOKEN_MINUS] = PREFIX_UNARY,
+    [TOKEN_HEAP] = PREFIX_HEAP,       [TOKEN_LEFT_PAREN] = PREFIX_GROUP,
+    [TOKEN_INTEGER] = PREFIX_INTEGER, [TOKEN_FLOAT] = PREFIX_FLOAT,
+    [TOKEN_STRING] = PREFIX_STRING,   [TOKEN_TRUE] = PREFIX_BOOL,
+    [TOKEN_FALSE] = PREFIX_BOOL,      [TOKEN_NULL] = PREFIX_NULL,
+    [TOKEN_IDENTIFIER] = PREFIX_IDENT,
+};
+
+#define BINARY(prec) {INFIX_BINARY, prec, false}
+#define ASSIGN {INFIX_ASSIGN, PREC_ASSIGN, true}
+#define POSTFIX(action) {action, PREC_POSTFIX, false}
+
+static const InfixRule infix_rules[TOKEN_EOF + 1] = {
+    [TOKEN_EQUAL] = ASSIGN,
+    [TOKEN_PLUS_EQUAL] = ASSIGN,
+    [TOKEN_MINUS_EQUAL] = ASSIGN,
+    [TOKEN_MUL_EQUAL] = ASSIGN,
+    [TOKEN_DIV_EQUAL] = ASSIGN,
+    [TOKEN_REM_EQUAL] = ASSIGN,
+    [TOKEN_EQUAL_EQUAL] = BINARY(PREC_EQUALITY),
+    [TOKEN_BANG_EQUAL] = BINARY(PREC_EQUALITY),
+    [TOKEN_LESS] = BINARY(PREC_COMPARISON),
+    [TOKEN_LESS_EQUAL] = BINARY(PREC_COMPARISON),
+    [TOKEN_GREATER] = BINARY(PREC_COMPARISON),
+    [TOKEN_GREATER_EQUAL] = BINARY(PREC_COMPARISON),
+    [TOKEN_PLUS] = BINARY(PREC_TERM),
+    [TOKEN_MINUS] = BINARY(PREC_TERM),
+    [TOKEN_MUL] = BINARY(PREC_FACTOR),
+    [TOKEN_DIV] = BINARY(PREC_FACTOR),
+    [TOKEN_REM] = BINARY(PREC_FACTOR),
+    [TOKEN_LEFT_PAREN] = POSTFIX(INFIX_CALL),
+    [TOKEN_DOT] = POSTFIX(INFIX_MEMBER),
+    [TOKEN_LEFT_BRACKET] = POSTFIX(INFIX_INDEX),
+    [TOKEN_PLUS_PLUS] = POSTFIX(INFIX_POSTFIX),
+    [TOKEN_MINUS_MINUS] = POSTFIX(INFIX_POSTFIX),
+};
+
+#undef BINARY
+#undef ASSIGN
+#undef POSTFIX
+
+typedef enum ExprFrameKind {
+  EXPR_ROOT,   // the whole expression, returned by parse_expr()
+  EXPR_UNARY,  // '!' / '-' or 'heap' waiting for its operand
+  EXPR_BINARY, // left side and operator waiting for the right side
+  EXPR_ASSIGN, // target and operator waiting for the value
+  EXPR_PAREN,  // '(' waiting for the inner expression and ')'
+  EXPR_CALL,   // call collecting its arguments on the scratch stack
+  EXPR_INDEX,  // subscript waiting for the index and ']'
+} ExprFrameKind;
+
+struct ExprFrame {
+  ExprFrameKind kind;
+  int min_prec; // an operator binding looser than this ends the operand
+  Node *node;   // node being completed, NULL for EXPR_ROOT/EXPR_PAREN
+  size_t base;  // EXPR_CALL: scratch base of the argument list
+};
+
+typedef enum ExprState {
+  EXPR_PREFIX, // expecting an operand
+  EXPR_INFIX,  // have an operand; extend it or complete the frame on top
+  EXPR_DONE,   // have a whole expression for the frame on top
+} ExprState;
+
+static bool push_expr(Parser *p, ExprFrameKind kind, int min_prec,
+                      Node *node) {
+  ExprStack *stack = &p->exprs;
+  if (stack->count + 1 > stack->cap) {
+    size_t old_cap = stack->cap;
+    size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+    ExprFrame *items = (ExprFrame *)REALLOC(
+        p->allocator, stack->items, old_cap * sizeof(ExprFrame),
+        new_cap * sizeof(ExprFrame), "ParserStack");
+    if (items == NULL) {
+      free_node(p->allocator, node);
+      return false;
+    }
+    stack->items = items;
+    stack->cap = new_cap;
+  }
 
-    Node *operand = parse_unary(p);
-    node->as.unary.op = op;
-    node->as.unary.operand = operand;
+  ExprFrame frame = {kind, min_prec, node, p->scratch.count};
+  stack->items[stack->count++] = frame;
+  return true;
+}
 
-    return node;
+// Drop the partial expression: the operand in hand and every frame's node
+static Node *unwind_exprs(Parser *p, size_t base, Node *operand) {
+  free_node(p->allocator, operand);
+  while (p->exprs.count > base) {
+    ExprFrame *frame = &p->exprs.items[--p->exprs.count];
+    if (frame->kind == EXPR_CALL)
+      close_list(p, frame->base, &frame->node->as.call.args);
+    free_node(p->allocator, frame->node);
   }
+  return NULL;
+}
 
-  if (match(p, TOKEN_HEAP)) {
-    Node *node = make(p, NODE_HEAP);
-    if (!node)
-      return NULL;
+// The operand a prefix token starts, or NULL after pushing the frame that
+// waits for it (or on error)
+static Node *parse_prefix(Parser *p, bool *pushed) {
+  PrefixAction action = (PrefixAction)prefix_rules[p->current.type];
+  if (action == PREFIX_NONE) {
+    error_at_current(p, DIAG_EXPECTED_EXPR);
+    return NULL;
+  }
+  TokenType op = p->current.type;
+  advance(p);
 
-    Node *val = parse_unary(p);
-    node->as.heap.val = val;
+  Node *node;
+  switch (action) {
+  case PREFIX_UNARY:
+  case PREFIX_HEAP:
+    node = make(p, action == PREFIX_HEAP ? NODE_HEAP : NODE_UNARY);
+    if (node && action == PREFIX_UNARY)
+      node->as.unary.op = op;
+    *pushed = node && push_expr(p, EXPR_UNARY, PREC_UNARY, node);
+    return NULL;
+  case PREFIX_GROUP:
+    *pushed = push_expr(p, EXPR_PAREN, PREC_ASSIGN, NULL);
+    return NULL;
+  case PREFIX_INTEGER:
+    node = make(p, NODE_INT_LIT);
+    if (node)
+      node->as.integer.val = p->previous.value.integer;
+    return node;
+  case PREFIX_FLOAT:
+    node = make(p, NODE_FLOAT_LIT);
+    if (node)
+      node->as.floating.val = p->previous.value.floating;
+    return node;
+  case PREFIX_STRING:
+    node = make(p, NODE_STRING_LIT);
+    if (node)
+      node->as.literal.text = prev_text(p);
+    return node;
+  case PREFIX_BOOL:
+    node = make(p, NODE_BOOL_LIT);
+    if (node)
+      node->as.boolean.val = op == TOKEN_TRUE;
     return node;
+  case PREFIX_NULL:
+    return make(p, NODE_NULL_LIT);
+  case PREFIX_IDENT:
+    node = make(p, NODE_IDENT);
+    if (node)
+      node->as.ident.name = prev_text(p);
+    return node;
+  case PREFIX_NONE:
+    break;
   }
-
-  return parse_postfix(p);
+  return NULL;
 }
 
-static Node *parse_postfix(Parser *p) {
-  Node *expr = parse_primary(p);
-  if (!expr)
+static Node *parse_expr(Parser *p) {
+  size_t base = p->exprs.count;
+  if (!push_expr(p, EXPR_ROOT, PREC_ASSIGN, NULL))
     return NULL;
 
+  ExprState state = EXPR_PREFIX;
+  Node *operand = NULL;
   for (;;) {
-    if (match(p, TOKEN_LEFT_PAREN)) {
-      Node *node = make(p, NODE_CALL);
-      if (!node)
-        return NULL;
+    ExprFrame *top = &p->exprs.items[p->exprs.count - 1];
 
-      node->as.call.callee = expr;
-      if (!check(p, TOKEN_RIGHT_PAREN)) {
-        do {
-          Node *arg = parse_expr(p);
-          if (!arg)
-            return NULL;
-          node_list_push(p->allocator, &node->as.call.args, arg);
-        } while (match(p, TOKEN_COMMA));
+    switch (state) {
+    case EXPR_PREFIX: {
+      if (too_deep(p)) {
+        error_at_current(p, DIAG_EXPR_TOO_DEEP);
+        return unwind_exprs(p, base, NULL);
       }
 
-      consume(p, TOKEN_RIGHT_PAREN, "Expected ')' after arguments");
-      expr = node;
-    } else if (match(p, TOKEN_DOT)) {
-      Node *node = make(p, NODE_MEMBER);
-      if (!node)
-        return NULL;
+      bool pushed = false;
+      operand = parse_prefix(p, &pushed);
+      if (pushed)
+        break;
+      if (!operand)
+        return unwind_exprs(p, base, NULL);
+      hash_node(operand);
+      state = EXPR_INFIX;
+      break;
+    }
 
-      consume(p, TOKEN_IDENTIFIER, "Expected property name after '.'.");
-      node->as.member.obj = expr;
-      node->as.member.field = prev_text(p);
-      expr = node;
-    } else if (match(p, TOKEN_LEFT_BRACKET)) {
-      Node *node = make(p, NODE_INDEX);
-      if (!node)
-        return NULL;
+    case EXPR_INFIX: {
+      InfixRule rule = infix_rules[p->current.type];
+      if (rule.action == INFIX_NONE || rule.prec < top->min_prec) {
+        // Nothing binds tighter, so the operand completes the frame on top
+        switch (top->kind) {
+        case EXPR_UNARY:
+          if (top->node->kind == NODE_HEAP)
+            top->node->as.heap.val = operand;
+          else
+            top->node->as.unary.operand = operand;
+          break;
+        case EXPR_BINARY:
+          top->node->as.binary.right = operand;
+          break;
+        case EXPR_ASSIGN:
+          top->node->as.assign.val = operand;
+          break;
+        default:
+          state = EXPR_DONE;
+          continue;
+        }
+        operand = top->node;
+        hash_node(operand);
+        p->exprs.count--;
+        break;
+      }
 
-      Node *idx = parse_expr(p);
-      consume(p, TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
-      node->as.subscript.obj = expr;
-      node->as.subscript.idx = idx;
-      expr = node;
-    } else if (check(p, TOKEN_PLUS_PLUS) || check(p, TOKEN_MINUS_MINUS)) {
       TokenType op = p->current.type;
       advance(p);
-      Node *node = make(p, NODE_POSTFIX);
-      if (!node)
-        return NULL;
-
-      node->as.unary.op = op;
-      node->as.unary.operand = expr;
-      expr = node;
-    } else {
+      Node *node;
+      switch ((InfixAction)rule.action) {
+      case INFIX_BINARY:
+        node = make(p, NODE_BINARY);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        node->as.binary.op = op;
+        node->as.binary.left = operand;
+        operand = NULL;
+        if (!push_expr(p, EXPR_BINARY, rule.prec + !rule.right_assoc, node))
+          return unwind_exprs(p, base, NULL);
+        state = EXPR_PREFIX;
+        break;
+      case INFIX_ASSIGN:
+        node = make(p, NODE_ASSIGN);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        node->as.assign.op = op;
+        node->as.assign.target = operand;
+        operand = NULL;
+        if (!push_expr(p, EXPR_ASSIGN, rule.prec + !rule.right_assoc, node))
+          return unwind_exprs(p, base, NULL);
+        state = EXPR_PREFIX;
+        break;
+      case INFIX_CALL:
+        node = make(p, NODE_CALL);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        node->as.call.callee = operand;
+        operand = node;
+        if (match(p, TOKEN_RIGHT_PAREN)) {
+          hash_node(node);
+          break;
+        }
+        operand = NULL;
+        if (!push_expr(p, EXPR_CALL, PREC_ASSIGN, node))
+          return unwind_exprs(p, base, NULL);
+        state = EXPR_PREFIX;
+        break;
+      case INFIX_MEMBER:
+        node = make(p, NODE_MEMBER);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        consume(p, TOKEN_IDENTIFIER, DIAG_EXPECTED_PROPERTY_NAME);
+        node->as.member.obj = operand;
+        node->as.member.field = prev_text(p);
+        hash_node(node);
+        operand = node;
+        break;
+      case INFIX_INDEX:
+        node = make(p, NODE_INDEX);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        node->as.subscript.obj = operand;
+        operand = NULL;
+        if (!push_expr(p, EXPR_INDEX, PREC_ASSIGN, node))
+          return unwind_exprs(p, base, NULL);
+        state = EXPR_PREFIX;
+        break;
+      case INFIX_POSTFIX:
+        node = make(p, NODE_POSTFIX);
+        if (!node)
+          return unwind_exprs(p, base, operand);
+        node->as.unary.op = op;
+        node->as.unary.operand = operand;
+        hash_node(node);
+        operand = node;
+        break;
+      case INFIX_NONE:
+        break;
+      }
       break;
     }
-  }
 
-  return expr;
-}
-
-static Node *parse_primary(Parser *p) {
-  if (match(p, TOKEN_INTEGER)) {
-    Node *node = make(p, NODE_INT_LIT);
-    if (!node)
-      return NULL;
-    node->as.literal.text = prev_text(p);
-    return node;
-  }
-  if (match(p, TOKEN_FLOAT)) {
-    Node *node = make(p, NODE_FLOAT_LIT);
-    if (!node)
-      return NULL;
-    node->as.literal.text = prev_text(p);
-    return node;
-  }
-  if (match(p, TOKEN_STRING)) {
-    Node *node = make(p, NODE_STRING_LIT);
-    if (!node)
-      return NULL;
-    node->as.literal.text = prev_text(p);
-    return node;
-  }
-  if (match(p, TOKEN_TRUE) || match(p, TOKEN_FALSE)) {
-    Node *node = make(p, NODE_BOOL_LIT);
-    if (!node)
-      return NULL;
-    node->as.boolean.val = (p->previous.type == TOKEN_TRUE);
-    return node;
-  }
-  if (match(p, TOKEN_NULL)) {
-    return make(p, NODE_NULL_LIT);
-  }
-  if (match(p, TOKEN_IDENTIFIER)) {
-    Node *node = make(p, NODE_IDENT);
-    if (!node)
-      return NULL;
-    node->as.ident.name = prev_text(p);
-    return node;
-  }
-  if (match(p, TOKEN_LEFT_PAREN)) {
-    Node *expr = parse_expr(p);
-    consume(p, TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
-    return expr;
+    case EXPR_DONE:
+      switch (top->kind) {
+      case EXPR_ROOT:
+        p->exprs.count--;
+        return operand;
+      case EXPR_PAREN:
+        consume(p, TOKEN_RIGHT_PAREN, DIAG_EXPECTED_PAREN_AFTER_EXPR);
+        p->exprs.count--;
+        break;
+      case EXPR_CALL:
+        list_push(p, operand);
+        operand = NULL;
+        if (match(p, TOKEN_COMMA)) {
+          state = EXPR_PREFIX;
+          continue;
+        }
+        close_list(p, top->base, &top->node->as.call.args);
+        consume(p, TOKEN_RIGHT_PAREN, DIAG_EXPECTED_PAREN_AFTER_ARGS);
+        operand = top->node;
+        hash_node(operand);
+        p->exprs.count--;
+        break;
+      case EXPR_INDEX:
+        consume(p, TOKEN_RIGHT_BRACKET, DIAG_EXPECTED_BRACKET_AFTER_INDEX);
+        top->node->as.subscript.idx = operand;
+        operand = top->node;
+        hash_node(operand);
+        p->exprs.count--;
+        break;
+      case EXPR_UNARY:
+      case EXPR_BINARY:
+      case EXPR_ASSIGN:
+        // completed in EXPR_INFIX before reaching here
+        break;
+      }
+      state = EXPR_INFIX;
+      break;
+    }
   }
-
-  error_at_current(p, "Expected an expression.");
-  return NULL;
 }
 
 /* --------------------------------------------------------------------------
  * Public API
  * -------------------------------------------------------------------------- */
 
-void init_parser(Parser *parser, Lexer *lexer, Allocator *allocator) {
+// Everything but the line index and the first token, which a parallel worker
+// takes from the parser it works for
+static void init_state(Parser *parser, Lexer *lexer, Allocator *allocator) {
   parser->lexer = lexer;
   parser->allocator = allocator;
   parser->had_error = false;
   parser->panic_mode = false;
+  init_diagnostics(&parser->diags, allocator);
+  parser->line_hint = 0;
+  parser->scratch.items = NULL;
+  parser->scratch.count = parser->scratch.cap = 0;
+  parser->max_depth = PARSER_DEFAULT_MAX_DEPTH;
+  parser->lazy_fn_bodies = false;
+  parser->program = NULL;
+  parser->exprs.items = NULL;
+  parser->exprs.count = parser->exprs.cap = 0;
+  parser->stmts.items = NULL;
+  parser->stmts.count = parser->stmts.cap = 0;
+  init_type_table(&parser->own_types);
+  parser->types = &parser->own_types;
   // Zero the tokens so the first advance() can safely "free" previous
   parser->current.type = TOKEN_EOF;
   parser->current.lexeme = NULL;
-  parser->current.line = 0;
+  parser->current.offset = 0;
   parser->previous = parser->current;
+}
+
+void init_parser(Parser *parser, Lexer *lexer, Allocator *allocator) {
+  init_state(parser, lexer, allocator);
+  build_line_index(&parser->lines, lexer->source, allocator);
   advance(parser);
 }
 
+static void free_state(Parser *parser) {
+  free_diagnostics(&parser->diags);
+  free_type_table(parser->allocator, &parser->own_types);
+  free_token_lexeme(parser->allocator, parser->current);
+  free_token_lexeme(parser->allocator, parser->previous);
+  parser->current.lexeme = NULL;
+  parser->previous.lexeme = NULL;
+  if (parser->scratch.items)
+    FREE(parser->allocator, parser->scratch.items,
+         parser->scratch.cap * sizeof(Node *), "NodeList");
+  parser->scratch.items = NULL;
+  parser->scratch.count = parser->scratch.cap = 0;
+  if (parser->exprs.items)
+    FREE(parser->allocator, parser->exprs.items,
+         parser->exprs.cap * sizeof(ExprFrame), "ParserStack");
+  if (parser->stmts.items)
+    FREE(parser->allocator, parser->stmts.items,
+         parser->stmts.cap * sizeof(StmtFrame), "ParserStack");
+  parser->exprs.items = NULL;
+  parser->stmts.items = NULL;
+  parser->exprs.count = parser->exprs.cap = 0;
+  parser->stmts.count = parser->stmts.cap = 0;
+}
+
 Node *parse_program(Parser *parser) {
   Node *program = new_node(parser->allocator, NODE_PROGRAM, 1);
   if (!program)
     return NULL;
 
+  size_t base = open_list(parser);
   while (!check(parser, TOKEN_EOF)) {
+    size_t start = parser->current.offset;
     Node *decl = parse_declaration(parser);
-    node_list_push(parser->allocator, &program->as.program.decls, decl);
+    list_push(parser, decl);
     if (parser->panic_mode)
-      synchronize(parser);
+      recover(parser, start);
   }
-
+  close_list(parser, base, &program->as.program.decls);
+  hash_node(program);
+  parser->program = program;
   return program;
 }
 
-void free_parser(Parser *parser) {
+// Parallel parsing. The source is cut at declaration keywords that sit at
+// brace depth 0, each piece is parsed by its own Parser on its own thread, and
+// the declarations are stitched together in source order. The cut is found by
+// skimming bytes rather than lexing, so it can be wrong in odd cases (broken
+// code, keywords the skim misreads); a worker then sees an error or stops short
+// of its piece's end, and the whole unit is parsed again sequentially. That
+// also keeps diagnostics exactly what parse_program() reports
+
+static bool is_word_byte(unsigned char c) {
+  return (unsigned)((c | 0x20) - 'a') < 26 || (unsigned)(c - '0') < 10 ||
+         c == '_' || c >= 0x80;
+}
+
+static bool opens_decl(const char *word, size_t len) {
+  switch (len) {
+  case 2:
+    return memcmp(word, "fn", 2) == 0;
+  case 3:
+    return memcmp(word, "let", 3) == 0 || memcmp(word, "pub", 3) == 0;
+  case 4:
+    return memcmp(word, "type", 4) == 0;
+  case 5:
+    return memcmp(word, "const", 5) == 0;
+  case 6:
+    return memcmp(word, "import", 6) == 0;
+  default:
+    return false;
+  }
+}
+
+// A pass over the source bytes that finds where top-level declarations start
+// without lexing. It knows just enough of the syntax (comments, strings,
+// braces) to tell a keyword at depth 0 from one nested or quoted
+typedef struct Skim {
+  const char *src;
+  size_t at, end;
+  size_t depth;
+  bool after_pub; // `pub fn` is one declaration, not two
+} Skim;
+
+// Offset of the next declaration keyword at brace depth 0, or `end`
+static size_t next_decl(Skim *s) {
+  const char *src = s->src;
+  while (s->at < s->end) {
+    // Inside braces only what moves the depth matters
+    if (s->depth > 0)
+      s->at += strcspn(src + s->at, "{}\"/");
+    if (s->at >= s->end)
+      break;
+    unsigned char c = (unsigned char)src[s->at];
+    if (c == '/' && src[s->at + 1] == '/') {
+      while (s->at < s->end && src[s->at] != '\n')
+        s->at++;
+    } else if (c == '"') {
+      s->at++;
+      while (s->at < s->end && src[s->at] != '"')
+        s->at++;
+      s->at++;
+      s->after_pub = false;
+    } else if (is_word_byte(c)) {
+      size_t word = s->at;
+      while (s->at < s->end && is_word_byte((unsigned char)src[s->at]))
+        s->at++;
+      size_t len = s->at - word;
+      bool keyword = s->depth == 0 && opens_decl(src + word, len);
+      bool starts = keyword && !s->after_pub;
+      s->after_pub = keyword && len == 3 && memcmp(src + word, "pub", 3) == 0;
+      if (starts)
+        return word;
+    } else {
+      if (c == '{')
+        s->depth++;
+      else if (c == '}' && s->depth > 0)
+        s->depth--;
+      if (!isspace(c))
+        s->after_pub = false;
+      s->at++;
+    }
+  }
+  return s->end;
+}
+
+// Fill `cuts` with up to `pieces` offsets in [from, end) where a piece starts,
+// aiming for pieces of equal size, and return how many there are. cuts[0] is
+// always `from`; cuts[n] is set to `end`
+static size_t cut_pieces(const char *src, size_t from, size_t end,
+                         size_t *cuts, size_t pieces) {
+  Skim skim = {src, from, end, 0, false};
+  size_t n = 0;
+  cuts[n++] = from;
+  size_t target = from + (end - from) / pieces;
+  while (n < pieces) {
+    size_t at = next_decl(&skim);
+    if (at == end)
+      break;
+    if (at > from && at >= target) {
+      cuts[n++] = at;
+      target = from + (end - from) / pieces * n;
+    }
+  }
+  cuts[n] = end;
+  return n;
+}
+
+typedef struct ParsePiece {
+  const Parser *parser; // the one parse_program_parallel() was called with
+  size_t start, end;
+  NodeList decls;
+  bool ok; // parsed cleanly and ended exactly at `end`
+  pthread_t thread;
+  bool threaded;
+} ParsePiece;
+
+// Set `p` up to parse spans of `parent`'s source by itself. It reads the
+// parent's line index and interns into the parent's types; its diagnostics are
+// dropped, the sequential retry records them
+static void init_worker(Parser *p, Lexer *lexer, const Parser *parent) {
+  *lexer = *parent->lexer;
+  init_state(p, lexer, parent->allocator);
+  p->lines = parent->lines; // read-only here; line_hint is per parser
+  p->types = parent->types;
+  p->max_depth = parent->max_depth;
+  p->lazy_fn_bodies = parent->lazy_fn_bodies;
+}
+
+// Parse the declarations in [start, end) into `decls`. True if there were no
+// errors and the last one ended exactly at `end`
+static bool parse_span(Parser *p, size_t start, size_t end, NodeList *decls) {
+  rewind_lexer(p->lexer, start, end - start);
+  free_token_lexeme(p->allocator, p->current);
+  free_token_lexeme(p->allocator, p->previous);
+  p->current.type = TOKEN_EOF;
+  p->current.lexeme = NULL;
+  p->current.offset = start;
+  p->previous = p->current;
+  p->had_error = false;
+  p->panic_mode = false;
+  advance(p);
+
+  size_t base = open_list(p);
+  while (!p->had_error && p->current.offset < end)
+    list_push(p, parse_declaration(p));
+  close_list(p, base, decls);
+  return !p->had_error && p->current.offset == end;
+}
+
+static void *parse_piece(void *arg) {
+  ParsePiece *piece = (ParsePiece *)arg;
+  Lexer lexer;
+  Parser p;
+  init_worker(&p, &lexer, piece->parser);
+  p.types = NULL; // the table isn't thread-safe; types are interned after
+  piece->ok = parse_span(&p, piece->start, piece->end, &piece->decls);
+  free_state(&p);
+  return NULL;
+}
+
+Node *parse_program_parallel(Parser *parser, size_t workers) {
+  if (workers < 2 || parser->had_error)
+    return parse_program(parser);
+
+  const char *src = parser->lexer->source;
+  size_t end = (size_t)(parser->lexer->end - src);
+  size_t *cuts = (size_t *)ALLOC(parser->allocator,
+                                 (workers + 1) * sizeof(size_t), "ParseCuts");
+  ParsePiece *pieces = (ParsePiece *)ALLOC(
+      parser->allocator, workers * sizeof(ParsePiece), "ParsePieces");
+  size_t n = cuts && pieces ? cut_pieces(src, parser->current.offset, end,
+                                         cuts, workers)
+                            : 0;
+
+  if (n < 2)
+    n = 0; // one piece is just parse_program()
+  for (size_t i = 0; i < n; i++) {
+    pieces[i].parser = parser;
+    pieces[i].start = cuts[i];
+    pieces[i].end = cuts[i + 1];
+    pieces[i].threaded = false;
+  }
+  // The first piece runs here; so does any whose thread won't start
+  for (size_t i = 1; i < n; i++)
+    pieces[i].threaded = pthread_create(&pieces[i].thread, NULL, parse_piece,
+                                        &pieces[i]) == 0;
+  if (n > 0)
+    parse_piece(&pieces[0]);
+  for (size_t i = 1; i < n; i++) {
+    if (pieces[i].threaded)
+      pthread_join(pieces[i].thread, NULL);
+    else
+      parse_piece(&pieces[i]);
+  }
+
+  bool ok = n > 0;
+  for (size_t i = 0; i < n; i++)
+    ok = ok && pieces[i].ok;
+
+  Node *program = NULL;
+  if (ok)
+    program = new_node(parser->allocator, NODE_PROGRAM, 1);
+  if (program) {
+    size_t base = open_list(parser);
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < pieces[i].decls.count; j++)
+        list_push(parser, pieces[i].decls.items[j]);
+    close_list(parser, base, &program->as.program.decls);
+    if (parser->types)
+      for (size_t i = 0; i < program->as.program.decls.count; i++)
+        intern_decl_types(parser, program->as.program.decls.items[i]);
+    hash_node(program);
+    parser->program = program;
+    // Leave the parser where parse_program() would: at EOF
+    rewind_lexer(parser->lexer, end, 0);
+    advance(parser);
+  } else {
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < pieces[i].decls.count; j++)
+        free_node(parser->allocator, pieces[i].decls.items[j]);
+  }
+  for (size_t i = 0; i < n; i++)
+    if (pieces[i].decls.items)
+      FREE(parser->allocator, pieces[i].decls.items,
+           pieces[i].decls.cap * sizeof(Node *), "NodeList");
+  if (pieces)
+    FREE(parser->allocator, pieces, workers * sizeof(ParsePiece),
+         "ParsePieces");
+  if (cuts)
+    FREE(parser->allocator, cuts, (workers + 1) * sizeof(size_t), "ParseCuts");
+
+  return program ? program : parse_program(parser);
+}
+
+// Incremental parsing. The source is cut at every top-level declaration the
+// same way the parallel parse cuts it, and each piece is keyed by a hash of
+// its bytes. A piece whose bytes the previous parse also had, checked against
+// a copy of its source, keeps that declaration, moved to its new line; the
+// rest are parsed. Anything that doesn't parse cleanly goes through
+// parse_program() instead, as above
+
+static void push_span(Allocator *a, IncrementalParse *state, DeclSpan span) {
+  if (state->count + 1 > state->cap) {
+    size_t old_cap = state->cap;
+    size_t new_cap = old_cap < 8 ? 8 : old_cap * 2;
+    state->spans = (DeclSpan *)REALLOC(a, state->spans,
+                                       old_cap * sizeof(DeclSpan),
+                                       new_cap * sizeof(DeclSpan), "DeclSpans");
+    state->cap = new_cap;
+  }
+  state->spans[state->count++] = span;
+}
+
+// Finds the previous parse's span with the same bytes as a new one. Most of a
+// file is unchanged, so the span after the last one taken is tried first, and
+// the one after that in case a declaration was deleted; only a miss builds
+// the index by hash
+typedef struct SpanIndex {
+  const char *old_src; // what the old spans point into
+  const char *src;     // and the new ones
+  DeclSpan *old;
+  size_t count;
+  size_t next;   // the old span after the last one taken
+  size_t *slots; // open addressing; a span's index + 1, 0 for empty
+  size_t mask;
+} SpanIndex;
+
+// The hash only narrows the search; reuse needs the bytes to really match
+static bool same_bytes(const SpanIndex *index, const DeclSpan *old,
+                       const DeclSpan *span) {
+  size_t len = span->end - span->start;
+  return old->decl && old->hash == span->hash &&
+         old->end - old->start == len &&
+         memcmp(index->old_src + old->start, index->src + span->start, len) ==
+             0;
+}
+
+static bool build_span_index(Allocator *a, SpanIndex *index) {
+  size_t cap = 16;
+  while (cap < index->count * 2)
+    cap *= 2;
+  index->slots = (size_t *)ALLOC(a, cap * sizeof(size_t), "SpanIndex");
+  if (index->slots == NULL)
+    return false;
+  index->mask = cap - 1;
+  memset(index->slots, 0, cap * sizeof(size_t));
+  for (size_t i = 0; i < index->count; i++) {
+    size_t slot = index->old[i].hash & index->mask;
+    while (index->slots[slot] != 0)
+      slot = (slot + 1) & index->mask;
+    index->slots[slot] = i + 1;
+  }
+  return true;
+}
+
+// The unclaimed old span with the same bytes as `span`, now claimed, or NULL
+static DeclSpan *claim_span(Allocator *a, SpanIndex *index,
+                            const DeclSpan *span) {
+  DeclSpan *found = NULL;
+  for (size_t i = index->next; i < index->count && i < index->next + 2; i++)
+    if (same_bytes(index, &index->old[i], span)) {
+      found = &index->old[i];
+      break;
+    }
+
+  if (found == NULL && index->count > 0 &&
+      (index->slots || build_span_index(a, index))) {
+    for (size_t i = span->hash & index->mask; index->slots[i] != 0;
+         i = (i + 1) & index->mask) {
+      DeclSpan *candidate = &index->old[index->slots[i] - 1];
+      if (same_bytes(index, candidate, span)) {
+        found = candidate;
+        break;
+      }
+    }
+  }
+
+  if (found)
+    index->next = (size_t)(found - index->old) + 1;
+  return found;
+}
+
+static void clear_spans(IncrementalParse *state) {
+  state->program = NULL;
+  state->spans = NULL;
+  state->count = state->cap = 0;
+  state->reused = 0;
+  state->source = NULL;
+  state->source_len = 0;
+}
+
+void init_incremental(IncrementalParse *state) {
+  clear_spans(state);
+  init_type_table(&state->types);
+}
+
+Node *parse_incremental(Parser *parser, IncrementalParse *state) {
+  Allocator *a = parser->allocator;
+  IncrementalParse old = *state;
+  clear_spans(state);
+  parser->types = &state->types;
+  // While there are spans the program's list mirrors them; take it apart so
+  // the declarations can move to the new program one by one
+  if (old.program && old.count > 0)
+    old.program->as.program.decls.count = 0;
+
+  const char *src = parser->lexer->source;
+  SpanIndex index = {old.source, src, old.spans, old.count, 0, NULL, 0};
+  size_t end = (size_t)(parser->lexer->end - src);
+  size_t start = parser->current.offset;
+  Skim skim = {src, start, end, 0, false};
+  Lexer lexer;
+  Parser worker;
+  init_worker(&worker, &lexer, parser);
+
+  bool ok = !parser->had_error;
+  while (ok && start < end) {
+    size_t next = next_decl(&skim);
+    if (next == start)
+      next = next_decl(&skim);
+
+    DeclSpan span = {hash_bytes(src + start, next - start), start, next,
+                     line_of(parser, start), NULL};
+    DeclSpan *from = claim_span(a, &index, &span);
+    if (from) {
+      span.decl = from->decl;
+      from->decl = NULL;
+      if (span.line != from->line)
+        shift_node_lines(a, span.decl, span.line - from->line);
+      Node *decl = span.decl;
+      if (span.start != from->start && decl->kind == NODE_FN &&
+          decl->as.fn.body == NULL) {
+        decl->as.fn.body_start += span.start - from->start;
+        decl->as.fn.body_end += span.start - from->start;
+      }
+      state->reused++;
+    } else {
+      NodeList decls;
+      ok = parse_span(&worker, start, next, &decls) && decls.count == 1;
+      if (ok)
+        span.decl = decls.items[0];
+      else
+        for (size_t i = 0; i < decls.count; i++)
+          free_node(a, decls.items[i]);
+      if (decls.items)
+        FREE(a, decls.items, decls.cap * sizeof(Node *), "NodeList");
+    }
+    if (span.decl)
+      push_span(a, state, span);
+    start = next;
+  }
+  free_state(&worker);
+
+  Node *program = ok ? new_node(a, NODE_PROGRAM, 1) : NULL;
+  if (program) {
+    size_t base = open_list(parser);
+    for (size_t i = 0; i < state->count; i++)
+      list_push(parser, state->spans[i].decl);
+    close_list(parser, base, &program->as.program.decls);
+    hash_node(program);
+    rewind_lexer(parser->lexer, end, 0);
+    advance(parser);
+    // The caller may change or free its source before the next parse
+    state->source = (char *)ALLOC(a, end, "IncrementalSource");
+    if (state->source) {
+      memcpy(state->source, src, end);
+      state->source_len = end;
+    } else {
+      state->count = 0; // nothing to compare a span with, so none is reused
+    }
+  } else {
+    for (size_t i = 0; i < state->count; i++)
+      free_node(a, state->spans[i].decl);
+    state->count = 0;
+    state->reused = 0;
+  }
+
+  for (size_t i = 0; i < old.count; i++)
+    free_node(a, old.spans[i].decl);
+  free_node(a, old.program);
+  if (old.spans)
+    FREE(a, old.spans, old.cap * sizeof(DeclSpan), "DeclSpans");
+  if (old.source)
+    FREE(a, old.source, old.source_len, "IncrementalSource");
+  if (index.slots)
+    FREE(a, index.slots, (index.mask + 1) * sizeof(size_t), "SpanIndex");
+
+  state->program = program ? program : parse_program(parser);
+  parser->program = state->program;
+  sweep_type_table(a, &state->types); // types only the old program used
+  return state->program;
+}
+
+void free_incremental(Allocator *allocator, IncrementalParse *state) {
+  free_node(allocator, state->program);
+  if (state->spans)
+    FREE(allocator, state->spans, state->cap * sizeof(DeclSpan), "DeclSpans");
+  if (state->source)
+    FREE(allocator, state->source, state->source_len, "IncrementalSource");
+  free_type_table(allocator, &state->types);
+  init_incremental(state);
+}
+
+Node *parse_fn_body(Parser *parser, Node *fn) {
+  if (fn == NULL || fn->kind != NODE_FN || fn->as.fn.body != NULL)
+    return fn ? fn->as.fn.body : NULL;
+  if (fn->as.fn.body_end <= fn->as.fn.body_start)
+    return NULL;
+
+  // Parse from a rewound copy of the lexer, with the parser's own tokens set
+  // aside so the caller can keep going afterwards
+  Lexer body_lexer = *parser->lexer;
+  rewind_lexer(&body_lexer, fn->as.fn.body_start,
+               fn->as.fn.body_end - fn->as.fn.body_start);
+
+  Lexer *saved_lexer = parser->lexer;
+  Token saved_current = parser->current;
+  Token saved_previous = parser->previous;
+  bool saved_panic = parser->panic_mode;
+
+  parser->lexer = &body_lexer;
+  parser->panic_mode = false;
+  parser->current.type = TOKEN_EOF;
+  parser->current.lexeme = NULL;
+  parser->current.offset = fn->as.fn.body_start;
+  parser->previous = parser->current;
+  advance(parser);
+  fn->as.fn.body = parse_block(parser);
+  hash_node(fn);
+  // Functions are only ever top-level declarations, so above this one there
+  // is just the program
+  hash_node(parser->program);
+
   free_token_lexeme(parser->allocator, parser->current);
   free_token_lexeme(parser->allocator, parser->previous);
-  parser->current.lexeme = NULL;
-  parser->previous.lexeme = NULL;
+  parser->lexer = saved_lexer;
+  parser->current = saved_current;
+  parser->previous = saved_previous;
+  parser->panic_mode = saved_panic;
+  return fn->as.fn.body;
+}
+
+void free_parser(Parser *parser) {
+  free_state(parser);
+  free_line_index(parser->allocator, &parser->lines);
 }
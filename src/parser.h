@@ -17,15 +17,41 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "allocator.h"
 #include "ast.h"
+#include "diagnostics.h"
 #include "lexer.h"
 
-// Errors are reported as they occur and recorded in `had_error`. After an error
-// the parser enters `panic_mode` and stays quiet until synchronize() finds a
-// safe boundary (a statement/decl start), so one mistake yields one message
-// rather than a cascade
+// Nesting limit for expressions, blocks and types. The parser itself keeps its
+// stacks on the heap and copes with far deeper input, as do walk_ast() and the
+// passes built on it; the limit turns pathological nesting into one clean
+// error. It doesn't bound tree depth: a left-associative chain like a+a+...+a
+// nests one level per operand without ever opening a frame
+#define PARSER_DEFAULT_MAX_DEPTH 10000
+
+// Frames of the explicit stacks behind parse_expr() and parse_block()
+typedef struct ExprFrame ExprFrame;
+typedef struct StmtFrame StmtFrame;
+
+typedef struct ExprStack {
+  ExprFrame *items;
+  size_t count;
+  size_t cap;
+} ExprStack;
+
+typedef struct StmtStack {
+  StmtFrame *items;
+  size_t count;
+  size_t cap;
+} StmtStack;
+
+// Errors are recorded in `diags` as they occur and flagged in `had_error`;
+// printing them is up to the caller. After an error the parser enters
+// `panic_mode` and stays quiet until synchronize() finds a safe boundary (a
+// statement/decl start), so one mistake yields one message rather than a
+// cascade
 typedef struct Parser {
   Lexer *lexer;
   Allocator *allocator;
@@ -33,6 +59,17 @@ typedef struct Parser {
   Token previous;
   bool had_error;
   bool panic_mode;
+  Diagnostics diags; // what went wrong, see render_diagnostics()
+  LineIndex lines; // of lexer->source, gives nodes their line numbers
+  size_t line_hint; // index into `lines` of the last lookup
+  NodeList scratch; // children of the lists still open, see close_list()
+  size_t max_depth; // PARSER_DEFAULT_MAX_DEPTH unless changed after init
+  bool lazy_fn_bodies; // skip fn bodies, see parse_fn_body()
+  Node *program; // the last one returned, which parse_fn_body() rehashes
+  ExprStack exprs;
+  StmtStack stmts;
+  TypeTable own_types;
+  TypeTable *types; // where type nodes are interned: own_types unless shared
 } Parser;
 
 void init_parser(Parser *parser, Lexer *lexer, Allocator *allocator);
@@ -42,4 +79,54 @@ void init_parser(Parser *parser, Lexer *lexer, Allocator *allocator);
 // returned node and must free it with free_node().
 Node *parse_program(Parser *parser);
 
+// Like parse_program(), but the top-level declarations are split between up to
+// `workers` threads and stitched back together in source order. The result and
+// the diagnostics are the same as parse_program()'s: source that doesn't split
+// cleanly, including any with errors, is parsed again sequentially. The
+// parser's allocator is shared by all the threads and must be thread-safe
+// (raw_allocator is)
+Node *parse_program_parallel(Parser *parser, size_t workers);
+
+// A top-level declaration of an incremental parse and the source bytes it was
+// parsed from, up to where the next one starts
+typedef struct DeclSpan {
+  uint64_t hash; // of the bytes in [start, end)
+  size_t start, end;
+  size_t line; // of `start`
+  Node *decl;
+} DeclSpan;
+
+// What parse_incremental() keeps from one version of a source to the next
+typedef struct IncrementalParse {
+  Node *program;
+  DeclSpan *spans; // one per declaration of `program`, empty after an error
+  size_t count;
+  size_t cap;
+  size_t reused; // declarations the last parse carried over unchanged
+  TypeTable types; // kept across parses so reused and new types stay shared
+  char *source; // a copy of the source `spans` point into, to compare against
+  size_t source_len;
+} IncrementalParse;
+
+void init_incremental(IncrementalParse *state);
+
+// Parse the parser's source into a new state->program, taking every
+// top-level declaration whose bytes are the same as one of the previous
+// program's from there instead of parsing it again. Only the edited region is
+// parsed; reused subtrees just get their lines moved. Declarations that weren't
+// reused are freed with the old program. Source with errors is parsed whole by
+// parse_program(), so the result and diagnostics are always the same as a
+// fresh parse's. The state owns the program and the interned types, which
+// the parser uses from then on; see free_incremental()
+Node *parse_incremental(Parser *parser, IncrementalParse *state);
+void free_incremental(Allocator *allocator, IncrementalParse *state);
+
+// Parse the body of a function that was skipped under `lazy_fn_bodies` and
+// attach it to `fn`; returns the body (NULL on error). The parser must not have
+// been freed yet. Errors in the body are recorded now, not during the lazy
+// parse. A function whose body is already there is returned unchanged. `fn`
+// is rehashed with its body, and so is the program the parser returned last,
+// which therefore must not have been freed
+Node *parse_fn_body(Parser *parser, Node *fn);
+
 void free_parser(Parser *parser);
@@ -0,0 +1,443 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "unicode.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Length of the all-ASCII prefix of [s, s + len)
+static size_t ascii_prefix(const unsigned char *s, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(s + i));
+    int high_bits = _mm_movemask_epi8(chunk);
+    if (high_bits != 0)
+      return i + (size_t)__builtin_ctz((unsigned)high_bits);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(s + i)) >= 0x80)
+      break;
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(word));
+    if (word & UINT64_C(0x8080808080808080))
+      break;
+  }
+  while (i < len && s[i] < 0x80)
+    i++;
+  return i;
+}
+
+static bool is_continuation(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+// Length of the well-formed sequence at `s` (no overlongs, surrogates or code
+// points past U+10FFFF), or 0. Bytes are checked in order so a NUL or the end
+// of `avail` stops it before anything further is read
+static size_t sequence_length(const unsigned char *s, size_t avail) {
+  unsigned char c = s[0];
+  if (c < 0x80)
+    return 1;
+  if (c < 0xC2)
+    return 0;
+  if (c < 0xE0)
+    return avail >= 2 && is_continuation(s[1]) ? 2 : 0;
+  if (c < 0xF0) {
+    if (avail < 3 || !is_continuation(s[1]) || !is_continuation(s[2]))
+      return 0;
+    if ((c == 0xE0 && s[1] < 0xA0) || (c == 0xED && s[1] >= 0xA0))
+      return 0;
+    return 3;
+  }
+  if (c < 0xF5) {
+    if (avail < 4 || !is_continuation(s[1]) || !is_continuation(s[2]) ||
+        !is_continuation(s[3]))
+      return 0;
+    if ((c == 0xF0 && s[1] < 0x90) || (c == 0xF4 && s[1] >= 0x90))
+      return 0;
+    return 4;
+  }
+  return 0;
+}
+
+size_t utf8_validate(const char *src, size_t len) {
+  const unsigned char *s = (const unsigned char *)src;
+  size_t i = 0;
+  for (;;) {
+    i += ascii_prefix(s + i, len - i);
+    if (i >= len)
+      return len;
+    size_t n = sequence_length(s + i, len - i);
+    if (n == 0)
+      return i;
+    i += n;
+  }
+}
+
+uint32_t utf8_decode(const char *s, size_t *len) {
+  const unsigned char *u = (const unsigned char *)s;
+  size_t n = sequence_length(u, 4);
+  switch (n) {
+  case 1:
+    *len = 1;
+    return u[0];
+  case 2:
+    *len = 2;
+    return ((uint32_t)(u[0] & 0x1F) << 6) | (u[1] & 0x3F);
+  case 3:
+    *len = 3;
+    return ((uint32_t)(u[0] & 0x0F) << 12) | ((uint32_t)(u[1] & 0x3F) << 6) |
+           (u[2] & 0x3F);
+  case 4:
+    *len = 4;
+    return ((uint32_t)(u[0] & 0x07) << 18) | ((uint32_t)(u[1] & 0x3F) << 12) |
+           ((uint32_t)(u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+  default:
+    *len = 1;
+    return UTF8_INVALID;
+  }
+}
+
+// Identifier classes above ASCII, as (code point << 2) | class where the class
+// holds from that code point up to the next entry: 0 = neither, 1 =
+// XID_Continue only, 3 = XID_Start (which implies XID_Continue). Generated from
+// the Unicode 14.0 character database.
+static const uint32_t xid_ranges[] = {
+    0x00000200, 0x000002ab, 0x000002ac, 0x000002d7, 0x000002d8, 0x000002dd,
+    0x000002e0, 0x000002eb, 0x000002ec, 0x00000303, 0x0000035c, 0x00000363,
+    0x000003dc, 0x000003e3, 0x00000b08, 0x00000b1b, 0x00000b48, 0x00000b83,
+    0x00000b94, 0x00000bb3, 0x00000bb4, 0x00000bbb, 0x00000bbc, 0x00000c01,
+    0x00000dc3, 0x00000dd4, 0x00000ddb, 0x00000de0, 0x00000def, 0x00000df8,
+    0x00000dff, 0x00000e00, 0x00000e1b, 0x00000e1d, 0x00000e23, 0x00000e2c,
+    0x00000e33, 0x00000e34, 0x00000e3b, 0x00000e88, 0x00000e8f, 0x00000fd8,
+    0x00000fdf, 0x00001208, 0x0000120d, 0x00001220, 0x0000122b, 0x000014c0,
+    0x000014c7, 0x0000155c, 0x00001567, 0x00001568, 0x00001583, 0x00001624,
+    0x00001645, 0x000016f8, 0x000016fd, 0x00001700, 0x00001705, 0x0000170c,
+    0x00001711, 0x00001718, 0x0000171d, 0x00001720, 0x00001743, 0x000017ac,
+    0x000017bf, 0x000017cc, 0x00001841, 0x0000186c, 0x00001883, 0x0000192d,
+    0x000019a8, 0x000019bb, 0x000019c1, 0x000019c7, 0x00001b50, 0x00001b57,
+    0x00001b59, 0x00001b74, 0x00001b7d, 0x00001b97, 0x00001b9d, 0x00001ba4,
+    0x00001ba9, 0x00001bbb, 0x00001bc1, 0x00001beb, 0x00001bf4, 0x00001bff,
+    0x00001c00, 0x00001c43, 0x00001c45, 0x00001c4b, 0x00001cc1, 0x00001d2c,
+    0x00001d37, 0x00001e99, 0x00001ec7, 0x00001ec8, 0x00001f01, 0x00001f2b,
+    0x00001fad, 0x00001fd3, 0x00001fd8, 0x00001feb, 0x00001fec, 0x00001ff5,
+    0x00001ff8, 0x00002003, 0x00002059, 0x0000206b, 0x0000206d, 0x00002093,
+    0x00002095, 0x000020a3, 0x000020a5, 0x000020b8, 0x00002103, 0x00002165,
+    0x00002170, 0x00002183, 0x000021ac, 0x000021c3, 0x00002220, 0x00002227,
+    0x0000223c, 0x00002261, 0x00002283, 0x00002329, 0x00002388, 0x0000238d,
+    0x00002413, 0x000024e9, 0x000024f7, 0x000024f9, 0x00002543, 0x00002545,
+    0x00002563, 0x00002589, 0x00002590, 0x00002599, 0x000025c0, 0x000025c7,
+    0x00002605, 0x00002610, 0x00002617, 0x00002634, 0x0000263f, 0x00002644,
+    0x0000264f, 0x000026a4, 0x000026ab, 0x000026c4, 0x000026cb, 0x000026cc,
+    0x000026db, 0x000026e8, 0x000026f1, 0x000026f7, 0x000026f9, 0x00002714,
+    0x0000271d, 0x00002724, 0x0000272d, 0x0000273b, 0x0000273c, 0x0000275d,
+    0x00002760, 0x00002773, 0x00002778, 0x0000277f, 0x00002789, 0x00002790,
+    0x00002799, 0x000027c3, 0x000027c8, 0x000027f3, 0x000027f4, 0x000027f9,
+    0x000027fc, 0x00002805, 0x00002810, 0x00002817, 0x0000282c, 0x0000283f,
+    0x00002844, 0x0000284f, 0x000028a4, 0x000028ab, 0x000028c4, 0x000028cb,
+    0x000028d0, 0x000028d7, 0x000028dc, 0x000028e3, 0x000028e8, 0x000028f1,
+    0x000028f4, 0x000028f9, 0x0000290c, 0x0000291d, 0x00002924, 0x0000292d,
+    0x00002938, 0x00002945, 0x00002948, 0x00002967, 0x00002974, 0x0000297b,
+    0x0000297c, 0x00002999, 0x000029cb, 0x000029d5, 0x000029d8, 0x00002a05,
+    0x00002a10, 0x00002a17, 0x00002a38, 0x00002a3f, 0x00002a48, 0x00002a4f,
+    0x00002aa4, 0x00002aab, 0x00002ac4, 0x00002acb, 0x00002ad0, 0x00002ad7,
+    0x00002ae8, 0x00002af1, 0x00002af7, 0x00002af9, 0x00002b18, 0x00002b1d,
+    0x00002b28, 0x00002b2d, 0x00002b38, 0x00002b43, 0x00002b44, 0x00002b83,
+    0x00002b89, 0x00002b90, 0x00002b99, 0x00002bc0, 0x00002be7, 0x00002be9,
+    0x00002c00, 0x00002c05, 0x00002c10, 0x00002c17, 0x00002c34, 0x00002c3f,
+    0x00002c44, 0x00002c4f, 0x00002ca4, 0x00002cab, 0x00002cc4, 0x00002ccb,
+    0x00002cd0, 0x00002cd7, 0x00002ce8, 0x00002cf1, 0x00002cf7, 0x00002cf9,
+    0x00002d14, 0x00002d1d, 0x00002d24, 0x00002d2d, 0x00002d38, 0x00002d55,
+    0x00002d60, 0x00002d73, 0x00002d78, 0x00002d7f, 0x00002d89, 0x00002d90,
+    0x00002d99, 0x00002dc0, 0x00002dc7, 0x00002dc8, 0x00002e09, 0x00002e0f,
+    0x00002e10, 0x00002e17, 0x00002e2c, 0x00002e3b, 0x00002e44, 0x00002e4b,
+    0x00002e58, 0x00002e67, 0x00002e6c, 0x00002e73, 0x00002e74, 0x00002e7b,
+    0x00002e80, 0x00002e8f, 0x00002e94, 0x00002ea3, 0x00002eac, 0x00002ebb,
+    0x00002ee8, 0x00002ef9, 0x00002f0c, 0x00002f19, 0x00002f24, 0x00002f29,
+    0x00002f38, 0x00002f43, 0x00002f44, 0x00002f5d, 0x00002f60, 0x00002f99,
+    0x00002fc0, 0x00003001, 0x00003017, 0x00003034, 0x0000303b, 0x00003044,
+    0x0000304b, 0x000030a4, 0x000030ab, 0x000030e8, 0x000030f1, 0x000030f7,
+    0x000030f9, 0x00003114, 0x00003119, 0x00003124, 0x00003129, 0x00003138,
+    0x00003155, 0x0000315c, 0x00003163, 0x0000316c, 0x00003177, 0x00003178,
+    0x00003183, 0x00003189, 0x00003190, 0x00003199, 0x000031c0, 0x00003203,
+    0x00003205, 0x00003210, 0x00003217, 0x00003234, 0x0000323b, 0x00003244,
+    0x0000324b, 0x000032a4, 0x000032ab, 0x000032d0, 0x000032d7, 0x000032e8,
+    0x000032f1, 0x000032f7, 0x000032f9, 0x00003314, 0x00003319, 0x00003324,
+    0x00003329, 0x00003338, 0x00003355, 0x0000335c, 0x00003377, 0x0000337c,
+    0x00003383, 0x00003389, 0x00003390, 0x00003399, 0x000033c0, 0x000033c7,
+    0x000033cc, 0x00003401, 0x00003413, 0x00003434, 0x0000343b, 0x00003444,
+    0x0000344b, 0x000034ed, 0x000034f7, 0x000034f9, 0x00003514, 0x00003519,
+    0x00003524, 0x00003529, 0x0000353b, 0x0000353c, 0x00003553, 0x0000355d,
+    0x00003560, 0x0000357f, 0x00003589, 0x00003590, 0x00003599, 0x000035c0,
+    0x000035eb, 0x00003600, 0x00003605, 0x00003610, 0x00003617, 0x0000365c,
+    0x0000366b, 0x000036c8, 0x000036cf, 0x000036f0, 0x000036f7, 0x000036f8,
+    0x00003703, 0x0000371c, 0x00003729, 0x0000372c, 0x0000373d, 0x00003754,
+    0x00003759, 0x0000375c, 0x00003761, 0x00003780, 0x00003799, 0x000037c0,
+    0x000037c9, 0x000037d0, 0x00003807, 0x000038c5, 0x000038cb, 0x000038cd,
+    0x000038ec, 0x00003903, 0x0000391d, 0x0000393c, 0x00003941, 0x00003968,
+    0x00003a07, 0x00003a0c, 0x00003a13, 0x00003a14, 0x00003a1b, 0x00003a2c,
+    0x00003a33, 0x00003a90, 0x00003a97, 0x00003a98, 0x00003a9f, 0x00003ac5,
+    0x00003acb, 0x00003acd, 0x00003af7, 0x00003af8, 0x00003b03, 0x00003b14,
+    0x00003b1b, 0x00003b1c, 0x00003b21, 0x00003b38, 0x00003b41, 0x00003b68,
+    0x00003b73, 0x00003b80, 0x00003c03, 0x00003c04, 0x00003c61, 0x00003c68,
+    0x00003c81, 0x00003ca8, 0x00003cd5, 0x00003cd8, 0x00003cdd, 0x00003ce0,
+    0x00003ce5, 0x00003ce8, 0x00003cf9, 0x00003d03, 0x00003d20, 0x00003d27,
+    0x00003db4, 0x00003dc5, 0x00003e14, 0x00003e19, 0x00003e23, 0x00003e35,
+    0x00003e60, 0x00003e65, 0x00003ef4, 0x00003f19, 0x00003f1c, 0x00004003,
+    0x000040ad, 0x000040ff, 0x00004101, 0x00004128, 0x00004143, 0x00004159,
+    0x0000416b, 0x00004179, 0x00004187, 0x00004189, 0x00004197, 0x0000419d,
+    0x000041bb, 0x000041c5, 0x000041d7, 0x00004209, 0x0000423b, 0x0000423d,
+    0x00004278, 0x00004283, 0x00004318, 0x0000431f, 0x00004320, 0x00004337,
+    0x00004338, 0x00004343, 0x000043ec, 0x000043f3, 0x00004924, 0x0000492b,
+    0x00004938, 0x00004943, 0x0000495c, 0x00004963, 0x00004964, 0x0000496b,
+    0x00004978, 0x00004983, 0x00004a24, 0x00004a2b, 0x00004a38, 0x00004a43,
+    0x00004ac4, 0x00004acb, 0x00004ad8, 0x00004ae3, 0x00004afc, 0x00004b03,
+    0x00004b04, 0x00004b0b, 0x00004b18, 0x00004b23, 0x00004b5c, 0x00004b63,
+    0x00004c44, 0x00004c4b, 0x00004c58, 0x00004c63, 0x00004d6c, 0x00004d75,
+    0x00004d80, 0x00004da5, 0x00004dc8, 0x00004e03, 0x00004e40, 0x00004e83,
+    0x00004fd8, 0x00004fe3, 0x00004ff8, 0x00005007, 0x000059b4, 0x000059bf,
+    0x00005a00, 0x00005a07, 0x00005a6c, 0x00005a83, 0x00005bac, 0x00005bbb,
+    0x00005be4, 0x00005c03, 0x00005c49, 0x00005c58, 0x00005c7f, 0x00005cc9,
+    0x00005cd4, 0x00005d03, 0x00005d49, 0x00005d50, 0x00005d83, 0x00005db4,
+    0x00005dbb, 0x00005dc4, 0x00005dc9, 0x00005dd0, 0x00005e03, 0x00005ed1,
+    0x00005f50, 0x00005f5f, 0x00005f60, 0x00005f73, 0x00005f75, 0x00005f78,
+    0x00005f81, 0x00005fa8, 0x0000602d, 0x00006038, 0x0000603d, 0x00006068,
+    0x00006083, 0x000061e4, 0x00006203, 0x000062a5, 0x000062ab, 0x000062ac,
+    0x000062c3, 0x000063d8, 0x00006403, 0x0000647c, 0x00006481, 0x000064b0,
+    0x000064c1, 0x000064f0, 0x00006519, 0x00006543, 0x000065b8, 0x000065c3,
+    0x000065d4, 0x00006603, 0x000066b0, 0x000066c3, 0x00006728, 0x00006741,
+    0x0000676c, 0x00006803, 0x0000685d, 0x00006870, 0x00006883, 0x00006955,
+    0x0000697c, 0x00006981, 0x000069f4, 0x000069fd, 0x00006a28, 0x00006a41,
+    0x00006a68, 0x00006a9f, 0x00006aa0, 0x00006ac1, 0x00006af8, 0x00006afd,
+    0x00006b3c, 0x00006c01, 0x00006c17, 0x00006cd1, 0x00006d17, 0x00006d34,
+    0x00006d41, 0x00006d68, 0x00006dad, 0x00006dd0, 0x00006e01, 0x00006e0f,
+    0x00006e85, 0x00006ebb, 0x00006ec1, 0x00006eeb, 0x00006f99, 0x00006fd0,
+    0x00007003, 0x00007091, 0x000070e0, 0x00007101, 0x00007128, 0x00007137,
+    0x00007141, 0x0000716b, 0x000071f8, 0x00007203, 0x00007224, 0x00007243,
+    0x000072ec, 0x000072f7, 0x00007300, 0x00007341, 0x0000734c, 0x00007351,
+    0x000073a7, 0x000073b5, 0x000073bb, 0x000073d1, 0x000073d7, 0x000073dd,
+    0x000073eb, 0x000073ec, 0x00007403, 0x00007701, 0x00007803, 0x00007c58,
+    0x00007c63, 0x00007c78, 0x00007c83, 0x00007d18, 0x00007d23, 0x00007d38,
+    0x00007d43, 0x00007d60, 0x00007d67, 0x00007d68, 0x00007d6f, 0x00007d70,
+    0x00007d77, 0x00007d78, 0x00007d7f, 0x00007df8, 0x00007e03, 0x00007ed4,
+    0x00007edb, 0x00007ef4, 0x00007efb, 0x00007efc, 0x00007f0b, 0x00007f14,
+    0x00007f1b, 0x00007f34, 0x00007f43, 0x00007f50, 0x00007f5b, 0x00007f70,
+    0x00007f83, 0x00007fb4, 0x00007fcb, 0x00007fd4, 0x00007fdb, 0x00007ff4,
+    0x000080fd, 0x00008104, 0x00008151, 0x00008154, 0x000081c7, 0x000081c8,
+    0x000081ff, 0x00008200, 0x00008243, 0x00008274, 0x00008341, 0x00008374,
+    0x00008385, 0x00008388, 0x00008395, 0x000083c4, 0x0000840b, 0x0000840c,
+    0x0000841f, 0x00008420, 0x0000842b, 0x00008450, 0x00008457, 0x00008458,
+    0x00008463, 0x00008478, 0x00008493, 0x00008494, 0x0000849b, 0x0000849c,
+    0x000084a3, 0x000084a4, 0x000084ab, 0x000084e8, 0x000084f3, 0x00008500,
+    0x00008517, 0x00008528, 0x0000853b, 0x0000853c, 0x00008583, 0x00008624,
+    0x0000b003, 0x0000b394, 0x0000b3af, 0x0000b3bd, 0x0000b3cb, 0x0000b3d0,
+    0x0000b403, 0x0000b498, 0x0000b49f, 0x0000b4a0, 0x0000b4b7, 0x0000b4b8,
+    0x0000b4c3, 0x0000b5a0, 0x0000b5bf, 0x0000b5c0, 0x0000b5fd, 0x0000b603,
+    0x0000b65c, 0x0000b683, 0x0000b69c, 0x0000b6a3, 0x0000b6bc, 0x0000b6c3,
+    0x0000b6dc, 0x0000b6e3, 0x0000b6fc, 0x0000b703, 0x0000b71c, 0x0000b723,
+    0x0000b73c, 0x0000b743, 0x0000b75c, 0x0000b763, 0x0000b77c, 0x0000b781,
+    0x0000b800, 0x0000c017, 0x0000c020, 0x0000c087, 0x0000c0a9, 0x0000c0c0,
+    0x0000c0c7, 0x0000c0d8, 0x0000c0e3, 0x0000c0f4, 0x0000c107, 0x0000c25c,
+    0x0000c265, 0x0000c26c, 0x0000c277, 0x0000c280, 0x0000c287, 0x0000c3ec,
+    0x0000c3f3, 0x0000c400, 0x0000c417, 0x0000c4c0, 0x0000c4c7, 0x0000c63c,
+    0x0000c683, 0x0000c700, 0x0000c7c3, 0x0000c800, 0x0000d003, 0x00013700,
+    0x00013803, 0x00029234, 0x00029343, 0x000293f8, 0x00029403, 0x00029834,
+    0x00029843, 0x00029881, 0x000298ab, 0x000298b0, 0x00029903, 0x000299bd,
+    0x000299c0, 0x000299d1, 0x000299f8, 0x000299ff, 0x00029a79, 0x00029a83,
+    0x00029bc1, 0x00029bc8, 0x00029c5f, 0x00029c80, 0x00029c8b, 0x00029e24,
+    0x00029e2f, 0x00029f2c, 0x00029f43, 0x00029f48, 0x00029f4f, 0x00029f50,
+    0x00029f57, 0x00029f68, 0x00029fcb, 0x0002a009, 0x0002a00f, 0x0002a019,
+    0x0002a01f, 0x0002a02d, 0x0002a033, 0x0002a08d, 0x0002a0a0, 0x0002a0b1,
+    0x0002a0b4, 0x0002a103, 0x0002a1d0, 0x0002a201, 0x0002a20b, 0x0002a2d1,
+    0x0002a318, 0x0002a341, 0x0002a368, 0x0002a381, 0x0002a3cb, 0x0002a3e0,
+    0x0002a3ef, 0x0002a3f0, 0x0002a3f7, 0x0002a3fd, 0x0002a42b, 0x0002a499,
+    0x0002a4b8, 0x0002a4c3, 0x0002a51d, 0x0002a550, 0x0002a583, 0x0002a5f4,
+    0x0002a601, 0x0002a613, 0x0002a6cd, 0x0002a704, 0x0002a73f, 0x0002a741,
+    0x0002a768, 0x0002a783, 0x0002a795, 0x0002a79b, 0x0002a7c1, 0x0002a7eb,
+    0x0002a7fc, 0x0002a803, 0x0002a8a5, 0x0002a8dc, 0x0002a903, 0x0002a90d,
+    0x0002a913, 0x0002a931, 0x0002a938, 0x0002a941, 0x0002a968, 0x0002a983,
+    0x0002a9dc, 0x0002a9eb, 0x0002a9ed, 0x0002a9fb, 0x0002aac1, 0x0002aac7,
+    0x0002aac9, 0x0002aad7, 0x0002aadd, 0x0002aae7, 0x0002aaf9, 0x0002ab03,
+    0x0002ab05, 0x0002ab0b, 0x0002ab0c, 0x0002ab6f, 0x0002ab78, 0x0002ab83,
+    0x0002abad, 0x0002abc0, 0x0002abcb, 0x0002abd5, 0x0002abdc, 0x0002ac07,
+    0x0002ac1c, 0x0002ac27, 0x0002ac3c, 0x0002ac47, 0x0002ac5c, 0x0002ac83,
+    0x0002ac9c, 0x0002aca3, 0x0002acbc, 0x0002acc3, 0x0002ad6c, 0x0002ad73,
+    0x0002ada8, 0x0002adc3, 0x0002af8d, 0x0002afac, 0x0002afb1, 0x0002afb8,
+    0x0002afc1, 0x0002afe8, 0x0002b003, 0x00035e90, 0x00035ec3, 0x00035f1c,
+    0x00035f2f, 0x00035ff0, 0x0003e403, 0x0003e9b8, 0x0003e9c3, 0x0003eb68,
+    0x0003ec03, 0x0003ec1c, 0x0003ec4f, 0x0003ec60, 0x0003ec77, 0x0003ec79,
+    0x0003ec7f, 0x0003eca4, 0x0003ecab, 0x0003ecdc, 0x0003ece3, 0x0003ecf4,
+    0x0003ecfb, 0x0003ecfc, 0x0003ed03, 0x0003ed08, 0x0003ed0f, 0x0003ed14,
+    0x0003ed1b, 0x0003eec8, 0x0003ef4f, 0x0003f178, 0x0003f193, 0x0003f4f8,
+    0x0003f543, 0x0003f640, 0x0003f64b, 0x0003f720, 0x0003f7c3, 0x0003f7e8,
+    0x0003f801, 0x0003f840, 0x0003f881, 0x0003f8c0, 0x0003f8cd, 0x0003f8d4,
+    0x0003f935, 0x0003f940, 0x0003f9c7, 0x0003f9c8, 0x0003f9cf, 0x0003f9d0,
+    0x0003f9df, 0x0003f9e0, 0x0003f9e7, 0x0003f9e8, 0x0003f9ef, 0x0003f9f0,
+    0x0003f9f7, 0x0003f9f8, 0x0003f9ff, 0x0003fbf4, 0x0003fc41, 0x0003fc68,
+    0x0003fc87, 0x0003fcec, 0x0003fcfd, 0x0003fd00, 0x0003fd07, 0x0003fd6c,
+    0x0003fd9b, 0x0003fe79, 0x0003fe83, 0x0003fefc, 0x0003ff0b, 0x0003ff20,
+    0x0003ff2b, 0x0003ff40, 0x0003ff4b, 0x0003ff60, 0x0003ff6b, 0x0003ff74,
+    0x00040003, 0x00040030, 0x00040037, 0x0004009c, 0x000400a3, 0x000400ec,
+    0x000400f3, 0x000400f8, 0x000400ff, 0x00040138, 0x00040143, 0x00040178,
+    0x00040203, 0x000403ec, 0x00040503, 0x000405d4, 0x000407f5, 0x000407f8,
+    0x00040a03, 0x00040a74, 0x00040a83, 0x00040b44, 0x00040b81, 0x00040b84,
+    0x00040c03, 0x00040c80, 0x00040cb7, 0x00040d2c, 0x00040d43, 0x00040dd9,
+    0x00040dec, 0x00040e03, 0x00040e78, 0x00040e83, 0x00040f10, 0x00040f23,
+    0x00040f40, 0x00040f47, 0x00040f58, 0x00041003, 0x00041278, 0x00041281,
+    0x000412a8, 0x000412c3, 0x00041350, 0x00041363, 0x000413f0, 0x00041403,
+    0x000414a0, 0x000414c3, 0x00041590, 0x000415c3, 0x000415ec, 0x000415f3,
+    0x0004162c, 0x00041633, 0x0004164c, 0x00041653, 0x00041658, 0x0004165f,
+    0x00041688, 0x0004168f, 0x000416c8, 0x000416cf, 0x000416e8, 0x000416ef,
+    0x000416f4, 0x00041803, 0x00041cdc, 0x00041d03, 0x00041d58, 0x00041d83,
+    0x00041da0, 0x00041e03, 0x00041e18, 0x00041e1f, 0x00041ec4, 0x00041ecb,
+    0x00041eec, 0x00042003, 0x00042018, 0x00042023, 0x00042024, 0x0004202b,
+    0x000420d8, 0x000420df, 0x000420e4, 0x000420f3, 0x000420f4, 0x000420ff,
+    0x00042158, 0x00042183, 0x000421dc, 0x00042203, 0x0004227c, 0x00042383,
+    0x000423cc, 0x000423d3, 0x000423d8, 0x00042403, 0x00042458, 0x00042483,
+    0x000424e8, 0x00042603, 0x000426e0, 0x000426fb, 0x00042700, 0x00042803,
+    0x00042805, 0x00042810, 0x00042815, 0x0004281c, 0x00042831, 0x00042843,
+    0x00042850, 0x00042857, 0x00042860, 0x00042867, 0x000428d8, 0x000428e1,
+    0x000428ec, 0x000428fd, 0x00042900, 0x00042983, 0x000429f4, 0x00042a03,
+    0x00042a74, 0x00042b03, 0x00042b20, 0x00042b27, 0x00042b95, 0x00042b9c,
+    0x00042c03, 0x00042cd8, 0x00042d03, 0x00042d58, 0x00042d83, 0x00042dcc,
+    0x00042e03, 0x00042e48, 0x00043003, 0x00043124, 0x00043203, 0x000432cc,
+    0x00043303, 0x000433cc, 0x00043403, 0x00043491, 0x000434a0, 0x000434c1,
+    0x000434e8, 0x00043a03, 0x00043aa8, 0x00043aad, 0x00043ab4, 0x00043ac3,
+    0x00043ac8, 0x00043c03, 0x00043c74, 0x00043c9f, 0x00043ca0, 0x00043cc3,
+    0x00043d19, 0x00043d44, 0x00043dc3, 0x00043e09, 0x00043e18, 0x00043ec3,
+    0x00043f14, 0x00043f83, 0x00043fdc, 0x00044001, 0x0004400f, 0x000440e1,
+    0x0004411c, 0x00044199, 0x000441c7, 0x000441cd, 0x000441d7, 0x000441d8,
+    0x000441fd, 0x0004420f, 0x000442c1, 0x000442ec, 0x00044309, 0x0004430c,
+    0x00044343, 0x000443a4, 0x000443c1, 0x000443e8, 0x00044401, 0x0004440f,
+    0x0004449d, 0x000444d4, 0x000444d9, 0x00044500, 0x00044513, 0x00044515,
+    0x0004451f, 0x00044520, 0x00044543, 0x000445cd, 0x000445d0, 0x000445db,
+    0x000445dc, 0x00044601, 0x0004460f, 0x000446cd, 0x00044707, 0x00044714,
+    0x00044725, 0x00044734, 0x00044739, 0x0004476b, 0x0004476c, 0x00044773,
+    0x00044774, 0x00044803, 0x00044848, 0x0004484f, 0x000448b1, 0x000448e0,
+    0x000448f9, 0x000448fc, 0x00044a03, 0x00044a1c, 0x00044a23, 0x00044a24,
+    0x00044a2b, 0x00044a38, 0x00044a3f, 0x00044a78, 0x00044a7f, 0x00044aa4,
+    0x00044ac3, 0x00044b7d, 0x00044bac, 0x00044bc1, 0x00044be8, 0x00044c01,
+    0x00044c10, 0x00044c17, 0x00044c34, 0x00044c3f, 0x00044c44, 0x00044c4f,
+    0x00044ca4, 0x00044cab, 0x00044cc4, 0x00044ccb, 0x00044cd0, 0x00044cd7,
+    0x00044ce8, 0x00044ced, 0x00044cf7, 0x00044cf9, 0x00044d14, 0x00044d1d,
+    0x00044d24, 0x00044d2d, 0x00044d38, 0x00044d43, 0x00044d44, 0x00044d5d,
+    0x00044d60, 0x00044d77, 0x00044d89, 0x00044d90, 0x00044d99, 0x00044db4,
+    0x00044dc1, 0x00044dd4, 0x00045003, 0x000450d5, 0x0004511f, 0x0004512c,
+    0x00045141, 0x00045168, 0x00045179, 0x0004517f, 0x00045188, 0x00045203,
+    0x000452c1, 0x00045313, 0x00045318, 0x0004531f, 0x00045320, 0x00045341,
+    0x00045368, 0x00045603, 0x000456bd, 0x000456d8, 0x000456e1, 0x00045704,
+    0x00045763, 0x00045771, 0x00045778, 0x00045803, 0x000458c1, 0x00045904,
+    0x00045913, 0x00045914, 0x00045941, 0x00045968, 0x00045a03, 0x00045aad,
+    0x00045ae3, 0x00045ae4, 0x00045b01, 0x00045b28, 0x00045c03, 0x00045c6c,
+    0x00045c75, 0x00045cb0, 0x00045cc1, 0x00045ce8, 0x00045d03, 0x00045d1c,
+    0x00046003, 0x000460b1, 0x000460ec, 0x00046283, 0x00046381, 0x000463a8,
+    0x000463ff, 0x0004641c, 0x00046427, 0x00046428, 0x00046433, 0x00046450,
+    0x00046457, 0x0004645c, 0x00046463, 0x000464c1, 0x000464d8, 0x000464dd,
+    0x000464e4, 0x000464ed, 0x000464ff, 0x00046501, 0x00046507, 0x00046509,
+    0x00046510, 0x00046541, 0x00046568, 0x00046683, 0x000466a0, 0x000466ab,
+    0x00046745, 0x00046760, 0x00046769, 0x00046787, 0x00046788, 0x0004678f,
+    0x00046791, 0x00046794, 0x00046803, 0x00046805, 0x0004682f, 0x000468cd,
+    0x000468eb, 0x000468ed, 0x000468fc, 0x0004691d, 0x00046920, 0x00046943,
+    0x00046945, 0x00046973, 0x00046a29, 0x00046a68, 0x00046a77, 0x00046a78,
+    0x00046ac3, 0x00046be4, 0x00047003, 0x00047024, 0x0004702b, 0x000470bd,
+    0x000470dc, 0x000470e1, 0x00047103, 0x00047104, 0x00047141, 0x00047168,
+    0x000471cb, 0x00047240, 0x00047249, 0x000472a0, 0x000472a5, 0x000472dc,
+    0x00047403, 0x0004741c, 0x00047423, 0x00047428, 0x0004742f, 0x000474c5,
+    0x000474dc, 0x000474e9, 0x000474ec, 0x000474f1, 0x000474f8, 0x000474fd,
+    0x0004751b, 0x0004751d, 0x00047520, 0x00047541, 0x00047568, 0x00047583,
+    0x00047598, 0x0004759f, 0x000475a4, 0x000475ab, 0x00047629, 0x0004763c,
+    0x00047641, 0x00047648, 0x0004764d, 0x00047663, 0x00047664, 0x00047681,
+    0x000476a8, 0x00047b83, 0x00047bcd, 0x00047bdc, 0x00047ec3, 0x00047ec4,
+    0x00048003, 0x00048e68, 0x00049003, 0x000491bc, 0x00049203, 0x00049510,
+    0x0004be43, 0x0004bfc4, 0x0004c003, 0x0004d0bc, 0x00051003, 0x0005191c,
+    0x0005a003, 0x0005a8e4, 0x0005a903, 0x0005a97c, 0x0005a981, 0x0005a9a8,
+    0x0005a9c3, 0x0005aafc, 0x0005ab01, 0x0005ab28, 0x0005ab43, 0x0005abb8,
+    0x0005abc1, 0x0005abd4, 0x0005ac03, 0x0005acc1, 0x0005acdc, 0x0005ad03,
+    0x0005ad10, 0x0005ad41, 0x0005ad68, 0x0005ad8f, 0x0005ade0, 0x0005adf7,
+    0x0005ae40, 0x0005b903, 0x0005ba00, 0x0005bc03, 0x0005bd2c, 0x0005bd3d,
+    0x0005bd43, 0x0005bd45, 0x0005be20, 0x0005be3d, 0x0005be4f, 0x0005be80,
+    0x0005bf83, 0x0005bf88, 0x0005bf8f, 0x0005bf91, 0x0005bf94, 0x0005bfc1,
+    0x0005bfc8, 0x0005c003, 0x00061fe0, 0x00062003, 0x00063358, 0x00063403,
+    0x00063424, 0x0006bfc3, 0x0006bfd0, 0x0006bfd7, 0x0006bff0, 0x0006bff7,
+    0x0006bffc, 0x0006c003, 0x0006c48c, 0x0006c543, 0x0006c54c, 0x0006c593,
+    0x0006c5a0, 0x0006c5c3, 0x0006cbf0, 0x0006f003, 0x0006f1ac, 0x0006f1c3,
+    0x0006f1f4, 0x0006f203, 0x0006f224, 0x0006f243, 0x0006f268, 0x0006f275,
+    0x0006f27c, 0x00073c01, 0x00073cb8, 0x00073cc1, 0x00073d1c, 0x00074595,
+    0x000745a8, 0x000745b5, 0x000745cc, 0x000745ed, 0x0007460c, 0x00074615,
+    0x00074630, 0x000746a9, 0x000746b8, 0x00074909, 0x00074914, 0x00075003,
+    0x00075154, 0x0007515b, 0x00075274, 0x0007527b, 0x00075280, 0x0007528b,
+    0x0007528c, 0x00075297, 0x0007529c, 0x000752a7, 0x000752b4, 0x000752bb,
+    0x000752e8, 0x000752ef, 0x000752f0, 0x000752f7, 0x00075310, 0x00075317,
+    0x00075418, 0x0007541f, 0x0007542c, 0x00075437, 0x00075454, 0x0007545b,
+    0x00075474, 0x0007547b, 0x000754e8, 0x000754ef, 0x000754fc, 0x00075503,
+    0x00075514, 0x0007551b, 0x0007551c, 0x0007552b, 0x00075544, 0x0007554b,
+    0x00075a98, 0x00075aa3, 0x00075b04, 0x00075b0b, 0x00075b6c, 0x00075b73,
+    0x00075bec, 0x00075bf3, 0x00075c54, 0x00075c5b, 0x00075cd4, 0x00075cdb,
+    0x00075d3c, 0x00075d43, 0x00075dbc, 0x00075dc3, 0x00075e24, 0x00075e2b,
+    0x00075ea4, 0x00075eab, 0x00075f0c, 0x00075f13, 0x00075f30, 0x00075f39,
+    0x00076000, 0x00076801, 0x000768dc, 0x000768ed, 0x000769b4, 0x000769d5,
+    0x000769d8, 0x00076a11, 0x00076a14, 0x00076a6d, 0x00076a80, 0x00076a85,
+    0x00076ac0, 0x00077c03, 0x00077c7c, 0x00078001, 0x0007801c, 0x00078021,
+    0x00078064, 0x0007806d, 0x00078088, 0x0007808d, 0x00078094, 0x00078099,
+    0x000780ac, 0x00078403, 0x000784b4, 0x000784c1, 0x000784df, 0x000784f8,
+    0x00078501, 0x00078528, 0x0007853b, 0x0007853c, 0x00078a43, 0x00078ab9,
+    0x00078abc, 0x00078b03, 0x00078bb1, 0x00078be8, 0x00079f83, 0x00079f9c,
+    0x00079fa3, 0x00079fb0, 0x00079fb7, 0x00079fbc, 0x00079fc3, 0x00079ffc,
+    0x0007a003, 0x0007a314, 0x0007a341, 0x0007a35c, 0x0007a403, 0x0007a511,
+    0x0007a52f, 0x0007a530, 0x0007a541, 0x0007a568, 0x0007b803, 0x0007b810,
+    0x0007b817, 0x0007b880, 0x0007b887, 0x0007b88c, 0x0007b893, 0x0007b894,
+    0x0007b89f, 0x0007b8a0, 0x0007b8a7, 0x0007b8cc, 0x0007b8d3, 0x0007b8e0,
+    0x0007b8e7, 0x0007b8e8, 0x0007b8ef, 0x0007b8f0, 0x0007b90b, 0x0007b90c,
+    0x0007b91f, 0x0007b920, 0x0007b927, 0x0007b928, 0x0007b92f, 0x0007b930,
+    0x0007b937, 0x0007b940, 0x0007b947, 0x0007b94c, 0x0007b953, 0x0007b954,
+    0x0007b95f, 0x0007b960, 0x0007b967, 0x0007b968, 0x0007b96f, 0x0007b970,
+    0x0007b977, 0x0007b978, 0x0007b97f, 0x0007b980, 0x0007b987, 0x0007b98c,
+    0x0007b993, 0x0007b994, 0x0007b99f, 0x0007b9ac, 0x0007b9b3, 0x0007b9cc,
+    0x0007b9d3, 0x0007b9e0, 0x0007b9e7, 0x0007b9f4, 0x0007b9fb, 0x0007b9fc,
+    0x0007ba03, 0x0007ba28, 0x0007ba2f, 0x0007ba70, 0x0007ba87, 0x0007ba90,
+    0x0007ba97, 0x0007baa8, 0x0007baaf, 0x0007baf0, 0x0007efc1, 0x0007efe8,
+    0x00080003, 0x000a9b80, 0x000a9c03, 0x000adce4, 0x000add03, 0x000ae078,
+    0x000ae083, 0x000b3a88, 0x000b3ac3, 0x000baf84, 0x000be003, 0x000be878,
+    0x000c0003, 0x000c4d2c, 0x00380401, 0x003807c0,
+};
+
+static unsigned xid_class(uint32_t cp) {
+  size_t lo = 0, hi = sizeof(xid_ranges) / sizeof(xid_ranges[0]);
+  if (cp < (xid_ranges[0] >> 2))
+    return 0;
+  // The last entry starting at or before `cp`
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if ((xid_ranges[mid] >> 2) <= cp)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return xid_ranges[lo] & 3;
+}
+
+bool unicode_is_xid_start(uint32_t cp) { return xid_class(cp) == 3; }
+
+bool unicode_is_xid_continue(uint32_t cp) { return xid_class(cp) != 0; }
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2026 Nobuharu Shimazu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTF8_INVALID 0xFFFFFFFFu
+
+// Offset of the first byte of [src, src + len) that isn't part of well-formed
+// UTF-8, or `len` when all of it is. Runs of ASCII are skipped 16 bytes at a
+// time with SSE2/NEON where available, 8 at a time otherwise
+size_t utf8_validate(const char *src, size_t len);
+
+// Decode the sequence at `s`, storing its length in `len`. Malformed input
+// yields UTF8_INVALID with a length of 1. Never reads past a NUL.
+uint32_t utf8_decode(const char *s, size_t *len);
+
+// Unicode identifier classes (UAX #31) for code points >= 0x80
+bool unicode_is_xid_start(uint32_t cp);
+bool unicode_is_xid_continue(uint32_t cp);
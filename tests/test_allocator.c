@@ -17,6 +17,8 @@
 #include "src/allocator.h"
 #include "test.h"
 
+#include <stdint.h>
+
 TEST(raw_allocator_alloc) {
   int64_t *ptr = ALLOC(&raw_allocator, sizeof(int64_t), "test");
   ASSERT_NOT_NULL(ptr);
@@ -54,11 +56,52 @@ TEST(tracing_allocator) {
   return true;
 }
 
+TEST(tracing_allocator_realloc) {
+  LogSink sink = {console_log, NULL};
+  TracingContext ctx = {0};
+  ctx.sink = &sink;
+  Allocator tracing_allocator = {tracing_alloc, tracing_realloc, tracing_free,
+                                 &ctx};
+  char *ptr = ALLOC(&tracing_allocator, 4, "string");
+  memcpy(ptr, "dud", 4);
+  ptr = REALLOC(&tracing_allocator, ptr, 4, 16, "string");
+  ASSERT_NOT_NULL(ptr);
+  ASSERT_STR_EQ(ptr, "dud");
+  FREE(&tracing_allocator, ptr, 16, "string");
+
+  ASSERT_NULL(ctx.head);
+  ASSERT_EQ(ctx.allocated, 4 + 16);
+  ASSERT_EQ(ctx.freed, 4 + 16);
+  return true;
+}
+
+TEST(counting_allocator) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  char *a = ALLOC(&counting, 16, "a");
+  char *b = ALLOC(&counting, 32, "b");
+  a = REALLOC(&counting, a, 16, 64, "a");
+  ASSERT_NOT_NULL(a);
+  ASSERT_EQ(ctx.peak, 96);
+  FREE(&counting, a, 64, "a");
+  FREE(&counting, b, 32, "b");
+
+  ASSERT_EQ(ctx.allocations, 3);
+  ASSERT_EQ(ctx.frees, 3);
+  ASSERT_EQ(ctx.allocated, 16 + 32 + 64);
+  ASSERT_EQ(ctx.allocated, ctx.freed);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
 int main(void) {
   TEST_SUITE("Allocator");
   RUN_TEST(raw_allocator_alloc);
   RUN_TEST(raw_allocator_realloc);
   RUN_TEST(tracing_allocator);
+  RUN_TEST(tracing_allocator_realloc);
+  RUN_TEST(counting_allocator);
 
   TEST_SUMMARY();
   return TEST_EXIT_CODE();
@@ -15,8 +15,10 @@
  */
 
 #include "src/lexer.h"
+#include "src/unicode.h"
 #include "test.h"
 
+#include <stdint.h>
 #include <string.h>
 
 static bool scan_single(const char *src, TokenType expected_type,
@@ -126,6 +128,49 @@ TEST(arithmetic_rem) { return scan_single("%", TOKEN_REM, NULL); }
 
 TEST(arithmetic_rem_equal) { return scan_single("%=", TOKEN_REM_EQUAL, NULL); }
 
+/* --------------------------------------------------------------------------
+ * Maximal munch
+ * -------------------------------------------------------------------------- */
+
+static bool scan_types(const char *src, const TokenType *expected, size_t n) {
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+  for (size_t i = 0; i < n; i++) {
+    Token tok = scan_token(&lexer);
+    free_token_lexeme(&raw_allocator, tok);
+    ASSERT_EQ(tok.type, expected[i]);
+  }
+  return true;
+}
+
+TEST(munch_plus_plus_plus) {
+  TokenType want[] = {TOKEN_PLUS_PLUS, TOKEN_PLUS, TOKEN_EOF};
+  return scan_types("+++", want, 3);
+}
+
+TEST(munch_bang_equal_equal) {
+  TokenType want[] = {TOKEN_BANG_EQUAL, TOKEN_EQUAL, TOKEN_EOF};
+  return scan_types("!==", want, 3);
+}
+
+TEST(munch_no_pair_falls_back) {
+  TokenType want[] = {TOKEN_EQUAL, TOKEN_GREATER, TOKEN_MINUS, TOKEN_GREATER,
+                      TOKEN_LESS,  TOKEN_LESS,    TOKEN_EOF};
+  return scan_types("=>-><<", want, 7);
+}
+
+TEST(munch_operator_before_identifier) {
+  TokenType want[] = {TOKEN_MINUS, TOKEN_IDENTIFIER, TOKEN_DOT,
+                      TOKEN_IDENTIFIER, TOKEN_EOF};
+  return scan_types("-a.b", want, 5);
+}
+
+TEST(munch_reserved_operator_bytes) {
+  if (!scan_single("&", TOKEN_ERROR, "Unexpected character '&'."))
+    return false;
+  return scan_single("|", TOKEN_ERROR, "Unexpected character '|'.");
+}
+
 /* --------------------------------------------------------------------------
  * Identifiers
  * -------------------------------------------------------------------------- */
@@ -216,6 +261,108 @@ TEST(float_long_fractional) {
   return scan_single("1.23456", TOKEN_FLOAT, "1.23456");
 }
 
+/* --------------------------------------------------------------------------
+ * Numbers — decoded values
+ * -------------------------------------------------------------------------- */
+
+static bool scan_integer(const char *src, uint64_t expected) {
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+
+  Token tok = scan_token(&lexer);
+  ASSERT_EQ(tok.type, TOKEN_INTEGER);
+  ASSERT_EQ(tok.value.integer, expected);
+  free_token_lexeme(&raw_allocator, tok);
+
+  Token eof = scan_token(&lexer);
+  ASSERT_EQ(eof.type, TOKEN_EOF);
+  return true;
+}
+
+static bool scan_float(const char *src, double expected) {
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+
+  Token tok = scan_token(&lexer);
+  ASSERT_EQ(tok.type, TOKEN_FLOAT);
+  ASSERT(tok.value.floating == expected, "float value should round exactly");
+  free_token_lexeme(&raw_allocator, tok);
+  return true;
+}
+
+// The whole of `src` is one error token
+static bool scan_number_error(const char *src) {
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+
+  Token tok = scan_token(&lexer);
+  ASSERT_EQ(tok.type, TOKEN_ERROR);
+  ASSERT_EQ(tok.length, strlen(src));
+  free_token_lexeme(&raw_allocator, tok);
+
+  Token eof = scan_token(&lexer);
+  ASSERT_EQ(eof.type, TOKEN_EOF);
+  return true;
+}
+
+TEST(integer_value_decimal) { return scan_integer("1000000", 1000000); }
+TEST(integer_value_separators) { return scan_integer("1_000_000", 1000000); }
+TEST(integer_value_hex) { return scan_integer("0xFF_ff", 0xFFFF); }
+TEST(integer_value_octal) { return scan_integer("0o755", 0755); }
+TEST(integer_value_binary) { return scan_integer("0b1010_1010", 0xAA); }
+
+TEST(integer_value_max) {
+  return scan_integer("18446744073709551615", UINT64_MAX);
+}
+
+TEST(integer_overflow_is_error) {
+  if (!scan_number_error("18446744073709551616"))
+    return false;
+  return scan_number_error("0x1_0000_0000_0000_0000");
+}
+
+TEST(integer_prefix_without_digits_is_error) {
+  return scan_number_error("0x");
+}
+
+TEST(integer_trailing_separator_is_error) { return scan_number_error("12_"); }
+
+TEST(integer_digit_outside_base_is_error) {
+  if (!scan_number_error("0b12"))
+    return false;
+  if (!scan_number_error("0o78"))
+    return false;
+  if (!scan_number_error("0x1fg"))
+    return false;
+  if (!scan_number_error("0x1.5"))
+    return false;
+  return scan_number_error("0b1.0");
+}
+
+TEST(separator_between_digits_only) {
+  if (!scan_number_error("1_.5"))
+    return false;
+  if (!scan_number_error("1__2"))
+    return false;
+  if (!scan_number_error("0x_1"))
+    return false;
+  return scan_number_error("1.5_");
+}
+
+TEST(float_value_fast_path) {
+  if (!scan_float("3.14", 3.14))
+    return false;
+  return scan_float("1_000.5", 1000.5);
+}
+
+TEST(float_value_slow_path) {
+  // Too many digits for an exact mantissa; falls back to strtod
+  if (!scan_float("0.1000000000000000055511151231257827", 0.1))
+    return false;
+  return scan_float("123456789012345678901234567890.5",
+                    123456789012345678901234567890.5);
+}
+
 /* --------------------------------------------------------------------------
  * Numbers — error cases
  * -------------------------------------------------------------------------- */
@@ -262,61 +409,92 @@ TEST(string_unterminated) {
  * Line tracking
  * -------------------------------------------------------------------------- */
 
+// Line of the next token, through a LineIndex over the same source
+static size_t next_token_line(Lexer *lexer, const LineIndex *index) {
+  Token tok = scan_token(lexer);
+  free_token_lexeme(&raw_allocator, tok);
+  return line_index_lookup(index, tok.offset).line;
+}
+
 TEST(line_starts_at_one) {
+  const char *src = "x";
   Lexer lexer;
-  init_lexer(&lexer, "x", &raw_allocator);
+  LineIndex index;
+  init_lexer(&lexer, src, &raw_allocator);
+  build_line_index(&index, src, &raw_allocator);
 
-  Token tok = scan_token(&lexer);
-  ASSERT_EQ(tok.line, 1);
-  free_token_lexeme(&raw_allocator, tok);
+  ASSERT_EQ(next_token_line(&lexer, &index), 1);
 
+  free_line_index(&raw_allocator, &index);
   return true;
 }
 
 TEST(line_increments_on_newline) {
+  const char *src = "a\nb";
   Lexer lexer;
-  init_lexer(&lexer, "a\nb", &raw_allocator);
-
-  Token t1 = scan_token(&lexer);
-  ASSERT_EQ(t1.line, 1);
-  free_token_lexeme(&raw_allocator, t1);
+  LineIndex index;
+  init_lexer(&lexer, src, &raw_allocator);
+  build_line_index(&index, src, &raw_allocator);
 
-  Token t2 = scan_token(&lexer);
-  ASSERT_EQ(t2.line, 2);
-  free_token_lexeme(&raw_allocator, t2);
+  ASSERT_EQ(next_token_line(&lexer, &index), 1);
+  ASSERT_EQ(next_token_line(&lexer, &index), 2);
 
+  free_line_index(&raw_allocator, &index);
   return true;
 }
 
 TEST(line_multiple_newlines) {
+  const char *src = "a\n\n\nb";
   Lexer lexer;
-  init_lexer(&lexer, "a\n\n\nb", &raw_allocator);
-
-  Token t1 = scan_token(&lexer);
-  ASSERT_EQ(t1.line, 1);
-  free_token_lexeme(&raw_allocator, t1);
+  LineIndex index;
+  init_lexer(&lexer, src, &raw_allocator);
+  build_line_index(&index, src, &raw_allocator);
 
-  Token t2 = scan_token(&lexer);
-  ASSERT_EQ(t2.line, 4);
-  free_token_lexeme(&raw_allocator, t2);
+  ASSERT_EQ(next_token_line(&lexer, &index), 1);
+  ASSERT_EQ(next_token_line(&lexer, &index), 4);
 
+  free_line_index(&raw_allocator, &index);
   return true;
 }
 
 TEST(line_multiline_string) {
   /* A string spanning two lines; the token after it should be on line 3. */
+  const char *src = "\"line1\nline2\"\nx";
   Lexer lexer;
-  init_lexer(&lexer, "\"line1\nline2\"\nx", &raw_allocator);
+  LineIndex index;
+  init_lexer(&lexer, src, &raw_allocator);
+  build_line_index(&index, src, &raw_allocator);
+
+  ASSERT_EQ(next_token_line(&lexer, &index), 1);
+  ASSERT_EQ(next_token_line(&lexer, &index), 3);
+
+  free_line_index(&raw_allocator, &index);
+  return true;
+}
+
+TEST(line_index_columns) {
+  const char *src = "ab\n  cd\n\nef";
+  LineIndex index;
+  build_line_index(&index, src, &raw_allocator);
+  ASSERT_EQ(index.count, 4);
+
+  SourcePos pos = line_index_lookup(&index, 0);
+  ASSERT_EQ(pos.line, 1);
+  ASSERT_EQ(pos.column, 1);
 
-  Token str = scan_token(&lexer);
-  ASSERT_EQ(str.type, TOKEN_STRING);
-  free_token_lexeme(&raw_allocator, str);
+  pos = line_index_lookup(&index, 5); // 'c'
+  ASSERT_EQ(pos.line, 2);
+  ASSERT_EQ(pos.column, 3);
 
-  Token id = scan_token(&lexer);
-  ASSERT_EQ(id.type, TOKEN_IDENTIFIER);
-  ASSERT_EQ(id.line, 3);
-  free_token_lexeme(&raw_allocator, id);
+  pos = line_index_lookup(&index, 2); // the newline ends line 1
+  ASSERT_EQ(pos.line, 1);
+  ASSERT_EQ(pos.column, 3);
 
+  pos = line_index_lookup(&index, 9); // 'e'
+  ASSERT_EQ(pos.line, 4);
+  ASSERT_EQ(pos.column, 1);
+
+  free_line_index(&raw_allocator, &index);
   return true;
 }
 
@@ -385,6 +563,98 @@ TEST(unexpected_character_tilde) {
   return true;
 }
 
+/* --------------------------------------------------------------------------
+ * Unicode
+ * -------------------------------------------------------------------------- */
+
+TEST(unicode_identifier_latin) {
+  return scan_single("caf\xC3\xA9", TOKEN_IDENTIFIER, "caf\xC3\xA9");
+}
+
+TEST(unicode_identifier_cjk_start) {
+  return scan_single("\xE5\x8F\x98\xE9\x87\x8F_1", TOKEN_IDENTIFIER,
+                     "\xE5\x8F\x98\xE9\x87\x8F_1");
+}
+
+TEST(unicode_combining_mark_continues_only) {
+  // U+0301 COMBINING ACUTE ACCENT may continue an identifier but not start one
+  if (!scan_single("e\xCC\x81", TOKEN_IDENTIFIER, "e\xCC\x81"))
+    return false;
+  return scan_single("\xCC\x81", TOKEN_ERROR, NULL);
+}
+
+TEST(unicode_symbol_is_unexpected) {
+  return scan_single("\xE2\x86\x92", TOKEN_ERROR,
+                     "Unexpected character '\xE2\x86\x92'.");
+}
+
+TEST(invalid_utf8_is_error) {
+  Lexer lexer;
+  init_lexer(&lexer, "a \"b\xFF\" c", &raw_allocator);
+
+  Token t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_IDENTIFIER);
+  free_token_lexeme(&raw_allocator, t);
+
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_ERROR);
+  ASSERT_STR_EQ(t.lexeme, "Invalid UTF-8 sequence.");
+  ASSERT_EQ(t.offset, 4);
+  free_token_lexeme(&raw_allocator, t);
+
+  t = scan_token(&lexer); // lexing carries on after the bad byte
+  ASSERT_EQ(t.type, TOKEN_IDENTIFIER);
+  ASSERT_STR_EQ(t.lexeme, "c");
+  free_token_lexeme(&raw_allocator, t);
+
+  return true;
+}
+
+// The error covers just the bad bytes, and the tokens around them survive
+static bool invalid_utf8_between(const char *src, size_t offset, size_t length,
+                                 TokenType next, const char *lexeme) {
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+  Token t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_ERROR);
+  ASSERT_EQ(t.offset, offset);
+  ASSERT_EQ(t.length, length);
+  free_token_lexeme(&raw_allocator, t);
+
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.type, next);
+  ASSERT_STR_EQ(t.lexeme, lexeme);
+  free_token_lexeme(&raw_allocator, t);
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_IDENTIFIER);
+  ASSERT_STR_EQ(t.lexeme, "x");
+  free_token_lexeme(&raw_allocator, t);
+  return true;
+}
+
+TEST(invalid_utf8_in_comment_keeps_next_token) {
+  if (!invalid_utf8_between("// caf\xFF\nlet x", 6, 1, TOKEN_LET, NULL))
+    return false;
+  return invalid_utf8_between("// \xFF more words\nlet x", 3, 1, TOKEN_LET,
+                              NULL);
+}
+
+TEST(invalid_utf8_sequence_reported_whole) {
+  // A lead byte cut short, with its continuation byte
+  return invalid_utf8_between("\xE2\x82 y x", 0, 2, TOKEN_IDENTIFIER, "y");
+}
+
+TEST(utf8_validate_rejects_malformed) {
+  ASSERT_EQ(utf8_validate("plain ascii text, long enough for a vector", 42),
+            42);
+  ASSERT_EQ(utf8_validate("\xE2\x82\xAC ok", 6), 6);
+  ASSERT_EQ(utf8_validate("ab\xC0\xAF", 4), 2);                 // overlong
+  ASSERT_EQ(utf8_validate("\xED\xA0\x80", 3), 0);               // surrogate
+  ASSERT_EQ(utf8_validate("\xF4\x90\x80\x80", 4), 0);           // > U+10FFFF
+  ASSERT_EQ(utf8_validate("0123456789abcdef\xE2\x82", 18), 16); // truncated
+  return true;
+}
+
 /* --------------------------------------------------------------------------
  * token_type_to_string
  * -------------------------------------------------------------------------- */
@@ -531,6 +801,291 @@ TEST(integration_if_else) {
   return true;
 }
 
+/* --------------------------------------------------------------------------
+ * Incremental re-lexing
+ * -------------------------------------------------------------------------- */
+
+// Re-lex `before` after `edit` turned it into `after` and check the result is
+// token-for-token what a full scan of `after` produces
+static bool relex_matches(const char *before, TextEdit edit, const char *after,
+                          size_t max_rescanned) {
+  Lexer lexer;
+  TokenBuffer tokens = {0};
+  init_lexer(&lexer, before, &raw_allocator);
+  lex_all(&lexer, &tokens);
+
+  RelexResult result = relex(&tokens, after, edit, &raw_allocator);
+  ASSERT(result.new_count <= max_rescanned, "re-scan should stay edit-local");
+
+  TokenBuffer expected = {0};
+  init_lexer(&lexer, after, &raw_allocator);
+  lex_all(&lexer, &expected);
+
+  ASSERT_EQ(tokens.count, expected.count);
+  for (size_t i = 0; i < tokens.count; i++) {
+    Token got = tokens.items[i];
+    Token want = expected.items[i];
+    ASSERT_EQ(got.type, want.type);
+    ASSERT_EQ(got.offset, want.offset);
+    ASSERT_EQ(got.length, want.length);
+    ASSERT_STR_EQ(got.lexeme, want.lexeme);
+  }
+
+  free_token_buffer(&raw_allocator, &tokens);
+  free_token_buffer(&raw_allocator, &expected);
+  return true;
+}
+
+TEST(token_offsets) {
+  Lexer lexer;
+  init_lexer(&lexer, "let s = \"hi\";", &raw_allocator);
+
+  Token t = scan_token(&lexer);
+  ASSERT_EQ(t.offset, 0);
+  ASSERT_EQ(t.length, 3);
+
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.offset, 4);
+  free_token_lexeme(&raw_allocator, t);
+
+  t = scan_token(&lexer);
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_STRING);
+  ASSERT_EQ(t.offset, 8);
+  ASSERT_EQ(t.length, 4); // quotes included
+  free_token_lexeme(&raw_allocator, t);
+
+  t = scan_token(&lexer);
+  t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_EOF);
+  ASSERT_EQ(t.offset, 13);
+
+  return true;
+}
+
+TEST(relex_replace_identifier) {
+  TextEdit edit = {8, 1, 3};
+  return relex_matches("let a = b + c;\nlet d = e;", edit,
+                       "let a = foo + c;\nlet d = e;", 3);
+}
+
+TEST(relex_insert_extends_token) {
+  TextEdit edit = {5, 0, 1};
+  return relex_matches("a = b+c;", edit, "a = b=+c;", 4);
+}
+
+TEST(relex_delete_merges_tokens) {
+  TextEdit edit = {1, 1, 0};
+  return relex_matches("a b c d", edit, "ab c d", 2);
+}
+
+TEST(relex_insert_newline_shifts_lines) {
+  TextEdit edit = {6, 0, 2};
+  return relex_matches("let a;\nlet b;\nlet c;", edit,
+                       "let a;\n\n\nlet b;\nlet c;", 2);
+}
+
+TEST(relex_comment_out_line) {
+  TextEdit edit = {7, 0, 2};
+  return relex_matches("let a;\nlet b;\nlet c;", edit,
+                       "let a;\n//let b;\nlet c;", 2);
+}
+
+TEST(relex_open_string_runs_to_end) {
+  TextEdit edit = {4, 0, 1};
+  return relex_matches("a = b;\nc = d;", edit, "a = \"b;\nc = d;", 4);
+}
+
+TEST(relex_at_start_and_end) {
+  TextEdit at_start = {0, 0, 4};
+  if (!relex_matches("b = c;", at_start, "let b = c;", 2))
+    return false;
+  TextEdit at_end = {6, 0, 3};
+  return relex_matches("b = c;", at_end, "b = c; x;", 4);
+}
+
+TEST(relex_in_leading_trivia) {
+  // No token ends before these edits, so relex has to start from the top
+  TextEdit unindent = {0, 2, 0};
+  if (!relex_matches("  a", unindent, "a", 2))
+    return false;
+  TextEdit in_comment = {3, 0, 3};
+  if (!relex_matches("/* a */ b", in_comment, "/* */ a */ b", 4))
+    return false;
+  TextEdit uncomment = {0, 2, 0};
+  return relex_matches("//a\nb", uncomment, "a\nb", 3);
+}
+
+TEST(relex_around_invalid_utf8) {
+  // A bad byte before the edit was reported by the first pass already
+  TextEdit past_it = {6, 1, 1};
+  if (!relex_matches("a \xFF b c", past_it, "a \xFF b d", 2))
+    return false;
+  // The error sits mid-string, so rescanning can't restart there
+  TextEdit unterminate = {4, 1, 2};
+  if (!relex_matches("\"\xFF;;\"", unterminate, "\"\xFF;;/x", 2))
+    return false;
+  TextEdit unquote = {0, 1, 0};
+  return relex_matches("\"x \xFF y\" z", unquote, "x \xFF y\" z", 6);
+}
+
+TEST(rewind_rescans_span) {
+  const char *src = "fn f() { g(1); } fn h() {}";
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+  Token t;
+  do {
+    t = scan_token(&lexer);
+    free_token_lexeme(&raw_allocator, t);
+  } while (t.type != TOKEN_EOF);
+
+  rewind_lexer(&lexer, 7, 9); // "{ g(1); }"
+  TokenType want[] = {TOKEN_LEFT_BRACE, TOKEN_IDENTIFIER, TOKEN_LEFT_PAREN,
+                      TOKEN_INTEGER,    TOKEN_RIGHT_PAREN, TOKEN_SEMICOLON,
+                      TOKEN_RIGHT_BRACE, TOKEN_FN};
+  for (size_t i = 0; i < sizeof(want) / sizeof(want[0]); i++) {
+    t = scan_token(&lexer);
+    free_token_lexeme(&raw_allocator, t);
+    ASSERT_EQ(t.type, want[i]);
+  }
+  ASSERT_EQ(t.offset, 17);
+  return true;
+}
+
+TEST(rewind_reports_invalid_utf8_in_span) {
+  const char *src = "x \"a\xFF\" y";
+  Lexer lexer;
+  init_lexer(&lexer, src, &raw_allocator);
+  rewind_lexer(&lexer, 2, 4);
+  Token t = scan_token(&lexer);
+  ASSERT_EQ(t.type, TOKEN_ERROR);
+  free_token_lexeme(&raw_allocator, t);
+  return true;
+}
+
+/* --------------------------------------------------------------------------
+ * Streaming
+ * -------------------------------------------------------------------------- */
+
+// Stream `src` through a `window`-byte lexer and check it yields exactly the
+// tokens an in-memory scan does
+static bool stream_matches(const char *src, size_t window) {
+  FILE *file = tmpfile();
+  ASSERT_NOT_NULL(file);
+  fputs(src, file);
+  fflush(file);
+  rewind(file);
+
+  Lexer lexer;
+  TokenBuffer expected = {0};
+  init_lexer(&lexer, src, &raw_allocator);
+  lex_all(&lexer, &expected);
+
+  StreamLexer stream;
+  init_stream_lexer(&stream, fileno(file), window, &raw_allocator);
+  for (size_t i = 0; i < expected.count; i++) {
+    Token got = stream_scan_token(&stream);
+    Token want = expected.items[i];
+    ASSERT_EQ(got.type, want.type);
+    ASSERT_EQ(got.offset, want.offset);
+    ASSERT_EQ(got.length, want.length);
+    ASSERT_STR_EQ(got.lexeme, want.lexeme);
+    free_token_lexeme(&raw_allocator, got);
+  }
+
+  free_stream_lexer(&stream);
+  free_token_buffer(&raw_allocator, &expected);
+  fclose(file);
+  return true;
+}
+
+TEST(stream_small_window) {
+  return stream_matches("fn add(a: i32, b: i32) i32 {\n"
+                        "  // sum them\n"
+                        "  let total = a + b; total += 1.25;\n"
+                        "  return total;\n"
+                        "}\n",
+                        16);
+}
+
+TEST(stream_token_longer_than_window) {
+  return stream_matches("let s = \"a string literal much longer than the "
+                        "window it is streamed through\"; x",
+                        16);
+}
+
+TEST(stream_utf8_split_across_reads) {
+  return stream_matches("\xE5\x8F\x98\xE9\x87\x8F = \xE5\x8F\x98\xE9\x87"
+                        "\x8F + caf\xC3\xA9 + \xE5\x8F\x98;",
+                        16);
+}
+
+TEST(stream_comment_longer_than_window) {
+  if (!stream_matches("a // a comment much longer than the window it is "
+                      "streamed through\nb // and one more at the end",
+                      16))
+    return false;
+  return stream_matches("a // caf\xC3\xA9 and \xFF and then \xFE, all in "
+                        "one comment\nb",
+                        16);
+}
+
+TEST(stream_memory_stays_bounded) {
+  size_t reps = 20000;
+  const char *stmt = "let x = y + 1;\n";
+  size_t len = strlen(stmt);
+
+  FILE *file = tmpfile();
+  ASSERT_NOT_NULL(file);
+  for (size_t i = 0; i < reps; i++)
+    fputs(stmt, file);
+  fflush(file);
+  rewind(file);
+
+  StreamLexer stream;
+  init_stream_lexer(&stream, fileno(file), 64, &raw_allocator);
+  size_t count = 0;
+  Token t;
+  while ((t = stream_scan_token(&stream)).type != TOKEN_EOF) {
+    free_token_lexeme(&raw_allocator, t);
+    count++;
+  }
+  ASSERT_EQ(count, reps * 7);
+  ASSERT_EQ(t.offset, reps * len);
+  ASSERT_EQ(stream.cap, 65); // never grew past the window
+
+  free_stream_lexer(&stream);
+  fclose(file);
+  return true;
+}
+
+TEST(stream_trivia_is_not_kept) {
+  size_t reps = 20000;
+  FILE *file = tmpfile();
+  ASSERT_NOT_NULL(file);
+  fputs("a", file);
+  for (size_t i = 0; i < reps; i++)
+    fputs("   // nothing but comments here\n", file);
+  fputs("b", file);
+  fflush(file);
+  rewind(file);
+
+  StreamLexer stream;
+  init_stream_lexer(&stream, fileno(file), 64, &raw_allocator);
+  Token a = stream_scan_token(&stream);
+  Token b = stream_scan_token(&stream);
+  ASSERT_STR_EQ(a.lexeme, "a");
+  ASSERT_STR_EQ(b.lexeme, "b");
+  ASSERT_EQ(stream_scan_token(&stream).type, TOKEN_EOF);
+  ASSERT_EQ(stream.cap, 65);
+
+  free_token_lexeme(&raw_allocator, a);
+  free_token_lexeme(&raw_allocator, b);
+  free_stream_lexer(&stream);
+  fclose(file);
+  return true;
+}
+
 /* --------------------------------------------------------------------------
  * main
  * -------------------------------------------------------------------------- */
@@ -577,6 +1132,13 @@ int main(void) {
   RUN_TEST(arithmetic_rem);
   RUN_TEST(arithmetic_rem_equal);
 
+  TEST_SUITE("Lexer — Maximal Munch");
+  RUN_TEST(munch_plus_plus_plus);
+  RUN_TEST(munch_bang_equal_equal);
+  RUN_TEST(munch_no_pair_falls_back);
+  RUN_TEST(munch_operator_before_identifier);
+  RUN_TEST(munch_reserved_operator_bytes);
+
   TEST_SUITE("Lexer — Identifiers");
   RUN_TEST(identifier_simple);
   RUN_TEST(identifier_with_underscore_prefix);
@@ -622,6 +1184,21 @@ int main(void) {
   RUN_TEST(float_leading_zero);
   RUN_TEST(float_long_fractional);
 
+  TEST_SUITE("Lexer — Number Values");
+  RUN_TEST(integer_value_decimal);
+  RUN_TEST(integer_value_separators);
+  RUN_TEST(integer_value_hex);
+  RUN_TEST(integer_value_octal);
+  RUN_TEST(integer_value_binary);
+  RUN_TEST(integer_value_max);
+  RUN_TEST(integer_overflow_is_error);
+  RUN_TEST(integer_prefix_without_digits_is_error);
+  RUN_TEST(integer_trailing_separator_is_error);
+  RUN_TEST(integer_digit_outside_base_is_error);
+  RUN_TEST(separator_between_digits_only);
+  RUN_TEST(float_value_fast_path);
+  RUN_TEST(float_value_slow_path);
+
   TEST_SUITE("Lexer — Number Errors");
   RUN_TEST(number_trailing_dot_is_error);
 
@@ -636,6 +1213,7 @@ int main(void) {
   RUN_TEST(line_increments_on_newline);
   RUN_TEST(line_multiple_newlines);
   RUN_TEST(line_multiline_string);
+  RUN_TEST(line_index_columns);
 
   TEST_SUITE("Lexer — Comments");
   RUN_TEST(comment_skipped);
@@ -646,6 +1224,16 @@ int main(void) {
   RUN_TEST(unexpected_character);
   RUN_TEST(unexpected_character_tilde);
 
+  TEST_SUITE("Lexer — Unicode");
+  RUN_TEST(unicode_identifier_latin);
+  RUN_TEST(unicode_identifier_cjk_start);
+  RUN_TEST(unicode_combining_mark_continues_only);
+  RUN_TEST(unicode_symbol_is_unexpected);
+  RUN_TEST(invalid_utf8_is_error);
+  RUN_TEST(invalid_utf8_in_comment_keeps_next_token);
+  RUN_TEST(invalid_utf8_sequence_reported_whole);
+  RUN_TEST(utf8_validate_rejects_malformed);
+
   TEST_SUITE("Lexer — token_type_to_string");
   RUN_TEST(token_type_to_string_samples);
 
@@ -654,6 +1242,28 @@ int main(void) {
   RUN_TEST(integration_fn_signature);
   RUN_TEST(integration_if_else);
 
+  TEST_SUITE("Lexer — Incremental");
+  RUN_TEST(token_offsets);
+  RUN_TEST(relex_replace_identifier);
+  RUN_TEST(relex_insert_extends_token);
+  RUN_TEST(relex_delete_merges_tokens);
+  RUN_TEST(relex_insert_newline_shifts_lines);
+  RUN_TEST(relex_comment_out_line);
+  RUN_TEST(relex_open_string_runs_to_end);
+  RUN_TEST(relex_at_start_and_end);
+  RUN_TEST(relex_in_leading_trivia);
+  RUN_TEST(relex_around_invalid_utf8);
+  RUN_TEST(rewind_rescans_span);
+  RUN_TEST(rewind_reports_invalid_utf8_in_span);
+
+  TEST_SUITE("Lexer — Streaming");
+  RUN_TEST(stream_small_window);
+  RUN_TEST(stream_token_longer_than_window);
+  RUN_TEST(stream_utf8_split_across_reads);
+  RUN_TEST(stream_comment_longer_than_window);
+  RUN_TEST(stream_memory_stays_bounded);
+  RUN_TEST(stream_trivia_is_not_kept);
+
   TEST_SUMMARY();
   return TEST_EXIT_CODE();
 }
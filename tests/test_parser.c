@@ -15,11 +15,18 @@
  */
 
 #include "src/ast.h"
+#include "src/ast_cache.h"
+#include "src/ast_dump.h"
+#include "src/flat_ast.h"
 #include "src/lexer.h"
 #include "src/parser.h"
 #include "test.h"
 
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static Node *parse_src(const char *src, Parser *out_parser) {
   static Lexer lexer;
@@ -110,6 +117,16 @@ TEST(let_with_type_and_init) {
   ASSERT_NOT_NULL(let->as.let.type);
   ASSERT_NOT_NULL(let->as.let.init);
   ASSERT_EQ(let->as.let.init->kind, NODE_INT_LIT);
+  ASSERT_EQ(let->as.let.init->as.integer.val, 42);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(node_lines_from_offsets) {
+  WITH_PARSE("fn f() {\n  let x = 1;\n\n  return x;\n}", prog, p);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(first_fn_stmt(prog, 0)->line, 2);
+  ASSERT_EQ(first_fn_stmt(prog, 1)->line, 4);
   TEARDOWN(prog, p);
   return true;
 }
@@ -402,6 +419,247 @@ TEST(type_alias) {
   return true;
 }
 
+TEST(types_are_interned) {
+  WITH_PARSE("fn f(a: ^User, b: ^User) ^User {\n"
+             "  let x: []i32 = y; let z: []i32 = w;\n"
+             "  let q: [4]i32 = v; let r: [4]i32 = u; let n: [k]i32 = t;\n"
+             "}\n"
+             "type Id = i32;",
+             prog, p);
+  ASSERT_FALSE(p.had_error);
+  Node *f = prog->as.program.decls.items[0];
+  Node *a = f->as.fn.params.items[0]->as.param.type;
+  ASSERT_EQ(a->kind, NODE_TYPE_PTR);
+  ASSERT_TRUE(a == f->as.fn.params.items[1]->as.param.type);
+  ASSERT_TRUE(a == f->as.fn.ret_type);
+  ASSERT_EQ(a->line, 0); // shared by every occurrence
+
+  ASSERT_TRUE(first_fn_stmt(prog, 0)->as.let.type ==
+              first_fn_stmt(prog, 1)->as.let.type);
+  Node *sized = first_fn_stmt(prog, 2)->as.let.type;
+  ASSERT_TRUE(sized == first_fn_stmt(prog, 3)->as.let.type);
+  ASSERT_TRUE(sized != first_fn_stmt(prog, 0)->as.let.type);
+  ASSERT_EQ(sized->as.array.size->line, 0);
+
+  // [k]i32 isn't interned, but its element still is
+  Node *dynamic = first_fn_stmt(prog, 4)->as.let.type;
+  ASSERT_EQ(node_refs(dynamic), 0);
+  ASSERT_TRUE(dynamic->as.array.elem == sized->as.array.elem);
+  ASSERT_TRUE(dynamic->as.array.elem ==
+              prog->as.program.decls.items[1]->as.type_decl.def);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(interned_types_outlive_either_owner) {
+  const char *src = "fn f(a: ^T, b: [2]^T) ^T { let c: ^T = a; }";
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  // Program freed first, then the parser and its table
+  Lexer lexer;
+  Parser p;
+  init_lexer(&lexer, src, &counting);
+  init_parser(&p, &lexer, &counting);
+  Node *prog = parse_program(&p);
+  ASSERT_FALSE(p.had_error);
+  free_node(&counting, prog);
+  free_parser(&p);
+  ASSERT_EQ(ctx.live, 0);
+
+  // And the other way around
+  init_lexer(&lexer, src, &counting);
+  init_parser(&p, &lexer, &counting);
+  prog = parse_program(&p);
+  free_parser(&p);
+  Node *f = prog->as.program.decls.items[0];
+  // a, b's element, the result and c
+  ASSERT_EQ(node_refs(f->as.fn.ret_type), 4);
+  free_node(&counting, prog);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(prefix_binds_looser_than_postfix) {
+  WITH_PARSE("fn f() { -a.b(c)[d] * (x + y)(z); }", prog, p);
+  ASSERT_FALSE(p.had_error);
+  Node *mul = first_fn_stmt(prog, 0)->as.expr_stmt.expr;
+  ASSERT_EQ(mul->kind, NODE_BINARY);
+  ASSERT_EQ(mul->as.binary.op, TOKEN_MUL);
+
+  Node *neg = mul->as.binary.left;
+  ASSERT_EQ(neg->kind, NODE_UNARY);
+  ASSERT_EQ(neg->as.unary.operand->kind, NODE_INDEX);
+  ASSERT_EQ(neg->as.unary.operand->as.subscript.obj->kind, NODE_CALL);
+
+  // a parenthesised expression takes postfix operators like a primary
+  Node *call = mul->as.binary.right;
+  ASSERT_EQ(call->kind, NODE_CALL);
+  ASSERT_EQ(call->as.call.callee->kind, NODE_BINARY);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(assignment_takes_whole_binary_target) {
+  WITH_PARSE("fn f() { a[i] = b = c + d * e == g; }", prog, p);
+  ASSERT_FALSE(p.had_error);
+  Node *outer = first_fn_stmt(prog, 0)->as.expr_stmt.expr;
+  ASSERT_EQ(outer->kind, NODE_ASSIGN);
+  ASSERT_EQ(outer->as.assign.target->kind, NODE_INDEX);
+
+  Node *inner = outer->as.assign.val;
+  ASSERT_EQ(inner->kind, NODE_ASSIGN);
+  Node *eq = inner->as.assign.val;
+  ASSERT_EQ(eq->as.binary.op, TOKEN_EQUAL_EQUAL);
+  ASSERT_EQ(eq->as.binary.left->as.binary.op, TOKEN_PLUS);
+  ASSERT_EQ(eq->as.binary.left->as.binary.right->as.binary.op, TOKEN_MUL);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(operators_share_their_level) {
+  // same-level operators fold left, compound assignment folds right and
+  // 'heap' binds like a prefix operator
+  WITH_PARSE("fn f() { a % b / c * d; a != b == c; a += b -= c; heap a + b; }",
+             prog, p);
+  ASSERT_FALSE(p.had_error);
+  Node *mul = first_fn_stmt(prog, 0)->as.expr_stmt.expr;
+  ASSERT_EQ(mul->as.binary.op, TOKEN_MUL);
+  ASSERT_EQ(mul->as.binary.left->as.binary.op, TOKEN_DIV);
+  ASSERT_EQ(mul->as.binary.left->as.binary.left->as.binary.op, TOKEN_REM);
+
+  Node *eq = first_fn_stmt(prog, 1)->as.expr_stmt.expr;
+  ASSERT_EQ(eq->as.binary.op, TOKEN_EQUAL_EQUAL);
+  ASSERT_EQ(eq->as.binary.left->as.binary.op, TOKEN_BANG_EQUAL);
+
+  Node *add = first_fn_stmt(prog, 2)->as.expr_stmt.expr;
+  ASSERT_EQ(add->as.assign.op, TOKEN_PLUS_EQUAL);
+  ASSERT_EQ(add->as.assign.target->kind, NODE_IDENT);
+  ASSERT_EQ(add->as.assign.val->as.assign.op, TOKEN_MINUS_EQUAL);
+
+  Node *sum = first_fn_stmt(prog, 3)->as.expr_stmt.expr;
+  ASSERT_EQ(sum->kind, NODE_BINARY);
+  ASSERT_EQ(sum->as.binary.left->kind, NODE_HEAP);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+static char *repeat_around(const char *open, size_t n, const char *middle,
+                           const char *close) {
+  size_t lo = strlen(open), lm = strlen(middle), lc = strlen(close);
+  char *s = malloc(n * (lo + lc) + lm + 1);
+  char *w = s;
+  for (size_t i = 0; i < n; i++, w += lo)
+    memcpy(w, open, lo);
+  memcpy(w, middle, lm);
+  w += lm;
+  for (size_t i = 0; i < n; i++, w += lc)
+    memcpy(w, close, lc);
+  *w = '\0';
+  return s;
+}
+
+static Node *parse_limited(const char *src, size_t max_depth, Allocator *a,
+                           Parser *parser, Lexer *lexer) {
+  init_lexer(lexer, src, a);
+  init_parser(parser, lexer, a);
+  parser->max_depth = max_depth;
+  return parse_program(parser);
+}
+
+TEST(deep_nesting_within_limit) {
+  char *parens = repeat_around("(", 5000, "x", ")");
+  char *negs = repeat_around("- ", 5000, "x", "");
+  char *blocks = repeat_around("{", 5000, "", "}");
+  size_t len = strlen(parens) + strlen(negs) + strlen(blocks) + 64;
+  char *src = malloc(len);
+  snprintf(src, len, "fn f() { y = %s; y = %s; %s }", parens, negs, blocks);
+
+  WITH_PARSE(src, prog, p);
+  ASSERT_FALSE(p.had_error);
+  Node *paren = first_fn_stmt(prog, 0)->as.expr_stmt.expr;
+  ASSERT_EQ(paren->as.assign.val->kind, NODE_IDENT);
+  Node *neg = first_fn_stmt(prog, 1)->as.expr_stmt.expr->as.assign.val;
+  size_t depth = 0;
+  for (; neg->kind == NODE_UNARY; depth++)
+    neg = neg->as.unary.operand;
+  ASSERT_EQ(depth, 5000);
+  ASSERT_EQ(neg->kind, NODE_IDENT);
+  ASSERT_EQ(first_fn_stmt(prog, 2)->kind, NODE_BLOCK);
+  ASSERT_EQ(p.exprs.count, 0);
+  ASSERT_EQ(p.stmts.count, 0);
+
+  TEARDOWN(prog, p);
+  free(parens);
+  free(negs);
+  free(blocks);
+  free(src);
+  return true;
+}
+
+TEST(million_deep_parens_with_raised_limit) {
+  char *body = repeat_around("(", 1000000, "x", ")");
+  size_t len = strlen(body) + 32;
+  char *src = malloc(len);
+  snprintf(src, len, "fn f() { %s; }", body);
+
+  Lexer lexer;
+  Parser parser;
+  Node *prog = parse_limited(src, 2000000, &raw_allocator, &parser, &lexer);
+  ASSERT_FALSE(parser.had_error);
+  ASSERT_EQ(first_fn_stmt(prog, 0)->as.expr_stmt.expr->kind, NODE_IDENT);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&parser);
+  free(body);
+  free(src);
+  return true;
+}
+
+static bool too_deep_is_clean_error(const char *src) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  Lexer lexer;
+  Parser parser;
+  Node *prog = parse_limited(src, 64, &counting, &parser, &lexer);
+  ASSERT_TRUE(parser.had_error);
+  ASSERT_EQ(parser.exprs.count, 0);
+  ASSERT_EQ(parser.stmts.count, 0);
+  ASSERT_EQ(parser.scratch.count, 0);
+
+  free_node(&counting, prog);
+  free_parser(&parser);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(nesting_limit_reports_error) {
+  char *exprs = repeat_around("f(1, -(a + [", 40, "x", "]))");
+  char *blocks = repeat_around("if a { while b { ", 40, "", "} }");
+  char *types = repeat_around("^", 100, "i32", "");
+  size_t len = strlen(exprs) + 32;
+  char *src = malloc(len);
+  snprintf(src, len, "fn f() { %s; }", exprs);
+  bool ok = too_deep_is_clean_error(src);
+
+  len = strlen(blocks) + 32;
+  src = realloc(src, len);
+  snprintf(src, len, "fn f() { %s } fn g() {}", blocks);
+  ok = ok && too_deep_is_clean_error(src);
+
+  len = strlen(types) + 32;
+  src = realloc(src, len);
+  snprintf(src, len, "fn f() { let x: %s; }", types);
+  ok = ok && too_deep_is_clean_error(src);
+
+  free(exprs);
+  free(blocks);
+  free(types);
+  free(src);
+  return ok;
+}
+
 static const char *README_PROGRAM =
     "type User = struct {\n"
     "  id: i32,\n"
@@ -438,6 +696,1200 @@ TEST(readme_program_parses) {
   return true;
 }
 
+static Node *parse_lazy(const char *src, Parser *parser, Lexer *lexer,
+                        Allocator *a) {
+  init_lexer(lexer, src, a);
+  init_parser(parser, lexer, a);
+  parser->lazy_fn_bodies = true;
+  return parse_program(parser);
+}
+
+TEST(lazy_skips_bodies_keeps_signatures) {
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy(README_PROGRAM, &p, &lexer, &raw_allocator);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(prog->as.program.decls.count, 2);
+  ASSERT_EQ(prog->as.program.decls.items[0]->kind, NODE_TYPE_DECL);
+
+  Node *main_fn = prog->as.program.decls.items[1];
+  ASSERT_STR_EQ(main_fn->as.fn.name, "main");
+  ASSERT_NULL(main_fn->as.fn.body);
+  ASSERT_EQ(README_PROGRAM[main_fn->as.fn.body_start], '{');
+  ASSERT_EQ(README_PROGRAM[main_fn->as.fn.body_end - 1], '}');
+
+  Node *body = parse_fn_body(&p, main_fn);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_TRUE(body == main_fn->as.fn.body);
+  ASSERT_EQ(body->as.block.stmts.count, 4);
+  ASSERT_EQ(body->line, 7);
+  ASSERT_EQ(body->as.block.stmts.items[1]->line, 9);
+  ASSERT_TRUE(parse_fn_body(&p, main_fn) == body); // already there
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  return true;
+}
+
+TEST(lazy_brace_matching) {
+  const char *src = "fn f(a: i32) i32 { if a { { } } while b { } }\n"
+                    "pub fn g() { }";
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy(src, &p, &lexer, &raw_allocator);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(prog->as.program.decls.count, 2);
+  Node *g = prog->as.program.decls.items[1];
+  ASSERT_STR_EQ(g->as.fn.name, "g");
+  ASSERT_TRUE(g->as.fn.is_pub);
+
+  Node *f = prog->as.program.decls.items[0];
+  Node *body = parse_fn_body(&p, f);
+  ASSERT_EQ(body->as.block.stmts.count, 2);
+  ASSERT_EQ(body->as.block.stmts.items[1]->kind, NODE_WHILE);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  return true;
+}
+
+TEST(lazy_body_errors_reported_on_demand) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy("fn f() { let = ; } fn g() {}", &p, &lexer,
+                          &counting);
+  ASSERT_FALSE(p.had_error);
+  parse_fn_body(&p, prog->as.program.decls.items[0]);
+  ASSERT_TRUE(p.had_error);
+
+  free_node(&counting, prog);
+  free_parser(&p);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+// A lazy parse of `src` reports nothing until its first fn's body is asked
+// for, and then exactly what an eager parse does
+static bool lazy_errors_match_eager(const char *src) {
+  WITH_PARSE(src, eager, pe);
+  ASSERT_TRUE(pe.had_error);
+
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy(src, &p, &lexer, &raw_allocator);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(p.diags.count, 0);
+  parse_fn_body(&p, prog->as.program.decls.items[0]);
+  ASSERT_TRUE(p.had_error);
+  ASSERT_EQ(p.diags.count, pe.diags.count);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  TEARDOWN(eager, pe);
+  return true;
+}
+
+TEST(lazy_body_lexical_errors_reported_once) {
+  if (!lazy_errors_match_eager("fn f() { let x = @; }"))
+    return false;
+  return lazy_errors_match_eager("fn f() { let s = \"\xFF\"; }");
+}
+
+TEST(lazy_unbalanced_body_reported_once) {
+  return lazy_errors_match_eager("fn f() { if x { return 1; }");
+}
+
+TEST(flat_fn_shape) {
+  WITH_PARSE("pub fn add(a: i32, b: i32) i32 {\n  return a + b * 2;\n}", prog,
+             p);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+  ASSERT_EQ(flat_kind(&flat, 0), NODE_PROGRAM);
+
+  FlatList decls = flat_list(&flat, flat.data[0].lhs);
+  ASSERT_EQ(decls.count, 1);
+  FlatIndex fn = decls.items[0];
+  ASSERT_EQ(flat_kind(&flat, fn), NODE_FN);
+  ASSERT_EQ(flat.ops[fn], 1); // pub
+  ASSERT_STR_EQ(flat_string(&flat, flat.data[fn].lhs), "add");
+
+  const uint32_t *parts = flat.extra + flat.data[fn].rhs;
+  FlatList params = flat_list(&flat, parts[0]);
+  ASSERT_EQ(params.count, 2);
+  ASSERT_STR_EQ(flat_string(&flat, flat.data[params.items[1]].lhs), "b");
+  ASSERT_EQ(flat_kind(&flat, parts[1]), NODE_TYPE_NAME);
+
+  FlatList stmts = flat_list(&flat, flat.data[parts[2]].lhs);
+  ASSERT_EQ(stmts.count, 1);
+  FlatIndex ret = stmts.items[0];
+  ASSERT_EQ(flat_kind(&flat, ret), NODE_RETURN);
+  ASSERT_EQ(flat.lines[ret], 2);
+
+  // a + (b * 2)
+  FlatIndex sum = flat.data[ret].lhs;
+  ASSERT_EQ(flat_kind(&flat, sum), NODE_BINARY);
+  ASSERT_EQ(flat.ops[sum], TOKEN_PLUS);
+  FlatIndex product = flat.data[sum].rhs;
+  ASSERT_EQ(flat.ops[product], TOKEN_MUL);
+  ASSERT_EQ(flat_integer(&flat, flat.data[product].rhs), 2);
+
+  // Pre-order: every child comes after its parent
+  ASSERT_TRUE(fn < parts[2] && parts[2] < ret && ret < sum && sum < product);
+
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(flat_literals_and_optional_children) {
+  WITH_PARSE("fn f() { let x = 1.5; let s = \"hi\"; let t: bool; "
+             "if true { } }",
+             prog, p);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+
+  FlatIndex fn = flat_list(&flat, flat.data[0].lhs).items[0];
+  FlatIndex body = flat.extra[flat.data[fn].rhs + 2];
+  FlatList stmts = flat_list(&flat, flat.data[body].lhs);
+  ASSERT_EQ(stmts.count, 4);
+
+  const uint32_t *x = flat.extra + flat.data[stmts.items[0]].rhs;
+  ASSERT_EQ(x[0], FLAT_NONE);
+  ASSERT_TRUE(flat_floating(&flat, x[1]) == 1.5);
+
+  const uint32_t *s = flat.extra + flat.data[stmts.items[1]].rhs;
+  ASSERT_STR_EQ(flat_string(&flat, flat.data[s[1]].lhs), "hi");
+
+  const uint32_t *t = flat.extra + flat.data[stmts.items[2]].rhs;
+  ASSERT_EQ(flat_kind(&flat, t[0]), NODE_TYPE_NAME);
+  ASSERT_EQ(t[1], FLAT_NONE);
+
+  FlatIndex if_stmt = stmts.items[3];
+  ASSERT_EQ(flat_kind(&flat, flat.data[if_stmt].lhs), NODE_BOOL_LIT);
+  ASSERT_EQ(flat.extra[flat.data[if_stmt].rhs + 1], FLAT_NONE);
+
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(flat_is_one_allocation) {
+  WITH_PARSE(README_PROGRAM, prog, p);
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &counting));
+  ASSERT_EQ(ctx.allocations, 1);
+  ASSERT_EQ(ctx.live, flat.size);
+
+  // Spot-check against the pointer tree: me.boss = sister;
+  FlatIndex main_fn = flat_list(&flat, flat.data[0].lhs).items[1];
+  FlatIndex body = flat.extra[flat.data[main_fn].rhs + 2];
+  FlatIndex stmt = flat_list(&flat, flat.data[body].lhs).items[2];
+  FlatIndex assign = flat.data[stmt].lhs;
+  ASSERT_EQ(flat_kind(&flat, assign), NODE_ASSIGN);
+  FlatIndex target = flat.data[assign].lhs;
+  ASSERT_EQ(flat_kind(&flat, target), NODE_MEMBER);
+  ASSERT_STR_EQ(flat_string(&flat, flat.data[target].rhs), "boss");
+
+  free_flat_ast(&flat);
+  ASSERT_EQ(ctx.live, 0);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(flat_long_operator_chain) {
+  // A left-associative chain is one level deeper per operand, but the parser
+  // never nests a frame for it, so the depth limit doesn't catch it
+  size_t operands = 1000000;
+  char *src = malloc(operands * 2 + 32);
+  size_t len = (size_t)sprintf(src, "fn f() { x = a");
+  for (size_t i = 1; i < operands; i++)
+    len += (size_t)sprintf(src + len, "+a");
+  strcpy(src + len, "; }");
+
+  WITH_PARSE(src, prog, p);
+  ASSERT_FALSE(p.had_error);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+  ASSERT_EQ(flat.count, 5 + 2 * operands);
+  FlatIndex sum = 6; // after program, fn, block, statement, assignment, x
+  ASSERT_EQ(flat_kind(&flat, sum), NODE_BINARY);
+  ASSERT_EQ(flat_kind(&flat, flat.data[sum].rhs), NODE_IDENT);
+  ASSERT_EQ(flat.data[sum].lhs, sum + 1);
+
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  free(src);
+  return true;
+}
+
+/* --------------------------------------------------------------------------
+ * AST cache
+ * -------------------------------------------------------------------------- */
+
+static void remove_cache_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return;
+  char path[512];
+  for (struct dirent *e = readdir(d); e; e = readdir(d)) {
+    if (e->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+TEST(cache_round_trip) {
+  char dir[] = "/tmp/dud_cache_XXXXXX";
+  ASSERT_NOT_NULL(mkdtemp(dir));
+
+  WITH_PARSE(README_PROGRAM, prog, p);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+  uint64_t key = ast_cache_key(README_PROGRAM, strlen(README_PROGRAM));
+  ASSERT_TRUE(store_cached_ast(dir, key, &flat));
+
+  CachedAst cached;
+  ASSERT_TRUE(load_cached_ast(&cached, dir, key));
+  const FlatAst *hit = &cached.ast;
+  ASSERT_EQ(hit->count, flat.count);
+  ASSERT_EQ(hit->extra_count, flat.extra_count);
+  ASSERT_EQ(hit->strings_len, flat.strings_len);
+  ASSERT_EQ(hit->size, flat.size);
+  ASSERT_TRUE(memcmp(hit->data, flat.data, flat.size) == 0);
+
+  // The arrays point into the mapping, laid out like a fresh flatten
+  FlatIndex main_fn = flat_list(hit, hit->data[0].lhs).items[1];
+  ASSERT_EQ(flat_kind(hit, main_fn), NODE_FN);
+  ASSERT_STR_EQ(flat_string(hit, hit->data[main_fn].lhs), "main");
+
+  unload_cached_ast(&cached);
+  ASSERT_NULL(cached.map);
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  remove_cache_dir(dir);
+  return true;
+}
+
+TEST(cache_misses_on_other_sources) {
+  char dir[] = "/tmp/dud_cache_XXXXXX";
+  ASSERT_NOT_NULL(mkdtemp(dir));
+
+  const char *src = "fn f() { return 1; }";
+  uint64_t key = ast_cache_key(src, strlen(src));
+  ASSERT_NEQ(key, ast_cache_key("fn f() { return 2; }", strlen(src)));
+  ASSERT_NEQ(key, ast_cache_key(src, strlen(src) - 1));
+
+  CachedAst cached;
+  ASSERT_FALSE(load_cached_ast(&cached, dir, key));
+
+  WITH_PARSE(src, prog, p);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+  ASSERT_TRUE(store_cached_ast(dir, key, &flat));
+  ASSERT_TRUE(load_cached_ast(&cached, dir, key));
+  unload_cached_ast(&cached);
+
+  // An entry renamed to another key, or cut short, is a miss
+  char from[512], to[512];
+  snprintf(from, sizeof(from), "%s/%016llx.ast", dir, (unsigned long long)key);
+  snprintf(to, sizeof(to), "%s/%016llx.ast", dir,
+           (unsigned long long)(key + 1));
+  ASSERT_EQ(rename(from, to), 0);
+  ASSERT_FALSE(load_cached_ast(&cached, dir, key + 1));
+
+  ASSERT_TRUE(store_cached_ast(dir, key, &flat));
+  ASSERT_EQ(truncate(from, 40), 0);
+  ASSERT_FALSE(load_cached_ast(&cached, dir, key));
+  ASSERT_NULL(cached.map);
+
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  remove_cache_dir(dir);
+  return true;
+}
+
+// Store `flat` under `key` and check the load turns it down
+static bool cache_rejects(const char *dir, uint64_t key, const FlatAst *flat) {
+  CachedAst cached;
+  ASSERT_FALSE(check_flat_ast(flat));
+  ASSERT_TRUE(store_cached_ast(dir, key, flat));
+  ASSERT_FALSE(load_cached_ast(&cached, dir, key));
+  ASSERT_NULL(cached.map);
+  return true;
+}
+
+TEST(cache_checks_payload_bounds) {
+  char dir[] = "/tmp/dud_cache_XXXXXX";
+  ASSERT_NOT_NULL(mkdtemp(dir));
+
+  WITH_PARSE(README_PROGRAM, prog, p);
+  FlatAst flat;
+  ASSERT_TRUE(flatten_ast(&flat, prog, &raw_allocator));
+  ASSERT_TRUE(check_flat_ast(&flat));
+  uint64_t key = ast_cache_key(README_PROGRAM, strlen(README_PROGRAM));
+
+  // Sizes that match the header, with indices that point out of the block
+  uint32_t decls = flat.data[0].lhs;
+  FlatIndex main_fn = flat.extra[decls + 2];
+  ASSERT_EQ(flat_kind(&flat, main_fn), NODE_FN);
+
+  uint32_t saved = flat.extra[decls + 1];
+  flat.extra[decls + 1] = flat.count;
+  ASSERT_TRUE(cache_rejects(dir, key, &flat));
+  flat.extra[decls + 1] = saved;
+
+  saved = flat.extra[decls];
+  flat.extra[decls] = flat.extra_count;
+  ASSERT_TRUE(cache_rejects(dir, key, &flat));
+  flat.extra[decls] = saved;
+
+  saved = flat.data[main_fn].lhs;
+  flat.data[main_fn].lhs = flat.strings_len;
+  ASSERT_TRUE(cache_rejects(dir, key, &flat));
+  flat.data[main_fn].lhs = saved;
+
+  // A child that loops back up the tree
+  uint32_t *body = &flat.extra[flat.data[main_fn].rhs + 2];
+  saved = *body;
+  *body = main_fn;
+  ASSERT_TRUE(cache_rejects(dir, key, &flat));
+  *body = saved;
+
+  CachedAst cached;
+  ASSERT_TRUE(store_cached_ast(dir, key, &flat));
+  ASSERT_TRUE(load_cached_ast(&cached, dir, key));
+  unload_cached_ast(&cached);
+
+  free_flat_ast(&flat);
+  TEARDOWN(prog, p);
+  remove_cache_dir(dir);
+  return true;
+}
+
+// A module of `n` declarations of every top-level kind, with keywords at
+// depths and in places (strings, comments) where the source must not be split
+static char *generated_module(size_t n) {
+  static const char *const decls[] = {
+      "import std%zu;\n",
+      "pub fn f%zu(a: i32) i32 {\n  let x = a * %zu; // fn g() {\n"
+      "  if x > 1 { const y = x; return y; }\n  return x;\n}\n",
+      "type T%zu = struct { a: i32, b: ^u8 }\n",
+      "let g%zu: i32 = %zu;\n",
+      "const s%zu = \"} fn %zu {\";\n",
+      "pub\ntype E%zu = enum { A, B }\n",
+  };
+  size_t kinds = sizeof(decls) / sizeof(decls[0]);
+  size_t cap = n * 128 + 1, len = 0;
+  char *src = malloc(cap);
+  for (size_t i = 0; i < n; i++)
+    len += (size_t)snprintf(src + len, cap - len, decls[i % kinds], i, i);
+  return src;
+}
+
+static bool same_flat(const Node *a, const Node *b) {
+  FlatAst fa, fb;
+  if (!flatten_ast(&fa, a, &raw_allocator))
+    return false;
+  if (!flatten_ast(&fb, b, &raw_allocator)) {
+    free_flat_ast(&fa);
+    return false;
+  }
+  bool same = check_flat_ast(&fa) && check_flat_ast(&fb) &&
+              fa.count == fb.count && fa.extra_count == fb.extra_count &&
+              fa.strings_len == fb.strings_len &&
+              memcmp(fa.kinds, fb.kinds, fa.count) == 0 &&
+              memcmp(fa.ops, fb.ops, fa.count) == 0 &&
+              memcmp(fa.lines, fb.lines, fa.count * sizeof(uint32_t)) == 0 &&
+              memcmp(fa.data, fb.data, fa.count * sizeof(FlatData)) == 0 &&
+              memcmp(fa.extra, fb.extra,
+                     fa.extra_count * sizeof(uint32_t)) == 0 &&
+              memcmp(fa.strings, fb.strings, fa.strings_len) == 0;
+  free_flat_ast(&fa);
+  free_flat_ast(&fb);
+  return same;
+}
+
+// The parser's diagnostics as text, for the caller to free()
+static char *rendered(const Parser *parser) {
+  char *text;
+  size_t len;
+  FILE *out = open_memstream(&text, &len);
+  render_diagnostics(&parser->diags, &parser->lines, out);
+  fclose(out);
+  return text;
+}
+
+// Parse `src` with `workers` threads (0 for parse_program) and render the
+// diagnostics into *errors
+static Node *parse_workers(const char *src, size_t workers, Parser *parser,
+                           Lexer *lexer, char **errors) {
+  init_lexer(lexer, src, &raw_allocator);
+  init_parser(parser, lexer, &raw_allocator);
+  Node *prog = workers ? parse_program_parallel(parser, workers)
+                       : parse_program(parser);
+  *errors = rendered(parser);
+  return prog;
+}
+
+TEST(parallel_matches_sequential) {
+  char *src = generated_module(600);
+  Lexer seq_lexer, par_lexer;
+  Parser seq, par;
+  char *seq_errors, *par_errors;
+  Node *expected = parse_workers(src, 0, &seq, &seq_lexer, &seq_errors);
+  Node *prog = parse_workers(src, 4, &par, &par_lexer, &par_errors);
+
+  ASSERT_FALSE(par.had_error);
+  ASSERT_STR_EQ(par_errors, "");
+  ASSERT_EQ(prog->as.program.decls.count, 600);
+  ASSERT_TRUE(same_flat(prog, expected));
+  ASSERT_EQ(prog->hash, expected->hash);
+  ASSERT_EQ(par.current.type, TOKEN_EOF);
+
+  free_node(&raw_allocator, expected);
+  free_node(&raw_allocator, prog);
+  free_parser(&seq);
+  free_parser(&par);
+  free(seq_errors);
+  free(par_errors);
+  free(src);
+  return true;
+}
+
+TEST(parallel_types_shared_across_pieces) {
+  char *src = generated_module(600);
+  Lexer lexer;
+  Parser p;
+  char *errors;
+  Node *prog = parse_workers(src, 4, &p, &lexer, &errors);
+  ASSERT_FALSE(p.had_error);
+
+  // f1 and f595 land in different pieces; so does g3
+  NodeList *decls = &prog->as.program.decls;
+  Node *i32 = decls->items[1]->as.fn.ret_type;
+  ASSERT_EQ(i32->kind, NODE_TYPE_NAME);
+  ASSERT_TRUE(decls->items[595]->as.fn.ret_type == i32);
+  ASSERT_TRUE(decls->items[3]->as.let.type == i32);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  free(errors);
+  free(src);
+  return true;
+}
+
+TEST(parallel_errors_match_sequential) {
+  char *src = generated_module(300);
+  memcpy(strstr(src, "let g147") + 4, "147", 3); // let 147: i32 = ...
+  Lexer seq_lexer, par_lexer;
+  Parser seq, par;
+  char *seq_errors, *par_errors;
+  Node *expected = parse_workers(src, 0, &seq, &seq_lexer, &seq_errors);
+  Node *prog = parse_workers(src, 3, &par, &par_lexer, &par_errors);
+
+  ASSERT_TRUE(par.had_error);
+  ASSERT_TRUE(strstr(par_errors, "[line ") == par_errors);
+  ASSERT_STR_EQ(par_errors, seq_errors);
+  ASSERT_TRUE(same_flat(prog, expected));
+
+  free_node(&raw_allocator, expected);
+  free_node(&raw_allocator, prog);
+  free_parser(&seq);
+  free_parser(&par);
+  free(seq_errors);
+  free(par_errors);
+  free(src);
+  return true;
+}
+
+TEST(parallel_small_and_lazy) {
+  // Fewer declarations than workers
+  Lexer lexer;
+  Parser p;
+  char *errors;
+  init_lexer(&lexer, "pub fn f() { return 1; }", &raw_allocator);
+  init_parser(&p, &lexer, &raw_allocator);
+  p.lazy_fn_bodies = true;
+  Node *prog = parse_program_parallel(&p, 8);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(prog->as.program.decls.count, 1);
+  Node *body = parse_fn_body(&p, prog->as.program.decls.items[0]);
+  ASSERT_EQ(body->as.block.stmts.count, 1);
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+
+  char *src = generated_module(60);
+  prog = parse_workers(src, 5, &p, &lexer, &errors);
+  ASSERT_EQ(prog->as.program.decls.count, 60);
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  free(errors);
+  free(src);
+  return true;
+}
+
+// Reparse `src` into `state` and check the result against a fresh parse
+static bool reparse_matches_fresh(const char *src, IncrementalParse *state) {
+  Lexer lexer, fresh_lexer;
+  Parser p, fresh;
+  char *fresh_errors;
+  init_lexer(&lexer, src, &raw_allocator);
+  init_parser(&p, &lexer, &raw_allocator);
+  Node *prog = parse_incremental(&p, state);
+  char *errors = rendered(&p);
+  Node *expected = parse_workers(src, 0, &fresh, &fresh_lexer, &fresh_errors);
+
+  bool same = prog == state->program && p.had_error == fresh.had_error &&
+              strcmp(errors, fresh_errors) == 0 && same_flat(prog, expected) &&
+              prog->hash == expected->hash;
+  free_node(&raw_allocator, expected);
+  free_parser(&p);
+  free_parser(&fresh);
+  free(errors);
+  free(fresh_errors);
+  return same;
+}
+
+// `src` with the first `old` replaced by `new`
+static char *edit(const char *src, const char *old, const char *new) {
+  const char *at = strstr(src, old);
+  size_t head = (size_t)(at - src), len = strlen(src);
+  char *out = malloc(len - strlen(old) + strlen(new) + 1);
+  memcpy(out, src, head);
+  strcpy(out + head, new);
+  strcat(out, at + strlen(old));
+  return out;
+}
+
+TEST(incremental_reuses_unchanged_decls) {
+  IncrementalParse state;
+  init_incremental(&state);
+  char *v1 = generated_module(300);
+  ASSERT_TRUE(reparse_matches_fresh(v1, &state));
+  ASSERT_EQ(state.reused, 0);
+  ASSERT_EQ(state.count, 300);
+  Node *before = state.spans[200].decl;
+
+  // Change one fn's body and add lines to it, moving everything below
+  char *v2 = edit(v1, "a * 145;", "a * 9;\n\n  x = x + 1;");
+  ASSERT_TRUE(reparse_matches_fresh(v2, &state));
+  ASSERT_EQ(state.reused, 299);
+  ASSERT_TRUE(state.spans[200].decl == before);
+  ASSERT_EQ(state.spans[200].line, before->line);
+
+  // Delete a declaration
+  char *v3 = edit(v2, "let g3: i32 = 3;\n", "");
+  ASSERT_TRUE(reparse_matches_fresh(v3, &state));
+  ASSERT_EQ(state.reused, 299);
+  ASSERT_EQ(state.count, 299);
+
+  free_incremental(&raw_allocator, &state);
+  free(v1);
+  free(v2);
+  free(v3);
+  return true;
+}
+
+TEST(incremental_types_stay_shared) {
+  IncrementalParse state;
+  init_incremental(&state);
+  char *v1 = generated_module(60);
+  ASSERT_TRUE(reparse_matches_fresh(v1, &state));
+  size_t types = state.types.count;
+
+  // The reparsed f7 shares its types with the reused f1
+  char *v2 = edit(v1, "a * 7;", "a * 7; let s: ^Gone = null;");
+  ASSERT_TRUE(reparse_matches_fresh(v2, &state));
+  ASSERT_EQ(state.reused, 59);
+  ASSERT_TRUE(state.spans[7].decl->as.fn.ret_type ==
+              state.spans[1].decl->as.fn.ret_type);
+  ASSERT_EQ(state.types.count, types + 2);
+
+  // Gone and ^Gone leave the table with the last declaration using them
+  ASSERT_TRUE(reparse_matches_fresh(v1, &state));
+  ASSERT_EQ(state.types.count, types);
+
+  free_incremental(&raw_allocator, &state);
+  free(v1);
+  free(v2);
+  return true;
+}
+
+TEST(incremental_errors_parse_whole_source) {
+  IncrementalParse state;
+  init_incremental(&state);
+  char *v1 = generated_module(60);
+  ASSERT_TRUE(reparse_matches_fresh(v1, &state));
+
+  char *broken = edit(v1, "let x = a * 7;", "let x = a * ;");
+  ASSERT_TRUE(reparse_matches_fresh(broken, &state));
+  ASSERT_EQ(state.count, 0);
+
+  // Nothing to reuse right after an error, then back to normal
+  ASSERT_TRUE(reparse_matches_fresh(v1, &state));
+  ASSERT_EQ(state.reused, 0);
+  char *v2 = edit(v1, "import std0;", "import io;");
+  ASSERT_TRUE(reparse_matches_fresh(v2, &state));
+  ASSERT_EQ(state.reused, 59);
+
+  free_incremental(&raw_allocator, &state);
+  free(v1);
+  free(broken);
+  free(v2);
+  return true;
+}
+
+TEST(incremental_compares_bytes_not_just_hashes) {
+  // Under the old word-wise FNV these two hashed the same, so the stale
+  // declaration was taken over; now the bytes themselves are compared too
+  IncrementalParse state;
+  init_incremental(&state);
+  ASSERT_TRUE(reparse_matches_fresh("fn f() i32 { return xxxxxxxxxxxxxxx; }",
+                                    &state));
+  ASSERT_TRUE(reparse_matches_fresh("fn f() i32 { return xxxdxxxxxxxtxxx; }",
+                                    &state));
+  ASSERT_EQ(state.reused, 0);
+  Node *ret = first_fn_stmt(state.program, 0);
+  ASSERT_STR_EQ(ret->as.ret.val->as.ident.name, "xxxdxxxxxxxtxxx");
+  free_incremental(&raw_allocator, &state);
+  return true;
+}
+
+TEST(incremental_missing_type_name) {
+  // The type name that isn't there mustn't take the text of the token before
+  IncrementalParse state;
+  init_incremental(&state);
+  ASSERT_TRUE(reparse_matches_fresh("fn f(x: i32) i32 { return x; }", &state));
+  ASSERT_TRUE(
+      reparse_matches_fresh("fn f(x: i3=2) i32 { return x; }", &state));
+  ASSERT_TRUE(reparse_matches_fresh("let a: 2 = 1;", &state));
+  free_incremental(&raw_allocator, &state);
+  return true;
+}
+
+TEST(incremental_lazy_bodies_follow_their_source) {
+  IncrementalParse state;
+  init_incremental(&state);
+  const char *v1 = "fn f() { return 1; }\nfn g() { return 2; }\n";
+  const char *v2 = "import io;\nfn f() { return 1; }\nfn g() { return 2; }\n";
+  Lexer lexer;
+  Parser p;
+  init_lexer(&lexer, v1, &raw_allocator);
+  init_parser(&p, &lexer, &raw_allocator);
+  p.lazy_fn_bodies = true;
+  parse_incremental(&p, &state);
+  free_parser(&p);
+
+  init_lexer(&lexer, v2, &raw_allocator);
+  init_parser(&p, &lexer, &raw_allocator);
+  p.lazy_fn_bodies = true;
+  Node *prog = parse_incremental(&p, &state);
+  ASSERT_EQ(state.reused, 2);
+  Node *g = prog->as.program.decls.items[2];
+  ASSERT_EQ(g->line, 3);
+  Node *body = parse_fn_body(&p, g);
+  ASSERT_FALSE(p.had_error);
+  Node *ret = body->as.block.stmts.items[0];
+  ASSERT_EQ(ret->as.ret.val->as.integer.val, 2);
+  free_parser(&p);
+
+  free_incremental(&raw_allocator, &state);
+  return true;
+}
+
+// Every kind of node, to check that none leaves the parser unhashed
+static const char *EVERY_KIND_PROGRAM =
+    "import io;\n"
+    "type P = ^[4][]i32;\n"
+    "type S = struct { a: []u8, b: ^S }\n"
+    "pub type U = union { i: i64, f: f64 }\n"
+    "type E = enum { A = 1, B }\n"
+    "const limit = 10;\n"
+    "pub fn f(a: i32, s: ^S) i32 {\n"
+    "  let x: [a]i32 = heap -a * (a + 1.5) - s.b[2]++;\n"
+    "  if x > 1 { return x; } else if !true { x += 2; } else { x = null; }\n"
+    "  while x < 10 { x = f(x, s); break; }\n"
+    "  do { continue; } while false;\n"
+    "  for let i = 0; i < 3; i++ { \"str\"; }\n"
+    "  return g();\n"
+    "}\n";
+
+TEST(hashes_cover_every_node) {
+  WITH_PARSE(EVERY_KIND_PROGRAM, prog, p);
+  ASSERT_FALSE(p.had_error);
+  SubtreeIndex index;
+  init_subtree_index(&index);
+  ASSERT_TRUE(index_subtrees(&raw_allocator, &index, prog));
+
+  // Rehashing from the children's stored hashes changes nothing, so every
+  // node was hashed, and after its children
+  bool seen[NODE_PROGRAM + 1] = {false};
+  for (size_t i = 0; i < index.entry_count; i++) {
+    Node *node = (Node *)index.entries[i].node;
+    uint64_t hash = node->hash;
+    hash_node(node);
+    ASSERT_EQ(node->hash, hash);
+    seen[node->kind] = true;
+  }
+  for (int kind = 0; kind <= NODE_PROGRAM; kind++)
+    ASSERT_TRUE(seen[kind]);
+
+  free_subtree_index(&raw_allocator, &index);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(hashes_ignore_lines) {
+  WITH_PARSE("fn f(a: i32) i32 { return a + 1; }", a, pa);
+  WITH_PARSE("\n\nfn f(a: i32)\n  i32 {\n  return a +\n 1;\n}\n", b, pb);
+  WITH_PARSE("fn f(a: i32) i32 { return a + 2; }", c, pc);
+  WITH_PARSE("fn f(a: i32) i32 { return 1 + a; }", d, pd);
+
+  ASSERT_EQ(a->hash, b->hash);
+  ASSERT_NEQ(a->hash, c->hash);
+  ASSERT_NEQ(a->hash, d->hash);
+  Node *fa = a->as.program.decls.items[0];
+  Node *fb = b->as.program.decls.items[0];
+  ASSERT_NEQ(fa->line, fb->line);
+  ASSERT_EQ(fa->hash, fb->hash);
+
+  TEARDOWN(a, pa);
+  TEARDOWN(b, pb);
+  TEARDOWN(c, pc);
+  TEARDOWN(d, pd);
+  return true;
+}
+
+TEST(hashes_tell_near_identical_names_apart) {
+  // A byte-wise hash without a finalizer let these two collide
+  WITH_PARSE("fn f() i32 { return counter_value_xx; }\n"
+             "fn f() i32 { return countertvalue_xi; }\n",
+             prog, p);
+  SubtreeIndex index;
+  init_subtree_index(&index);
+  ASSERT_TRUE(index_subtrees(&raw_allocator, &index, prog));
+
+  NodeList *decls = &prog->as.program.decls;
+  ASSERT_NEQ(decls->items[0]->hash, decls->items[1]->hash);
+  const Node *found[2];
+  ASSERT_EQ(find_subtrees(&index, decls->items[0]->hash, found, 2), 1);
+
+  ASSERT_NEQ(hash_bytes("xxxxxxxxxxxxxxx", 15),
+             hash_bytes("xxxdxxxxxxxtxxx", 15));
+  ASSERT_NEQ(hash_bytes("ab", 2), hash_bytes("ab\0", 3));
+
+  free_subtree_index(&raw_allocator, &index);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(duplicate_functions_found_by_hash) {
+  WITH_PARSE("fn a(x: i32) i32 { return x * 2; }\n"
+             "fn b(y: i32) i32 { return y * 2; }\n"
+             "fn c(x: i32) i32 { return x * 2; }\n",
+             prog, p);
+  SubtreeIndex index;
+  init_subtree_index(&index);
+  ASSERT_TRUE(index_subtrees(&raw_allocator, &index, prog));
+
+  NodeList *decls = &prog->as.program.decls;
+  const Node *found[4];
+  ASSERT_EQ(find_subtrees(&index, decls->items[0]->as.fn.body->hash, found, 4),
+            2);
+  ASSERT_TRUE(found[0] == decls->items[2]->as.fn.body);
+  ASSERT_TRUE(found[1] == decls->items[0]->as.fn.body);
+
+  // The names differ, so the functions themselves don't match
+  ASSERT_EQ(find_subtrees(&index, decls->items[0]->hash, found, 4), 1);
+  ASSERT_EQ(find_subtrees(&index, decls->items[0]->hash + 1, found, 4), 0);
+
+  // i32 is one interned node, whatever uses it
+  Node *i32 = decls->items[0]->as.fn.ret_type;
+  ASSERT_EQ(find_subtrees(&index, i32->hash, found, 4), 1);
+  ASSERT_TRUE(found[0] == i32);
+
+  free_subtree_index(&raw_allocator, &index);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(lazy_body_hash_matches_eager) {
+  WITH_PARSE(README_PROGRAM, eager, pe);
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy(README_PROGRAM, &p, &lexer, &raw_allocator);
+
+  Node *eager_fn = eager->as.program.decls.items[1];
+  Node *lazy_fn = prog->as.program.decls.items[1];
+  ASSERT_NEQ(lazy_fn->hash, eager_fn->hash);
+  parse_fn_body(&p, lazy_fn);
+  ASSERT_EQ(lazy_fn->hash, eager_fn->hash);
+
+  // The program follows its functions as their bodies arrive
+  NodeList *decls = &prog->as.program.decls;
+  for (size_t i = 0; i < decls->count; i++)
+    parse_fn_body(&p, decls->items[i]);
+  ASSERT_EQ(prog->hash, eager->hash);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  TEARDOWN(eager, pe);
+  return true;
+}
+
+TEST(lazy_bodies_hash_by_their_text) {
+  Lexer lexer;
+  Parser p;
+  Node *prog = parse_lazy("fn f() { return 1; }\nfn f() { return 2; }\n"
+                          "fn f() { return 1; }",
+                          &p, &lexer, &raw_allocator);
+  NodeList *decls = &prog->as.program.decls;
+  ASSERT_NEQ(decls->items[0]->hash, decls->items[1]->hash);
+  ASSERT_EQ(decls->items[0]->hash, decls->items[2]->hash);
+
+  uint64_t before = prog->hash;
+  parse_fn_body(&p, decls->items[1]);
+  ASSERT_NEQ(prog->hash, before);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&p);
+  return true;
+}
+
+// Records what a walk saw, as kind numbers with pre/post marks
+typedef struct WalkLog {
+  char text[256];
+  size_t len;
+  NodeKind skip; // pre skips nodes of this kind
+  NodeKind stop; // pre stops at nodes of this kind
+  size_t nodes;
+  size_t max_depth;
+} WalkLog;
+
+static void walk_log(WalkLog *log, const char *fmt, const char *name) {
+  size_t room = sizeof(log->text) - log->len;
+  log->len += (size_t)snprintf(log->text + log->len, room, fmt, name);
+}
+
+static WalkStep log_pre(Node *node, const WalkPos *pos, void *ctx) {
+  WalkLog *log = (WalkLog *)ctx;
+  if (node == NULL) {
+    walk_log(log, "-%s ", pos->slot->name);
+    return WALK_CONTINUE;
+  }
+  walk_log(log, "(%s ", node_kind_to_string(node->kind));
+  if (node->kind == log->stop)
+    return WALK_STOP;
+  return node->kind == log->skip ? WALK_SKIP : WALK_CONTINUE;
+}
+
+static WalkStep log_post(Node *node, const WalkPos *pos, void *ctx) {
+  (void)pos;
+  walk_log((WalkLog *)ctx, ")%s ", node_kind_to_string(node->kind));
+  return WALK_CONTINUE;
+}
+
+static const char *walk_text(Node *root, NodeKind skip, NodeKind stop,
+                             bool nulls, WalkLog *log) {
+  *log = (WalkLog){.skip = skip, .stop = stop};
+  AstVisitor visitor = {log_pre, log_post, log, nulls};
+  walk_ast(&raw_allocator, root, &visitor);
+  return log->text;
+}
+
+TEST(walk_visits_pre_and_post_in_order) {
+  WITH_PARSE("fn f() { return a + 1; }", prog, p);
+  Node *ret = first_fn_stmt(prog, 0);
+  WalkLog log;
+  ASSERT_STR_EQ(walk_text(ret, NODE_PROGRAM, NODE_PROGRAM, false, &log),
+                "(Return (Binary (Ident )Ident (IntLit )IntLit )Binary "
+                ")Return ");
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(walk_skips_and_stops) {
+  WITH_PARSE("fn f() { g(a + 1, b); return c; }", prog, p);
+  Node *body = prog->as.program.decls.items[0]->as.fn.body;
+  WalkLog log;
+  ASSERT_STR_EQ(walk_text(body, NODE_BINARY, NODE_PROGRAM, false, &log),
+                "(Block (ExprStmt (Call (Ident )Ident (Binary (Ident )Ident "
+                ")Call )ExprStmt (Return (Ident )Ident )Return )Block ");
+  ASSERT_STR_EQ(walk_text(body, NODE_PROGRAM, NODE_BINARY, false, &log),
+                "(Block (ExprStmt (Call (Ident )Ident (Binary ");
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(walk_reports_empty_slots_when_asked) {
+  WITH_PARSE("fn f() { let x; return; }", prog, p);
+  Node *body = prog->as.program.decls.items[0]->as.fn.body;
+  WalkLog log;
+  ASSERT_STR_EQ(walk_text(body, NODE_PROGRAM, NODE_PROGRAM, false, &log),
+                "(Block (Let )Let (Return )Return )Block ");
+  ASSERT_STR_EQ(walk_text(body, NODE_PROGRAM, NODE_PROGRAM, true, &log),
+                "(Block (Let -type -init )Let (Return -val )Return )Block ");
+  TEARDOWN(prog, p);
+  return true;
+}
+
+static WalkStep check_pos(Node *node, const WalkPos *pos, void *ctx) {
+  WalkLog *log = (WalkLog *)ctx;
+  log->nodes++;
+  if (pos->depth > log->max_depth)
+    log->max_depth = pos->depth;
+  if (pos->parent == NULL)
+    return pos->depth == 0 && node->kind == NODE_PROGRAM ? WALK_CONTINUE
+                                                         : WALK_STOP;
+  // The position leads back from the parent to the node
+  const ChildSlot *slot = pos->slot;
+  Node *back = slot->flags & CHILD_LIST
+                   ? slot_list(pos->parent, slot)->items[pos->index]
+                   : slot_node(pos->parent, slot);
+  return back == node ? WALK_CONTINUE : WALK_STOP;
+}
+
+TEST(walk_positions_lead_back_to_nodes) {
+  WITH_PARSE(EVERY_KIND_PROGRAM, prog, p);
+  WalkLog log = {0};
+  AstVisitor visitor = {check_pos, NULL, &log, false};
+  ASSERT_TRUE(walk_ast(&raw_allocator, prog, &visitor));
+
+  // Stopping early would leave nodes unvisited; there are more visits than
+  // index entries because interned types are met once per use
+  SubtreeIndex index;
+  init_subtree_index(&index);
+  ASSERT_TRUE(index_subtrees(&raw_allocator, &index, prog));
+  ASSERT_TRUE(log.nodes > index.entry_count);
+  Node *fn = prog->as.program.decls.items[6];
+  ASSERT_EQ(find_subtrees(&index, fn->hash, NULL, 0), 1);
+  free_subtree_index(&raw_allocator, &index);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(deep_tree_walked_and_freed_without_recursion) {
+  char *negs = repeat_around("- ", 300000, "x", "");
+  size_t len = strlen(negs) + 32;
+  char *src = malloc(len);
+  snprintf(src, len, "fn f() { %s; }", negs);
+
+  Lexer lexer;
+  Parser parser;
+  Node *prog = parse_limited(src, 1000000, &raw_allocator, &parser, &lexer);
+  ASSERT_FALSE(parser.had_error);
+  WalkLog log = {0};
+  AstVisitor visitor = {check_pos, NULL, &log, false};
+  ASSERT_TRUE(walk_ast(&raw_allocator, prog, &visitor));
+  // Program, fn, block, statement, the negations and x
+  ASSERT_EQ(log.nodes, 300005);
+  ASSERT_EQ(log.max_depth, 300004);
+
+  free_node(&raw_allocator, prog);
+  free_parser(&parser);
+  free(negs);
+  free(src);
+  return true;
+}
+
+static const char *DUMP_PROGRAM = "import io;\n"
+                                  "fn f(a: i32) {\n"
+                                  "  g(a.b, 1.5, \"s\");\n"
+                                  "  return;\n"
+                                  "}\n"
+                                  "type E = enum { A = 1, B }\n";
+
+// The dump of `src` in `format`, owned by the caller
+static char *dump_src(const char *src, AstFormat format) {
+  WITH_PARSE(src, prog, p);
+  AstWriter writer;
+  init_memory_writer(&writer, &raw_allocator);
+  bool ok = dump_ast(&writer, prog, format) && !p.had_error;
+  char *text = ok ? strdup(writer.buf) : NULL;
+  free_ast_writer(&writer);
+  TEARDOWN(prog, p);
+  return text;
+}
+
+TEST(dump_sexpr) {
+  char *text = dump_src(DUMP_PROGRAM, AST_FORMAT_SEXPR);
+  ASSERT_STR_EQ(text,
+                "(Program [(Import io) (Fn f [(Param a (TypeName i32))] nil "
+                "(Block [(ExprStmt (Call (Ident g) [(Member b (Ident a)) "
+                "(FloatLit 1.5) (StringLit \"s\")])) (Return nil)])) "
+                "(TypeDecl E (Enum [(EnumVariant A (IntLit 1)) "
+                "(EnumVariant B nil)]))])\n");
+  free(text);
+  return true;
+}
+
+TEST(dump_json) {
+  char *text = dump_src("fn f() {}\nlet x = -\"q\\\\\";", AST_FORMAT_JSON);
+  ASSERT_STR_EQ(text,
+                "{\"kind\":\"Program\",\"line\":1,\"decls\":["
+                "{\"kind\":\"Fn\",\"line\":1,\"pub\":false,\"name\":\"f\","
+                "\"params\":[],\"ret_type\":null,"
+                "\"body\":{\"kind\":\"Block\",\"line\":1,\"stmts\":[]}},"
+                "{\"kind\":\"Let\",\"line\":2,\"const\":false,\"name\":\"x\","
+                "\"type\":null,\"init\":{\"kind\":\"Unary\",\"line\":2,"
+                "\"op\":\"MINUS\",\"operand\":{\"kind\":\"StringLit\","
+                "\"line\":2,\"value\":\"q\\\\\\\\\"}}}]}\n");
+  free(text);
+  return true;
+}
+
+TEST(dump_tree) {
+  char *text = dump_src("fn f(a: i32) { return a; }", AST_FORMAT_TREE);
+  ASSERT_STR_EQ(text, "Program\n"
+                      "  decls:\n"
+                      "    Fn f\n"
+                      "      params:\n"
+                      "        Param a\n"
+                      "          type:\n"
+                      "            TypeName i32\n"
+                      "      Block\n"
+                      "        stmts:\n"
+                      "          Return\n"
+                      "            val:\n"
+                      "              Ident a\n");
+  free(text);
+  return true;
+}
+
+TEST(dump_to_file_matches_memory) {
+  char *json = dump_src(EVERY_KIND_PROGRAM, AST_FORMAT_JSON);
+  ASSERT_NOT_NULL(json);
+  WITH_PARSE(EVERY_KIND_PROGRAM, prog, p);
+  FILE *file = tmpfile();
+  AstWriter writer;
+  init_file_writer(&writer, file);
+  ASSERT_TRUE(dump_ast(&writer, prog, AST_FORMAT_JSON));
+
+  size_t len = strlen(json);
+  char *back = malloc(len + 1);
+  rewind(file);
+  ASSERT_EQ(fread(back, 1, len + 1, file), len);
+  ASSERT_TRUE(memcmp(back, json, len) == 0);
+
+  fclose(file);
+  free(back);
+  free(json);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+// Messages from a sink, each followed by a newline
+typedef struct SinkText {
+  char *text;
+  size_t len;
+  size_t messages;
+} SinkText;
+
+static void collect_log(void *context, const char *fmt, va_list args) {
+  SinkText *sink = (SinkText *)context;
+  va_list copy;
+  va_copy(copy, args);
+  size_t n = (size_t)vsnprintf(NULL, 0, fmt, copy);
+  va_end(copy);
+  sink->text = realloc(sink->text, sink->len + n + 2);
+  vsnprintf(sink->text + sink->len, n + 1, fmt, args);
+  sink->len += n;
+  sink->text[sink->len++] = '\n';
+  sink->text[sink->len] = '\0';
+  sink->messages++;
+}
+
+static bool sink_dump(Node *prog, AstFormat format, SinkText *out) {
+  *out = (SinkText){0};
+  LogSink sink = {collect_log, out};
+  AstWriter writer;
+  init_sink_writer(&writer, &sink);
+  return dump_ast(&writer, prog, format);
+}
+
+TEST(dump_to_sink_by_line) {
+  char *tree = dump_src(EVERY_KIND_PROGRAM, AST_FORMAT_TREE);
+  ASSERT_NOT_NULL(tree);
+  WITH_PARSE(EVERY_KIND_PROGRAM, prog, p);
+  SinkText out;
+  ASSERT_TRUE(sink_dump(prog, AST_FORMAT_TREE, &out));
+  ASSERT_STR_EQ(out.text, tree);
+  size_t lines = 0;
+  for (const char *c = tree; *c; c++)
+    lines += *c == '\n';
+  ASSERT_EQ(out.messages, lines);
+
+  free(out.text);
+  free(tree);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(dump_long_line_to_sink_in_pieces) {
+  // Far more than AST_WRITER_BUFFER of JSON on its one line
+  size_t count = 2000;
+  char *src = malloc(count * 16 + 1);
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++)
+    len += (size_t)sprintf(src + len, "let v%zu = 1;\n", i);
+  char *json = dump_src(src, AST_FORMAT_JSON);
+  ASSERT_NOT_NULL(json);
+  ASSERT_TRUE(strlen(json) > 4 * AST_WRITER_BUFFER);
+
+  WITH_PARSE(src, prog, p);
+  SinkText out;
+  ASSERT_TRUE(sink_dump(prog, AST_FORMAT_JSON, &out));
+  ASSERT_TRUE(out.messages > 4);
+  size_t joined = 0;
+  for (size_t i = 0; i < out.len; i++)
+    if (out.text[i] != '\n')
+      out.text[joined++] = out.text[i];
+  ASSERT_EQ(joined, strlen(json) - 1);
+  ASSERT_TRUE(memcmp(out.text, json, joined) == 0);
+
+  free(out.text);
+  free(json);
+  free(src);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(dump_deep_tree) {
+  char *negs = repeat_around("- ", 300000, "x", "");
+  size_t len = strlen(negs) + 32;
+  char *src = malloc(len);
+  snprintf(src, len, "fn f() { %s; }", negs);
+
+  Lexer lexer;
+  Parser parser;
+  Node *prog = parse_limited(src, 1000000, &raw_allocator, &parser, &lexer);
+  ASSERT_FALSE(parser.had_error);
+  AstWriter writer;
+  init_memory_writer(&writer, &raw_allocator);
+  ASSERT_TRUE(dump_ast(&writer, prog, AST_FORMAT_SEXPR));
+  const char *unary = "(Unary MINUS ";
+  ASSERT_TRUE(strstr(writer.buf, "(Block [(ExprStmt (Unary MINUS (Unary"));
+  ASSERT_EQ(writer.len, strlen("(Program [(Fn f [] nil (Block [(ExprStmt "
+                               "(Ident x))]))])\n") +
+                            300000 * (strlen(unary) + 1));
+
+  free_ast_writer(&writer);
+  free_node(&raw_allocator, prog);
+  free_parser(&parser);
+  free(negs);
+  free(src);
+  return true;
+}
+
 TEST(error_missing_semicolon) {
   WITH_PARSE("fn f() { let x = 1 }", prog, p);
   ASSERT_TRUE(p.had_error); // missing ';' is reported
@@ -461,6 +1913,82 @@ TEST(error_recovers_and_continues) {
   return true;
 }
 
+TEST(diagnostics_are_structured) {
+  WITH_PARSE("fn f() { let x = 1 }\nfn g() { return @; }\nimport", prog, p);
+  ASSERT_EQ(p.diags.count, 4);
+
+  const Diagnostic *missing_semi = &p.diags.items[0];
+  ASSERT_EQ(missing_semi->kind, DIAG_SYNTAX_ERROR);
+  ASSERT_EQ(missing_semi->id, DIAG_EXPECTED_SEMI_AFTER_VAR);
+  ASSERT_EQ(missing_semi->offset, 19); // the '}'
+  ASSERT_EQ(missing_semi->length, 1);
+  ASSERT_NULL(missing_semi->arg);
+
+  const Diagnostic *keyword = &p.diags.items[1]; // `fn` while recovering
+  ASSERT_EQ(keyword->id, DIAG_EXPECTED_EXPR);
+  ASSERT_EQ(keyword->length, 2);
+  ASSERT_NULL(keyword->arg);
+
+  const Diagnostic *bad_char = &p.diags.items[2];
+  ASSERT_EQ(bad_char->kind, DIAG_LEX_ERROR);
+  ASSERT_EQ(bad_char->id, DIAG_BAD_TOKEN);
+  ASSERT_STR_EQ(bad_char->arg, "Unexpected character '@'.");
+
+  const Diagnostic *at_end = &p.diags.items[3];
+  ASSERT_EQ(at_end->id, DIAG_EXPECTED_MODULE_NAME);
+  ASSERT_EQ(at_end->length, 0);
+  ASSERT_STR_EQ(diag_message(at_end->id),
+                "Expected module name after 'import'.");
+
+  char *text = rendered(&p);
+  ASSERT_STR_EQ(text, "[line 1:20] Error: Expected ';' after variable "
+                      "declaration.\n"
+                      "[line 2:1] Error: Expected an expression.\n"
+                      "[line 2:17] Error: Unexpected character '@'.\n"
+                      "[line 3:7] Error at end: Expected module name after "
+                      "'import'.\n");
+  free(text);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(diagnostics_render_token_text) {
+  WITH_PARSE("fn f() { let 1 = x; }", prog, p);
+  ASSERT_EQ(p.diags.count, 1);
+  ASSERT_STR_EQ(p.diags.items[0].arg, "1");
+  char *text = rendered(&p);
+  ASSERT_STR_EQ(text, "[line 1:14] Error at '1': Expected variable name.\n");
+  free(text);
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(diagnostics_freed_with_parser) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+  Lexer lexer;
+  Parser p;
+  init_lexer(&lexer, "fn f( { @ } let 1; type = ; import", &counting);
+  init_parser(&p, &lexer, &counting);
+  Node *prog = parse_program(&p);
+  ASSERT_TRUE(p.diags.count >= 3);
+  free_node(&counting, prog);
+  free_parser(&p);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(error_recovery_always_makes_progress) {
+  // Each of these used to fail at the same token forever
+  WITH_PARSE("if a {} fn good() { a; ) b; }", prog, p);
+  ASSERT_TRUE(p.had_error);
+  Node *last = prog->as.program.decls.items[prog->as.program.decls.count - 1];
+  ASSERT_EQ(last->kind, NODE_FN);
+  ASSERT_STR_EQ(last->as.fn.name, "good");
+  TEARDOWN(prog, p);
+  return true;
+}
+
 TEST(no_leaks_on_valid_program) {
   // Silent sink: file_log with a NULL FILE* is a no-op, so the leak tracker
   // runs without flooding test output
@@ -486,6 +2014,166 @@ TEST(no_leaks_on_valid_program) {
   return true;
 }
 
+TEST(names_moved_from_tokens) {
+  // Each name is allocated once by the lexer and handed to the node, so
+  // nothing is left live after the tree and parser are freed
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  Lexer lexer;
+  init_lexer(&lexer, "fn main() { let s = \"hi\"; io.print(s); }",
+             &counting);
+  Parser parser;
+  init_parser(&parser, &lexer, &counting);
+  Node *prog = parse_program(&parser);
+  ASSERT_FALSE(parser.had_error);
+
+  Node *fn = prog->as.program.decls.items[0];
+  ASSERT_STR_EQ(fn->as.fn.name, "main");
+  Node *let = first_fn_stmt(prog, 0);
+  ASSERT_STR_EQ(let->as.let.name, "s");
+  ASSERT_STR_EQ(let->as.let.init->as.literal.text, "hi");
+  ASSERT_NULL(parser.previous.lexeme);
+
+  free_node(&counting, prog);
+  free_parser(&parser);
+  ASSERT_EQ(ctx.allocations, ctx.frees);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(lists_are_exactly_sized) {
+  WITH_PARSE("fn main() { f(1); g(h(2, 3), 4); }", prog, p);
+  ASSERT_FALSE(p.had_error);
+  ASSERT_EQ(prog->as.program.decls.cap, 1);
+
+  Node *fn = prog->as.program.decls.items[0];
+  ASSERT_NULL(fn->as.fn.params.items);
+  ASSERT_EQ(fn->as.fn.params.cap, 0);
+  ASSERT_EQ(fn->as.fn.body->as.block.stmts.cap, 2);
+
+  Node *call = first_fn_stmt(prog, 1)->as.expr_stmt.expr;
+  ASSERT_EQ(call->as.call.args.count, 2);
+  ASSERT_EQ(call->as.call.args.cap, 2);
+  Node *inner = call->as.call.args.items[0];
+  ASSERT_EQ(inner->as.call.args.cap, 2);
+  ASSERT_EQ(p.scratch.count, 0);
+
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(no_leaks_on_bad_call_args) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+
+  Lexer lexer;
+  init_lexer(&lexer, "fn main() { f(1, ); g(x); }", &counting);
+  Parser parser;
+  init_parser(&parser, &lexer, &counting);
+  Node *prog = parse_program(&parser);
+  ASSERT_TRUE(parser.had_error);
+  ASSERT_EQ(parser.scratch.count, 0);
+
+  free_node(&counting, prog);
+  free_parser(&parser);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(nodes_sized_by_kind) {
+  ASSERT_EQ(node_size(NODE_BREAK), 16); // kind, line and hash
+  ASSERT_TRUE(node_size(NODE_BREAK) < node_size(NODE_INT_LIT));
+  ASSERT_TRUE(node_size(NODE_IDENT) < node_size(NODE_BINARY));
+  ASSERT_TRUE(node_size(NODE_BINARY) < node_size(NODE_FN));
+  ASSERT_TRUE(node_size(NODE_FN) <= sizeof(Node));
+  ASSERT_EQ(node_size(NODE_STRUCT), node_size(NODE_UNION));
+
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+  Node *lit = new_node(&counting, NODE_INT_LIT, 1);
+  ASSERT_EQ(ctx.live, node_size(NODE_INT_LIT));
+  free_node(&counting, lit);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(memory_counted_by_kind) {
+  WITH_PARSE("fn f(a: i32, b: i32) i32 { return a + b; }", prog, p);
+  AstMemory memory;
+  ASSERT_TRUE(measure_ast_memory(&raw_allocator, prog, &memory));
+  ASSERT_EQ(memory.kinds[NODE_PARAM].nodes, 2);
+  ASSERT_EQ(memory.kinds[NODE_PARAM].string_bytes, 4);
+  ASSERT_EQ(memory.kinds[NODE_IDENT].nodes, 2);
+  ASSERT_EQ(memory.kinds[NODE_BINARY].node_bytes, node_size(NODE_BINARY));
+  // i32 is one interned node, used three times
+  ASSERT_EQ(memory.kinds[NODE_TYPE_NAME].nodes, 1);
+  ASSERT_EQ(memory.kinds[NODE_TYPE_NAME].string_bytes, 4);
+  ASSERT_EQ(memory.kinds[NODE_FN].list_bytes, 2 * sizeof(Node *));
+  ASSERT_EQ(memory.total.nodes, 10);
+  ASSERT_EQ(memory.total.string_bytes, 2 + 4 + 4 + 4);
+  ASSERT_EQ(memory.total.list_slack, 0);
+
+  // A list grown by pushing has room to spare
+  Node *body = prog->as.program.decls.items[0]->as.fn.body;
+  node_list_push(&raw_allocator, &body->as.block.stmts,
+                 new_node(&raw_allocator, NODE_BREAK, 1));
+  ASSERT_TRUE(measure_ast_memory(&raw_allocator, prog, &memory));
+  ASSERT_EQ(memory.kinds[NODE_BLOCK].list_bytes, 8 * sizeof(Node *));
+  ASSERT_EQ(memory.kinds[NODE_BLOCK].list_slack, 6);
+  ASSERT_EQ(memory.total.nodes, 11);
+
+  TEARDOWN(prog, p);
+  return true;
+}
+
+TEST(memory_matches_allocations) {
+  CountingContext ctx = {0};
+  Allocator counting = {counting_alloc, counting_realloc, counting_free, &ctx};
+  Lexer lexer;
+  init_lexer(&lexer, EVERY_KIND_PROGRAM, &counting);
+  Parser parser;
+  init_parser(&parser, &lexer, &counting);
+  Node *prog = parse_program(&parser);
+  ASSERT_FALSE(parser.had_error);
+  free_parser(&parser);
+
+  // With the parser gone, the tree is all that's left
+  AstMemory memory;
+  ASSERT_TRUE(measure_ast_memory(&raw_allocator, prog, &memory));
+  const KindMemory *total = &memory.total;
+  ASSERT_EQ(total->node_bytes + total->string_bytes + total->list_bytes,
+            ctx.live);
+
+  free_node(&counting, prog);
+  ASSERT_EQ(ctx.live, 0);
+  return true;
+}
+
+TEST(memory_report_lists_kinds) {
+  WITH_PARSE("fn f() { return 1; }\nfn g() {}\n", prog, p);
+  AstMemory memory;
+  ASSERT_TRUE(measure_ast_memory(&raw_allocator, prog, &memory));
+  SinkText out = {0};
+  LogSink sink = {collect_log, &out};
+  report_ast_memory(&sink, &memory, 2);
+
+  ASSERT_NOT_NULL(strstr(out.text, "\nFn                   2 "));
+  ASSERT_NOT_NULL(strstr(out.text, "\nIntLit               1 "));
+  ASSERT_NULL(strstr(out.text, "\nIdent "));
+  ASSERT_NOT_NULL(strstr(out.text, "\nTotal                7 "));
+  char line[64];
+  size_t bytes = memory.total.node_bytes + memory.total.string_bytes +
+                 memory.total.list_bytes;
+  snprintf(line, sizeof(line), "Bytes per line: %.1f (2 lines)\n",
+           (double)bytes / 2);
+  ASSERT_NOT_NULL(strstr(out.text, line));
+
+  free(out.text);
+  TEARDOWN(prog, p);
+  return true;
+}
+
 int main(void) {
   TEST_SUITE("Parser - Declarations");
   RUN_TEST(fn_simple);
@@ -495,6 +2183,7 @@ int main(void) {
 
   TEST_SUITE("Parser - Statements");
   RUN_TEST(let_with_type_and_init);
+  RUN_TEST(node_lines_from_offsets);
   RUN_TEST(const_decl);
   RUN_TEST(if_else);
   RUN_TEST(else_if_chain);
@@ -513,6 +2202,14 @@ int main(void) {
   RUN_TEST(call_member_chain);
   RUN_TEST(call_with_args);
   RUN_TEST(heap_expression);
+  RUN_TEST(prefix_binds_looser_than_postfix);
+  RUN_TEST(assignment_takes_whole_binary_target);
+  RUN_TEST(operators_share_their_level);
+
+  TEST_SUITE("Parser - Deep Nesting");
+  RUN_TEST(deep_nesting_within_limit);
+  RUN_TEST(million_deep_parens_with_raised_limit);
+  RUN_TEST(nesting_limit_reports_error);
 
   TEST_SUITE("Parser - Types");
   RUN_TEST(pointer_type);
@@ -522,16 +2219,85 @@ int main(void) {
   RUN_TEST(struct_type_decl);
   RUN_TEST(enum_type_decl);
   RUN_TEST(type_alias);
+  RUN_TEST(types_are_interned);
+  RUN_TEST(interned_types_outlive_either_owner);
 
   TEST_SUITE("Parser - Full Program");
   RUN_TEST(readme_program_parses);
 
+  TEST_SUITE("Parser - Lazy Function Bodies");
+  RUN_TEST(lazy_skips_bodies_keeps_signatures);
+  RUN_TEST(lazy_brace_matching);
+  RUN_TEST(lazy_body_errors_reported_on_demand);
+  RUN_TEST(lazy_body_lexical_errors_reported_once);
+  RUN_TEST(lazy_unbalanced_body_reported_once);
+
+  TEST_SUITE("Parser - Flat AST");
+  RUN_TEST(flat_fn_shape);
+  RUN_TEST(flat_literals_and_optional_children);
+  RUN_TEST(flat_is_one_allocation);
+  RUN_TEST(flat_long_operator_chain);
+
+  TEST_SUITE("Parser - AST Cache");
+  RUN_TEST(cache_round_trip);
+  RUN_TEST(cache_misses_on_other_sources);
+  RUN_TEST(cache_checks_payload_bounds);
+
+  TEST_SUITE("Parser - Parallel");
+  RUN_TEST(parallel_matches_sequential);
+  RUN_TEST(parallel_types_shared_across_pieces);
+  RUN_TEST(parallel_errors_match_sequential);
+  RUN_TEST(parallel_small_and_lazy);
+
+  TEST_SUITE("Parser - Incremental");
+  RUN_TEST(incremental_reuses_unchanged_decls);
+  RUN_TEST(incremental_types_stay_shared);
+  RUN_TEST(incremental_errors_parse_whole_source);
+  RUN_TEST(incremental_compares_bytes_not_just_hashes);
+  RUN_TEST(incremental_missing_type_name);
+  RUN_TEST(incremental_lazy_bodies_follow_their_source);
+
+  TEST_SUITE("Parser - Structural Hashes");
+  RUN_TEST(hashes_cover_every_node);
+  RUN_TEST(hashes_ignore_lines);
+  RUN_TEST(hashes_tell_near_identical_names_apart);
+  RUN_TEST(duplicate_functions_found_by_hash);
+  RUN_TEST(lazy_body_hash_matches_eager);
+  RUN_TEST(lazy_bodies_hash_by_their_text);
+
+  TEST_SUITE("Parser - AST Walker");
+  RUN_TEST(walk_visits_pre_and_post_in_order);
+  RUN_TEST(walk_skips_and_stops);
+  RUN_TEST(walk_reports_empty_slots_when_asked);
+  RUN_TEST(walk_positions_lead_back_to_nodes);
+  RUN_TEST(deep_tree_walked_and_freed_without_recursion);
+
+  TEST_SUITE("Parser - AST Dump");
+  RUN_TEST(dump_sexpr);
+  RUN_TEST(dump_json);
+  RUN_TEST(dump_tree);
+  RUN_TEST(dump_to_file_matches_memory);
+  RUN_TEST(dump_to_sink_by_line);
+  RUN_TEST(dump_long_line_to_sink_in_pieces);
+  RUN_TEST(dump_deep_tree);
+
   TEST_SUITE("Parser - Error Handling");
   RUN_TEST(error_missing_semicolon);
   RUN_TEST(error_recovers_and_continues);
+  RUN_TEST(error_recovery_always_makes_progress);
+  RUN_TEST(diagnostics_are_structured);
+  RUN_TEST(diagnostics_render_token_text);
+  RUN_TEST(diagnostics_freed_with_parser);
 
   TEST_SUITE("Parser - Memory");
   RUN_TEST(no_leaks_on_valid_program);
+  RUN_TEST(names_moved_from_tokens);
+  RUN_TEST(lists_are_exactly_sized);
+  RUN_TEST(no_leaks_on_bad_call_args);
+  RUN_TEST(nodes_sized_by_kind);
+  RUN_TEST(memory_counted_by_kind);
+  RUN_TEST(memory_matches_allocations);
+  RUN_TEST(memory_report_lists_kinds);
 
   TEST_SUMMARY();
   return TEST_EXIT_CODE();